@@ -0,0 +1,203 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "admission.h"
+#include "event_loop.h"
+#include "exec.h"
+#include "watchdog.h"
+
+#define NUM_PRIORITIES (NICE_MAX - NICE_MIN + 1)
+// Interval between two dispatch attempts while the load or the memory pressure is too high.
+#define RETRY_INTERVAL_S 1
+
+int max_jobs = 0;
+int max_load = 0;
+int max_mem_pressure = 0;
+
+// Queued jobs, one FIFO list (linked through job->next) per priority.
+static job_t *queue_head[NUM_PRIORITIES], *queue_tail[NUM_PRIORITIES];
+static int queued_count = 0;
+static int timer_fd = -1, timer_armed = 0;
+// Kept open to read the pressure with a single pread.
+static int pressure_fd = -1;
+
+enum capacity {
+    CAPACITY_OK, CAPACITY_SLOTS, CAPACITY_PRESSURE
+};
+
+static int memory_pressure(void) {
+    char buf[256];
+    if (pressure_fd == -1) pressure_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    if (pressure_fd == -1) return 0;
+    ssize_t n = pread(pressure_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    double avg10;
+    if (sscanf(buf, "some avg10=%lf", &avg10) != 1) return 0;
+    return (int) avg10;
+}
+
+static enum capacity check_capacity(job_list_t *job_list) {
+    if (max_jobs > 0 && job_list->running_bg >= max_jobs) return CAPACITY_SLOTS;
+    double load;
+    if (max_load > 0 && getloadavg(&load, 1) == 1 && load >= max_load) return CAPACITY_PRESSURE;
+    if (max_mem_pressure > 0 && memory_pressure() >= max_mem_pressure) return CAPACITY_PRESSURE;
+    return CAPACITY_OK;
+}
+
+static void timer_callback(int fd, unsigned int events, void *data) {
+    unsigned long long expirations;
+    while (read(fd, &expirations, sizeof(expirations)) > 0);
+    timer_armed = 0;
+    dispatch_jobs(data);
+}
+
+void init_admission(job_list_t *job_list) {
+    max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    job_list->dispatch = dispatch_jobs;
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) perror("timerfd_create");
+    else event_add(timer_fd, EPOLLIN, timer_callback, job_list);
+}
+
+void reset_admission(job_list_t *job_list) {
+    memset(queue_head, 0, sizeof(queue_head));
+    memset(queue_tail, 0, sizeof(queue_tail));
+    queued_count = 0;
+    timer_armed = 0;
+    // The timer is shared with the parent shell, which would lose its expirations.
+    if (timer_fd != -1) close(timer_fd);
+    job_list->dispatch = dispatch_jobs;
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd != -1) event_add(timer_fd, EPOLLIN, timer_callback, job_list);
+}
+
+int admit_job(job_list_t *job_list) {
+    // New jobs do not overtake the queued ones.
+    return queued_count == 0 && check_capacity(job_list) == CAPACITY_OK;
+}
+
+// Copy the arguments of the stages into one allocation (see job_t.queued_argv).
+static char **copy_stages(command_t *stages, int num_stages) {
+    size_t count = 1, bytes = 0;
+    for (int i = 0; i < num_stages; i++) {
+        count += stages[i].argc + 1;
+        for (int j = 0; j < stages[i].argc; j++) bytes += strlen(stages[i].args[j]) + 1;
+    }
+    char **argv = malloc(sizeof(char *) * count + bytes);
+    char *data = (char *) (argv + count);
+    size_t k = 0;
+    for (int i = 0; i < num_stages; i++) {
+        for (int j = 0; j < stages[i].argc; j++) {
+            size_t len = strlen(stages[i].args[j]) + 1;
+            memcpy(data, stages[i].args[j], len);
+            argv[k++] = data;
+            data += len;
+        }
+        argv[k++] = NULL;
+    }
+    argv[k] = NULL;
+    return argv;
+}
+
+// Rebuild the stages from a copy made by copy_stages (the array has to be freed).
+static command_t *unpack_stages(char **argv, int *num_stages) {
+    int n = 0;
+    for (int k = 0; argv[k] != NULL; k++) {
+        n++;
+        while (argv[k] != NULL) k++;
+    }
+    command_t *stages = malloc(sizeof(command_t) * (n ? n : 1));
+    n = 0;
+    for (int k = 0; argv[k] != NULL; k++) {
+        stages[n].args = &argv[k];
+        while (argv[k] != NULL) k++;
+        stages[n].argc = &argv[k] - stages[n].args;
+        stages[n].separator = '|';
+        // The arguments of a group are "(", its command line and ")".
+        int group = stages[n].argc == 3 && strcmp(stages[n].args[0], group_open) == 0 && strcmp(stages[n].args[2], group_close) == 0;
+        stages[n].group = group ? stages[n].args[1] : NULL;
+        n++;
+    }
+    *num_stages = n;
+    return stages;
+}
+
+job_t *queue_job(job_list_t *job_list, command_t *stages, int num_stages, const job_limits_t *limits, int priority) {
+    job_t *job = add_job(job_list, 0, QUEUED, stages[0].args);
+    for (int i = 1; i < num_stages; i++) add_job_process(job_list, job, 0, stages[i].args);
+    job->limits = *limits;
+    job->priority = priority;
+    job->queued_argv = copy_stages(stages, num_stages);
+    int p = priority - NICE_MIN;
+    job->next = NULL;
+    if (queue_tail[p] == NULL) queue_head[p] = job;
+    else queue_tail[p]->next = job;
+    queue_tail[p] = job;
+    queued_count++;
+    return job;
+}
+
+static void unqueue_job(job_t *job) {
+    int p = job->priority - NICE_MIN;
+    job_t *prev = NULL;
+    for (job_t *j = queue_head[p]; j != job; j = j->next) prev = j;
+    if (prev == NULL) queue_head[p] = job->next;
+    else prev->next = job->next;
+    if (queue_tail[p] == job) queue_tail[p] = prev;
+    job->next = NULL;
+    queued_count--;
+}
+
+int run_queued_job(job_list_t *job_list, job_t *job, int bg_process) {
+    unqueue_job(job);
+    set_job_state(job_list, job, bg_process ? BACKGROUND : FOREGROUND);
+    // The job starts running now.
+    time(&job->start_time);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    int num_stages;
+    command_t *stages = unpack_stages(job->queued_argv, &num_stages);
+    int started = start_job_processes(job_list, job, stages, num_stages, bg_process);
+    free(stages);
+    free(job->queued_argv);
+    job->queued_argv = NULL;
+    if (started == 0) {
+        // None of the commands could be started.
+        job->status = 127 << 8;
+        if (job->on_done != NULL) job->on_done(job, job->done_data);
+        delete_job(job_list, job);
+        return 127 << 8;
+    }
+    // The time limit of the job starts now.
+    if (job->timeout_ms > 0) set_deadline(job, job->timeout_ms, job->grace_ms);
+    return bg_process ? 0 : wait_for_job(job_list, job, 0);
+}
+
+void dispatch_jobs(job_list_t *job_list) {
+    while (queued_count > 0) {
+        enum capacity capacity = check_capacity(job_list);
+        if (capacity == CAPACITY_PRESSURE && timer_fd != -1 && !timer_armed) {
+            // Nothing may finish soon, so check the load and the memory pressure again later.
+            struct itimerspec retry = {{0, 0}, {RETRY_INTERVAL_S, 0}};
+            timerfd_settime(timer_fd, 0, &retry, NULL);
+            timer_armed = 1;
+        }
+        if (capacity != CAPACITY_OK) return;
+        int p = 0;
+        while (queue_head[p] == NULL) p++;
+        run_queued_job(job_list, queue_head[p], 1);
+    }
+}
+
+void cancel_queued_job(job_list_t *job_list, job_t *job) {
+    unqueue_job(job);
+    job->status = SIGTERM;
+    if (job->on_done != NULL) job->on_done(job, job->done_data);
+    else printf("[%d] Removed from the queue\n", job->pgid);
+    delete_job(job_list, job);
+}
@@ -0,0 +1,101 @@
+#include "job_control.h"
+#include "utils.h"
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+// Maximum number of running background jobs (0 for no limit, set with "set max_jobs <n>").
+extern int max_jobs;
+// 1-minute load average at which background jobs are queued (0 to ignore the load).
+extern int max_load;
+// Memory pressure ("some avg10" of /proc/pressure/memory, in percent) at which background jobs are queued (0 to ignore it).
+extern int max_mem_pressure;
+
+// Lowest and highest niceness, which are also the dispatch priority classes of queued jobs.
+#define NICE_MIN -20
+#define NICE_MAX 19
+
+/*
+ * Function: init_admission
+ * ------------------------
+ *   Set up the admission queue of background jobs: max_jobs defaults to the number of
+ *   online CPUs, and queued jobs are dispatched whenever children are reaped (and
+ *   retried every second while only the load or the memory pressure holds them back).
+ *
+ *   job_list: the job list
+ */
+void init_admission(job_list_t *job_list);
+
+/*
+ * Function: reset_admission
+ * -------------------------
+ *   Empty the admission queue in a forked subshell (whose job list was reset) and give
+ *   it its own retry timer in its own event loop.
+ *
+ *   job_list: the job list of the subshell
+ */
+void reset_admission(job_list_t *job_list);
+
+/*
+ * Function: admit_job
+ * -------------------
+ *   Check whether a new background job may start now: nothing is queued already,
+ *   fewer than max_jobs background jobs are running, and the load and memory
+ *   pressure are below their thresholds.
+ *
+ *   job_list: the job list
+ *
+ *   returns: 1 if the job may start, 0 if it has to be queued
+ */
+int admit_job(job_list_t *job_list);
+
+/*
+ * Function: queue_job
+ * -------------------
+ *   Add a QUEUED job with a copy of the pipeline, to be started later by dispatch_jobs.
+ *   Jobs are dispatched by priority (lowest niceness first), in order of arrival within a priority.
+ *
+ *   job_list: the job list
+ *   stages: the commands of the stages
+ *   num_stages: the number of stages
+ *   limits: the resource limits of the job
+ *   priority: the niceness of the job
+ *
+ *   returns: the queued job
+ */
+job_t *queue_job(job_list_t *job_list, command_t *stages, int num_stages, const job_limits_t *limits, int priority);
+
+/*
+ * Function: dispatch_jobs
+ * -----------------------
+ *   Start queued jobs in the background while there is room for them.
+ *
+ *   job_list: the job list
+ */
+void dispatch_jobs(job_list_t *job_list);
+
+/*
+ * Function: run_queued_job
+ * ------------------------
+ *   Take a job out of the queue and start it right away (waiting for it in the foreground).
+ *
+ *   job_list: the job list
+ *   job: the queued job
+ *   bg_process: whether the job runs in the background
+ *
+ *   returns: the wait status of a foreground job (-1 if it was stopped), 127 << 8 if it
+ *            could not be started, or 0 for a background job
+ */
+int run_queued_job(job_list_t *job_list, job_t *job, int bg_process);
+
+/*
+ * Function: cancel_queued_job
+ * ---------------------------
+ *   Take a job out of the queue and delete it, as if it was terminated by SIGTERM.
+ *
+ *   job_list: the job list
+ *   job: the queued job
+ */
+void cancel_queued_job(job_list_t *job_list, job_t *job);
+
+#endif
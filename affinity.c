@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "affinity.h"
+
+int autopin = 0;
+// Index, among the CPUs of the shell, of the CPU the next background job goes to.
+static int next_cpu = 0;
+
+static int parse_cpulist(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10), last;
+        if (end == p || first < 0) return -1;
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) return -1;
+        }
+        if (last >= CPU_SETSIZE) return -1;
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, set);
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+int next_autopin_cpu(void) {
+    cpu_set_t set;
+    // Ask again every time, the cpuset of the shell may have changed.
+    if (sched_getaffinity(0, sizeof(set), &set) == -1) return -1;
+    int count = CPU_COUNT(&set);
+    int index = next_cpu++ % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &set) && index-- == 0) return cpu;
+    return -1;
+}
+
+// Set the affinity of every thread of a process.
+static int pin_threads(pid_t pid, const cpu_set_t *set) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) return 0;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        if (sched_setaffinity(atoi(entry->d_name), sizeof(cpu_set_t), set) == 0) count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Get the process group of a process from /proc/<pid>/stat (-1 if it is gone).
+static pid_t get_pgid(pid_t pid) {
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // The command name may contain spaces and parentheses, the fields start after the last ')'.
+    char *p = strrchr(buf, ')');
+    int pgid;
+    if (p == NULL || sscanf(p + 1, " %*c %*d %d", &pgid) != 1) return -1;
+    return pgid;
+}
+
+int pin_process_group(pid_t pgid, const char *cpulist) {
+    cpu_set_t set;
+    if (parse_cpulist(cpulist, &set) == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+    DIR *proc = opendir("/proc");
+    if (proc == NULL) return -1;
+    int count = 0, error = 0;
+    struct dirent *entry;
+    while ((entry = readdir(proc)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+        pid_t pid = atoi(entry->d_name);
+        if (get_pgid(pid) != pgid) continue;
+        int n = pin_threads(pid, &set);
+        if (n == 0) error = errno;
+        count += n;
+    }
+    closedir(proc);
+    if (count == 0) {
+        errno = error ? error : ESRCH;
+        return -1;
+    }
+    return count;
+}
+
+char *format_affinity(pid_t pid, char *buf, size_t size) {
+    cpu_set_t set;
+    if (sched_getaffinity(pid, sizeof(set), &set) == -1) return NULL;
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && len < size; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set)) last++;
+        if (last == cpu) len += snprintf(buf + len, size - len, "%s%d", len ? "," : "", cpu);
+        else len += snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", cpu, last);
+        cpu = last;
+    }
+    return buf;
+}
@@ -0,0 +1,46 @@
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+// Whether new background jobs are spread round-robin over the shell's CPUs (set with "set autopin on").
+extern int autopin;
+
+/*
+ * Function: next_autopin_cpu
+ * --------------------------
+ *   Pick the CPU for the next background job: the CPUs the shell may run on
+ *   (its own affinity, so a cpuset is respected) are used in turn.
+ *
+ *   returns: the CPU number, or -1 on error
+ */
+int next_autopin_cpu(void);
+
+/*
+ * Function: pin_process_group
+ * ---------------------------
+ *   Set the CPU affinity of every thread of every process in a process group
+ *   (including the processes the job started itself).
+ *
+ *   pgid: the process group ID
+ *   cpulist: the CPUs, such as "0-3,6"
+ *
+ *   returns: the number of threads changed, or -1 on error (with errno set, EINVAL for a bad list)
+ */
+int pin_process_group(pid_t pgid, const char *cpulist);
+
+/*
+ * Function: format_affinity
+ * -------------------------
+ *   Format the CPU affinity of a process as a CPU list, with ranges for consecutive CPUs.
+ *
+ *   pid: the process ID
+ *   buf: the output buffer
+ *   size: the size of the buffer
+ *
+ *   returns: buf, or NULL on error
+ */
+char *format_affinity(pid_t pid, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ALIGNMENT 16
+
+void arena_init(arena_t *arena) {
+    arena->first = arena->current = NULL;
+    arena->block_allocs = 0;
+}
+
+static arena_block_t *new_block(arena_t *arena, size_t min_size) {
+    size_t size = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    arena->block_allocs++;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+    if (arena->current == NULL) arena->first = arena->current = new_block(arena, size);
+    while (arena->current->size - arena->current->used < size) {
+        // Move on to the next block kept from before the last reset, or add a new one.
+        arena_block_t *next = arena->current->next;
+        if (next == NULL || next->size < size) {
+            arena_block_t *block = new_block(arena, size);
+            block->next = next;
+            arena->current->next = block;
+            next = block;
+        }
+        arena->current = next;
+    }
+    void *ptr = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return ptr;
+}
+
+void *arena_grow(arena_t *arena, void *array, size_t elem_size, int *cap) {
+    int new_cap = *cap ? *cap * 2 : 8;
+    void *new_array = arena_alloc(arena, elem_size * new_cap);
+    if (array != NULL) memcpy(new_array, array, elem_size * *cap);
+    *cap = new_cap;
+    return new_array;
+}
+
+void arena_reset(arena_t *arena) {
+    for (arena_block_t *block = arena->first; block != NULL; block = block->next) block->used = 0;
+    arena->current = arena->first;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *block = arena->first;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = arena->current = NULL;
+}
@@ -0,0 +1,79 @@
+#include <stddef.h>
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#define ARENA_BLOCK_SIZE 4096
+
+typedef struct arena_block {
+    // Pointer to the next block.
+    struct arena_block *next;
+    // Usable size of the block and bytes handed out from it.
+    size_t size, used;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    // First block (kept across resets) and the block allocations currently come from.
+    arena_block_t *first, *current;
+    // Number of blocks allocated with malloc since the arena was created.
+    unsigned long block_allocs;
+} arena_t;
+
+/*
+ * Function: arena_init
+ * --------------------
+ *   Initialize an empty arena.
+ *
+ *   arena: the arena
+ */
+void arena_init(arena_t *arena);
+
+/*
+ * Function: arena_alloc
+ * ---------------------
+ *   Allocate memory from an arena (aligned for any type).
+ *   The memory stays valid until the arena is reset or freed.
+ *
+ *   arena: the arena
+ *   size: the number of bytes
+ *
+ *   returns: a pointer to the memory
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/*
+ * Function: arena_grow
+ * --------------------
+ *   Grow an array allocated from an arena by doubling its capacity.
+ *   The old array is copied and left in the arena until the next reset.
+ *
+ *   arena: the arena
+ *   array: the array (NULL for a new one)
+ *   elem_size: the size of an element
+ *   cap: the capacity in elements, updated to the new capacity
+ *
+ *   returns: a pointer to the new array
+ */
+void *arena_grow(arena_t *arena, void *array, size_t elem_size, int *cap);
+
+/*
+ * Function: arena_reset
+ * ---------------------
+ *   Release everything allocated from an arena at once.
+ *   The blocks are kept and reused by later allocations.
+ *
+ *   arena: the arena
+ */
+void arena_reset(arena_t *arena);
+
+/*
+ * Function: arena_free
+ * --------------------
+ *   Free all the blocks of an arena.
+ *
+ *   arena: the arena
+ */
+void arena_free(arena_t *arena);
+
+#endif
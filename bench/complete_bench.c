@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "complete.h"
+
+// Micro-benchmark for tab completion: reports the cost of building the trie of command
+// names from the search directories, of a refresh when nothing changed, and of the
+// completion of command names and of file names in a large directory.
+//
+// usage: complete_bench [iterations] [directory]
+
+static const char *commands[] = {"", "g", "gr", "ca", "ls", "py", "x", "z", "sh", "ld", "git", "make", "ja", "bg", "hi"};
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    const char *dir = argc > 2 ? argv[2] : "/usr/bin";
+    completion_t completion;
+    init_completion(&completion);
+
+    double start = now();
+    refresh_completions();
+    double build = now() - start;
+    start = now();
+    refresh_completions();
+    double refresh = now() - start;
+
+    char line[4096];
+    unsigned long matches = 0;
+    double worst = 0;
+    start = now();
+    for (int i = 0; i < iterations; i++) {
+        const char *cmd = commands[i % NUM_COMMANDS];
+        double t = now();
+        complete_line(cmd, strlen(cmd), &completion);
+        t = now() - t;
+        // The first call also sets up the arena of the matches.
+        if (i > 0 && t > worst) worst = t;
+        matches += completion.num_matches;
+    }
+    double command_time = now() - start;
+
+    double worst_file = 0, first_file = 0;
+    start = now();
+    for (int i = 0; i < iterations; i++) {
+        int n = snprintf(line, sizeof(line), "ls %s/%s", dir, commands[i % NUM_COMMANDS]);
+        double t = now();
+        complete_line(line, n, &completion);
+        t = now() - t;
+        // The first call reads the directory.
+        if (i == 0) first_file = t;
+        else if (t > worst_file) worst_file = t;
+        matches += completion.num_matches;
+    }
+    double file_time = now() - start;
+
+    printf("trie build:            %.3f ms\n", build * 1e3);
+    printf("refresh (unchanged):   %.3f us\n", refresh * 1e6);
+    printf("command completion:    %.3f us mean, %.3f us worst\n", command_time / iterations * 1e6, worst * 1e6);
+    printf("file completion:       %.3f us mean, %.3f us worst, %.3f us first (%s)\n",
+           file_time / iterations * 1e6, worst_file * 1e6, first_file * 1e6, dir);
+    printf("matches listed:        %lu\n", matches);
+    arena_free(&completion.arena);
+    return 0;
+}
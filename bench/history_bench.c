@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "history.h"
+
+// Micro-benchmark for the history: appends a generated history to a new file, then
+// reports the cost of opening it, of the first (indexing) access, and of prefix and
+// substring searches on the indexed entries.
+//
+// usage: history_bench [entries] [queries]
+
+static const char *words[] = {
+    "ls", "-l", "grep", "--color=auto", "cat", "/usr/share/dict/words", "sort", "-n", "uniq", "-c",
+    "echo", "hello", "world", "find", ".", "-name", "*.c", "xargs", "wc", "sleep", "10", "make", "-j8",
+    "git", "status", "commit", "ssh", "server", "cd", "src", "vim", "main.c", "docker", "run"
+};
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+static unsigned int seed = 12345;
+
+static unsigned int next_random(void) {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 16;
+}
+
+static void make_line(char *buf) {
+    int len = 0, n = 1 + next_random() % 8;
+    for (int i = 0; i < n; i++) len += sprintf(buf + len, "%s%s", i ? " " : "", words[next_random() % NUM_WORDS]);
+    // Make most lines unique, as real histories are.
+    if (next_random() % 4 != 0) sprintf(buf + len, " %u", next_random() % 100000);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int num_entries = argc > 1 ? atoi(argv[1]) : 200000;
+    int num_queries = argc > 2 ? atoi(argv[2]) : 1000;
+    char path[] = "/tmp/history_bench.XXXXXX", line[256];
+    close(mkstemp(path));
+    setenv("HISTFILE", path, 1);
+
+    // Another process writes the history, so this one starts like a new shell on a full file.
+    int fds[2];
+    double append;
+    pipe(fds);
+    if (fork() == 0) {
+        double start = now();
+        init_history();
+        for (int i = 0; i < num_entries; i++) {
+            make_line(line);
+            set_history_result(add_history(line), 0, 0.001);
+        }
+        append = now() - start;
+        write(fds[1], &append, sizeof(append));
+        _exit(0);
+    }
+    if (read(fds[0], &append, sizeof(append)) != sizeof(append)) return 1;
+    wait(NULL);
+    // Opening the history must not read it.
+    double start = now();
+    init_history();
+    double open_time = now() - start;
+    start = now();
+    int size = history_size();
+    double index_time = now() - start;
+    start = now();
+    find_history_prefix("git");
+    double sort_time = now() - start;
+
+    int found = 0;
+    start = now();
+    for (int i = 0; i < num_queries; i++) {
+        const char *word = words[next_random() % NUM_WORDS];
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%s %s", word, words[next_random() % NUM_WORDS]);
+        found += find_history_prefix(prefix) != -1;
+    }
+    double prefix_time = now() - start;
+    start = now();
+    for (int i = 0; i < num_queries; i++) {
+        char text[64];
+        snprintf(text, sizeof(text), "%s %s", words[next_random() % NUM_WORDS], words[next_random() % NUM_WORDS]);
+        found += search_history(text, size) != -1;
+    }
+    double search_time = now() - start;
+
+    printf("entries:               %d\n", size);
+    printf("append:                %.3f us per entry\n", append / num_entries * 1e6);
+    printf("open:                  %.3f us\n", open_time * 1e6);
+    printf("first access (index):  %.3f ms\n", index_time * 1e3);
+    printf("prefix index build:    %.3f ms\n", sort_time * 1e3);
+    printf("prefix search:         %.3f us per query\n", prefix_time / num_queries * 1e6);
+    printf("substring search:      %.3f us per query\n", search_time / num_queries * 1e6);
+    printf("matches:               %d of %d\n", found, 2 * num_queries);
+    unlink(path);
+    return 0;
+}
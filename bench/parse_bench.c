@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "arena.h"
+#include "utils.h"
+
+// Micro-benchmark for parse_args: parses a generated corpus of command lines
+// and reports the tokenizer throughput and the allocations made per line.
+//
+// usage: parse_bench [lines] [iterations]
+
+static const char *words[] = {
+    "ls", "-l", "grep", "--color=auto", "cat", "/usr/share/dict/words", "sort", "-n", "uniq", "-c",
+    "echo", "hello", "world", "find", ".", "-name", "*.c", "xargs", "wc", "sleep", "10", "make", "-j8"
+};
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+static unsigned int seed = 12345;
+
+static unsigned int next_random(void) {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 16;
+}
+
+// Append a random command line (words, quoted strings, escapes, pipes and ampersands) to buf.
+static int make_line(char *buf) {
+    int len = 0, n = 2 + next_random() % 12;
+    for (int i = 0; i < n; i++) {
+        unsigned int kind = next_random() % 16;
+        if (kind == 0) len += sprintf(buf + len, "\"quoted %s string\" ", words[next_random() % NUM_WORDS]);
+        else if (kind == 1) len += sprintf(buf + len, "'single %s' ", words[next_random() % NUM_WORDS]);
+        else if (kind == 2) len += sprintf(buf + len, "escaped\\ %s ", words[next_random() % NUM_WORDS]);
+        else if (kind == 3 && i > 0 && i < n - 1) len += sprintf(buf + len, "| ");
+        else len += sprintf(buf + len, "%s ", words[next_random() % NUM_WORDS]);
+    }
+    if (next_random() % 4 == 0) len += sprintf(buf + len, "&");
+    return len;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int num_lines = argc > 1 ? atoi(argv[1]) : 100000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    // Build the corpus as one buffer of NUL-separated lines.
+    char *corpus = malloc((size_t) num_lines * 512);
+    int *offsets = malloc(sizeof(int) * (num_lines + 1));
+    size_t pos = 0;
+    for (int i = 0; i < num_lines; i++) {
+        offsets[i] = pos;
+        pos += make_line(corpus + pos) + 1;
+        corpus[pos - 1] = '\0';
+    }
+    offsets[num_lines] = pos;
+
+    // parse_args unquotes in place, so every line is parsed from a scratch copy (the copy is timed too).
+    char *line = malloc(512);
+    arena_t arena;
+    arena_init(&arena);
+    command_line_t cmd_line;
+    unsigned long tokens = 0, commands = 0;
+    double start = now();
+    for (int it = 0; it < iterations; it++)
+        for (int i = 0; i < num_lines; i++) {
+            memcpy(line, corpus + offsets[i], offsets[i + 1] - offsets[i]);
+            arena_reset(&arena);
+            parse_args(line, &arena, &cmd_line);
+            commands += cmd_line.count;
+            for (int k = 0; k < cmd_line.count; k++) tokens += cmd_line.cmds[k].argc;
+        }
+    double elapsed = now() - start;
+    unsigned long parsed = (unsigned long) num_lines * iterations;
+
+    printf("lines parsed:          %lu\n", parsed);
+    printf("tokens:                %lu (%.1f per line)\n", tokens, (double) tokens / parsed);
+    printf("commands:              %lu\n", commands);
+    printf("time:                  %.3f s\n", elapsed);
+    printf("lines per second:      %.0f\n", parsed / elapsed);
+    printf("tokens per second:     %.0f\n", tokens / elapsed);
+    printf("allocations per line:  %.6f (%lu arena blocks in total)\n",
+           (double) arena.block_allocs / parsed, arena.block_allocs);
+    arena_free(&arena);
+    free(line);
+    free(offsets);
+    free(corpus);
+    return 0;
+}
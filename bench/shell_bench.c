@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// End-to-end benchmarks of the shell, driven through its stdin and stdout like a batch runner:
+//   launch_throughput   foreground launches per second of a script of "true" lines, per spawn backend
+//   exec_latency        time from writing a line to the child reaching main (p50, p99 and mean)
+//   bg_launch           background launches per second while the job list grows
+//   jobs_cost, kill_cost, fg_wakeup
+//                       cost of the builtins as the job list grows (fg_wakeup is the time from the
+//                       foreground job's exit to the shell reading the next line)
+//   reap_storm          time to reap and report N background jobs exiting at once
+// Results are printed as CSV: build,benchmark,jobs,value,unit
+//
+// usage: shell_bench <build> <shell> <stamp> [max_jobs]
+
+#define LATENCY_SAMPLES 1000
+#define SCRIPT_LINES 2000
+#define STORM_JOBS 500
+
+static const char *build, *shell_path, *stamp_path;
+// Pipes to the stdin and from the stdout of the shell.
+static int to_shell, from_shell;
+static pid_t shell_pid;
+// Partial output line of the shell.
+static char out_buf[4096];
+static size_t out_len;
+// Number of "Done" notifications seen, and the time the last one arrived.
+static long done_count;
+static long long last_done_ns;
+// Time printed by the last stamp fence (0 if none arrived yet).
+static long long stamp_ns;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void result(const char *benchmark, long jobs, double value, const char *unit) {
+    printf("%s,%s,%ld,%.3f,%s\n", build, benchmark, jobs, value, unit);
+    fflush(stdout);
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void handle_line(const char *line) {
+    // A stamp is written with one write call, but may follow a partial line of the shell.
+    const char *stamp = strstr(line, "stamp ");
+    if (stamp != NULL) stamp_ns = atoll(stamp + 6);
+    else if (strstr(line, " Done") != NULL) {
+        done_count++;
+        last_done_ns = now_ns();
+    }
+}
+
+// Read what the shell printed and handle every complete line.
+static void read_output(void) {
+    ssize_t n = read(from_shell, out_buf + out_len, sizeof(out_buf) - out_len);
+    if (n <= 0) {
+        fprintf(stderr, "shell_bench: the shell exited\n");
+        exit(1);
+    }
+    out_len += n;
+    char *start = out_buf, *end;
+    while ((end = memchr(start, '\n', out_buf + out_len - start)) != NULL) {
+        *end = '\0';
+        handle_line(start);
+        start = end + 1;
+    }
+    out_len -= start - out_buf;
+    memmove(out_buf, start, out_len);
+    // Drop a line that does not fit.
+    if (out_len == sizeof(out_buf)) out_len = 0;
+}
+
+// Write input to the shell while draining its output (so neither side can block the other),
+// until the input is consumed and cond returns true.
+static void exchange(const char *input, size_t len, int (*cond)(long), long arg) {
+    size_t written = 0;
+    while (written < len || !cond(arg)) {
+        struct pollfd fds[2] = {{from_shell, POLLIN, 0}, {to_shell, written < len ? POLLOUT : 0, 0}};
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            exit(1);
+        }
+        if (fds[0].revents) read_output();
+        if (fds[1].revents & POLLOUT) {
+            ssize_t n = write(to_shell, input + written, len - written);
+            if (n > 0) written += n;
+        }
+    }
+}
+
+static int stamp_arrived(long unused) {
+    return stamp_ns != 0;
+}
+
+static int done_reached(long target) {
+    return done_count >= target;
+}
+
+// Send lines followed by a stamp fence, and return the time the fence command started.
+static long long run_fenced(const char *lines) {
+    size_t len = strlen(lines), stamp_len = strlen(stamp_path);
+    char *input = malloc(len + stamp_len + 2);
+    memcpy(input, lines, len);
+    memcpy(input + len, stamp_path, stamp_len);
+    input[len + stamp_len] = '\n';
+    stamp_ns = 0;
+    exchange(input, len + stamp_len + 1, stamp_arrived, 0);
+    free(input);
+    return stamp_ns;
+}
+
+// Median cost of running lines, over the cost of a fence alone measured right before.
+static double fenced_cost_us(const char *lines, int runs) {
+    long long samples[runs];
+    for (int i = 0; i < runs; i++) {
+        long long start = now_ns();
+        long long fence = run_fenced("") - start;
+        start = now_ns();
+        samples[i] = run_fenced(lines) - start - fence;
+    }
+    qsort(samples, runs, sizeof(long long), compare_ll);
+    return samples[runs / 2] / 1e3;
+}
+
+// Launch count background jobs that block until fd is closed at the other end.
+static double launch_blockers(int fd, long count) {
+    size_t cap = 4096, len = 0;
+    char *lines = malloc(cap);
+    for (long i = 0; i < count; i++) {
+        if (len + strlen(stamp_path) + 32 > cap) lines = realloc(lines, cap *= 2);
+        len += sprintf(lines + len, "%s block %d &\n", stamp_path, fd);
+    }
+    long long start = now_ns();
+    run_fenced(lines);
+    free(lines);
+    return count / ((now_ns() - start) / 1e9);
+}
+
+static void start_shell(void) {
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    shell_pid = fork();
+    if (shell_pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        execl(shell_path, shell_path, (char *) NULL);
+        perror(shell_path);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    to_shell = in[1];
+    from_shell = out[0];
+    fcntl(to_shell, F_SETFL, O_NONBLOCK);
+}
+
+// Make a pipe whose read end is inherited by the shell and its jobs, and whose write end is not.
+static void blocker_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    fcntl(fds[0], F_SETFD, 0);
+}
+
+static void bench_launch_throughput(void) {
+    static const char *backends[] = {"fork", "posix_spawn", "vfork"};
+    char script[] = "/tmp/shell_bench.XXXXXX";
+    for (int b = 0; b < 3; b++) {
+        int fd = mkstemp(script);
+        FILE *f = fdopen(fd, "w");
+        fprintf(f, "set spawn %s\n", backends[b]);
+        for (int i = 0; i < SCRIPT_LINES; i++) fprintf(f, "true\n");
+        fclose(f);
+        long long start = now_ns();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            execl(shell_path, shell_path, script, (char *) NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+        double elapsed = (now_ns() - start) / 1e9;
+        unlink(script);
+        strcpy(script, "/tmp/shell_bench.XXXXXX");
+        char name[64];
+        snprintf(name, sizeof(name), "launch_throughput_%s", backends[b]);
+        result(name, 0, SCRIPT_LINES / elapsed, "launches/s");
+    }
+}
+
+// Returns the median latency of a fence, used as the baseline of the other measurements.
+static long long bench_exec_latency(void) {
+    long long samples[LATENCY_SAMPLES], total = 0;
+    for (int i = 0; i < LATENCY_SAMPLES; i++) {
+        long long start = now_ns();
+        samples[i] = run_fenced("") - start;
+        total += samples[i];
+    }
+    qsort(samples, LATENCY_SAMPLES, sizeof(long long), compare_ll);
+    result("exec_latency_p50", 0, samples[LATENCY_SAMPLES / 2] / 1e3, "us");
+    result("exec_latency_p99", 0, samples[LATENCY_SAMPLES * 99 / 100] / 1e3, "us");
+    result("exec_latency_mean", 0, total / LATENCY_SAMPLES / 1e3, "us");
+    return samples[LATENCY_SAMPLES / 2];
+}
+
+static void bench_reap_storm(int fds[2], long count, long already_done) {
+    long long start = now_ns();
+    close(fds[1]);
+    exchange("", 0, done_reached, already_done + count);
+    result("reap_storm", count, (last_done_ns - start) / 1e6, "ms");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: shell_bench <build> <shell> <stamp> [max_jobs]\n");
+        return 1;
+    }
+    build = argv[1];
+    shell_path = argv[2];
+    stamp_path = argv[3];
+    long max_jobs = argc > 4 ? atol(argv[4]) : 10000;
+    signal(SIGPIPE, SIG_IGN);
+    printf("build,benchmark,jobs,value,unit\n");
+
+    bench_launch_throughput();
+
+    // One pipe for the bulk of the jobs, one for the storm and one per foreground target.
+    int bulk[2], storm[2], fg[8][2];
+    blocker_pipe(bulk);
+    blocker_pipe(storm);
+    int num_sizes = 0;
+    for (long size = 10; size <= max_jobs && num_sizes < 8; size *= 10) blocker_pipe(fg[num_sizes++]);
+    start_shell();
+    // Every blocker job has to run at once, bypassing the admission queue.
+    run_fenced("set max_jobs 0\n");
+
+    long long fence_ns = bench_exec_latency();
+
+    launch_blockers(storm[0], STORM_JOBS);
+    bench_reap_storm(storm, STORM_JOBS, 0);
+
+    // Grow the job list and measure the builtins at every size.
+    long jobs = 0, next_id = 1, killed = 0;
+    char line[64];
+    for (int s = 0; s < num_sizes; s++) {
+        long size = 10;
+        for (int i = 0; i < s; i++) size *= 10;
+        result("bg_launch", size, launch_blockers(bulk[0], size - 1 - jobs), "launches/s");
+        next_id += size - 1 - jobs;
+        jobs = size - 1;
+        // The last job is the foreground target.
+        launch_blockers(fg[s][0], 1);
+        long fg_id = next_id;
+        result("jobs_cost", size, fenced_cost_us("jobs\n", 9), "us");
+        // Kill the oldest bulk job left.
+        snprintf(line, sizeof(line), "kill %%%ld\n", ++killed);
+        result("kill_cost", size, fenced_cost_us(line, 1), "us");
+        jobs--;
+        snprintf(line, sizeof(line), "fg %%%ld\n", fg_id);
+        exchange(line, strlen(line), stamp_arrived, 0);
+        // Give the shell time to start waiting, then let the job exit.
+        usleep(100000);
+        long long start = now_ns();
+        close(fg[s][1]);
+        result("fg_wakeup", size, (run_fenced("") - start - fence_ns) / 1e3, "us");
+    }
+    long bulk_jobs = jobs;
+    bench_reap_storm(bulk, bulk_jobs, done_count);
+
+    exchange("exit\n", 5, stamp_arrived, 0);
+    close(to_shell);
+    waitpid(shell_pid, NULL, 0);
+    return 0;
+}
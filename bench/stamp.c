@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Helper command for shell_bench.
+//
+// usage: stamp             print "stamp <ns>", the CLOCK_MONOTONIC time main was reached at
+//        stamp block FD    wait until FD reaches end of file, then exit
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], "block") == 0) {
+        int fd = atoi(argv[2]);
+        char c;
+        while (read(fd, &c, 1) > 0);
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    printf("stamp %lld\n", ts.tv_sec * 1000000000LL + ts.tv_nsec);
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "capture.h"
+#include "event_loop.h"
+#include "spawn.h"
+
+// Initial size of a job's buffer, which doubles up to capture_size as the job writes more.
+#define RING_MIN 4096
+// Bytes read from a pipe at once, and the most chunks read per event (so one chatty job
+// does not hold up the shell).
+#define CAPTURE_CHUNK 65536
+#define CAPTURE_READS 16
+
+const char *capture_overflow_str[2] = {"drop", "block"};
+int capture_jobs = 0;
+int capture_size = 65536;
+int capture_overflow = CAPTURE_DROP;
+
+// Output of the last finished jobs, in a circular array (the oldest one is replaced).
+static struct {
+    int id;
+    output_ring_t *ring;
+} finished[FINISHED_OUTPUTS];
+static int finished_next = 0;
+
+int open_job_output(int fds[2]) {
+    if (!capture_jobs || make_pipe(fds) == -1) return -1;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+// Largest size of a buffer: capture_size (at least RING_MIN), or the buffer's own size if capture_size was lowered since.
+static size_t ring_limit(const output_ring_t *ring) {
+    size_t limit = capture_size > RING_MIN ? capture_size : RING_MIN;
+    return ring->cap > limit ? ring->cap : limit;
+}
+
+// Write the contents of a buffer, oldest first.
+static void write_ring(const output_ring_t *ring, FILE *out) {
+    if (ring->len == 0) return;
+    size_t first = ring->len < ring->cap - ring->start ? ring->len : ring->cap - ring->start;
+    fwrite(ring->data + ring->start, 1, first, out);
+    fwrite(ring->data, 1, ring->len - first, out);
+}
+
+// Add output to a buffer, growing it up to its limit and then dropping the oldest bytes.
+static void append_ring(output_ring_t *ring, const char *buf, size_t n) {
+    size_t limit = ring_limit(ring);
+    if (ring->len + n > ring->cap && ring->cap < limit) {
+        size_t cap = ring->cap ? ring->cap : RING_MIN;
+        while (cap < ring->len + n && cap < limit) cap *= 2;
+        if (cap > limit) cap = limit;
+        // The contents are moved to the start of the new buffer.
+        char *data = malloc(cap);
+        size_t first = ring->len < ring->cap - ring->start ? ring->len : ring->cap - ring->start;
+        if (ring->len > 0) {
+            memcpy(data, ring->data + ring->start, first);
+            memcpy(data + first, ring->data, ring->len - first);
+        }
+        free(ring->data);
+        ring->data = data;
+        ring->cap = cap;
+        ring->start = 0;
+    }
+    if (n >= ring->cap) {
+        // Only the end of the chunk fits.
+        ring->dropped += ring->len + n - ring->cap;
+        buf += n - ring->cap;
+        n = ring->cap;
+        ring->start = ring->len = 0;
+    }
+    else if (ring->len + n > ring->cap) {
+        size_t drop = ring->len + n - ring->cap;
+        ring->start = (ring->start + drop) % ring->cap;
+        ring->len -= drop;
+        ring->dropped += drop;
+    }
+    size_t end = (ring->start + ring->len) % ring->cap;
+    size_t first = n < ring->cap - end ? n : ring->cap - end;
+    memcpy(ring->data + end, buf, first);
+    memcpy(ring->data, buf + first, n - first);
+    ring->len += n;
+}
+
+/*
+ * Function: read_job_output
+ * -------------------------
+ *   Move what the job wrote from its pipe to its buffer (or to the terminal in the foreground).
+ *
+ *   returns: 1 if the pipe may have more to read, 0 if it is empty, closed or blocked
+ */
+static int read_job_output(job_t *job) {
+    output_ring_t *ring = job->output;
+    char buf[CAPTURE_CHUNK];
+    for (int i = 0; i < CAPTURE_READS; i++) {
+        size_t room = sizeof(buf);
+        if (job->state != FOREGROUND && capture_overflow == CAPTURE_BLOCK) {
+            // Leave the rest in the pipe, so the job blocks once the pipe is full too.
+            size_t free_space = ring_limit(ring) - ring->len;
+            if (free_space == 0) {
+                ring->blocked = 1;
+                event_mod(ring->fd, 0);
+                return 0;
+            }
+            if (room > free_space) room = free_space;
+        }
+        ssize_t n = read(ring->fd, buf, room);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == 0) {
+            // All the processes that could write to the pipe have exited.
+            event_del(ring->fd);
+            close(ring->fd);
+            ring->fd = -1;
+        }
+        if (n <= 0) return 0;
+        if (job->state == FOREGROUND) {
+            fwrite(buf, 1, n, stdout);
+            fflush(stdout);
+        }
+        else append_ring(ring, buf, n);
+    }
+    return 1;
+}
+
+static void output_callback(int fd, unsigned int events, void *data) {
+    // The event is level-triggered, so the rest is read on the next round of the event loop.
+    read_job_output(data);
+}
+
+void attach_job_output(job_t *job, int fd) {
+    output_ring_t *ring = calloc(1, sizeof(output_ring_t));
+    ring->fd = fd;
+    job->output = ring;
+    if (event_add(fd, EPOLLIN, output_callback, job) == -1) perror("epoll_ctl");
+}
+
+void release_job_output(job_t *job) {
+    output_ring_t *ring = job->output;
+    if (ring == NULL) return;
+    // Read what the job wrote before it exited (its children may keep writing, they get SIGPIPE).
+    if (ring->fd != -1 && !ring->blocked) while (read_job_output(job));
+    job->output = NULL;
+    if (ring->fd != -1) {
+        event_del(ring->fd);
+        close(ring->fd);
+        ring->fd = -1;
+    }
+    ring->blocked = 0;
+    if (ring->len == 0) {
+        free(ring->data);
+        free(ring);
+        return;
+    }
+    output_ring_t *oldest = finished[finished_next].ring;
+    if (oldest != NULL) {
+        free(oldest->data);
+        free(oldest);
+    }
+    finished[finished_next].id = job->pgid;
+    finished[finished_next].ring = ring;
+    finished_next = (finished_next + 1) % FINISHED_OUTPUTS;
+}
+
+void foreground_job_output(job_t *job) {
+    output_ring_t *ring = job->output;
+    if (ring == NULL) return;
+    write_ring(ring, stdout);
+    fflush(stdout);
+    ring->start = ring->len = 0;
+    if (ring->blocked) {
+        ring->blocked = 0;
+        event_mod(ring->fd, EPOLLIN);
+    }
+}
+
+int print_job_output(job_list_t *job_list, int id) {
+    job_t *job = get_job_by_id(job_list, id);
+    output_ring_t *ring = job != NULL ? job->output : NULL;
+    // Otherwise look for the last finished job with this ID.
+    for (int i = 1; ring == NULL && i <= FINISHED_OUTPUTS; i++) {
+        int k = (finished_next - i + FINISHED_OUTPUTS) % FINISHED_OUTPUTS;
+        if (finished[k].ring != NULL && finished[k].id == id) ring = finished[k].ring;
+    }
+    if (ring == NULL) return -1;
+    if (ring->dropped > 0) fprintf(stderr, "[%d] %llu bytes of output dropped\n", id, ring->dropped);
+    write_ring(ring, stdout);
+    fflush(stdout);
+    if (capture_overflow == CAPTURE_BLOCK) {
+        ring->start = ring->len = 0;
+        if (ring->blocked) {
+            ring->blocked = 0;
+            event_mod(ring->fd, EPOLLIN);
+        }
+    }
+    return 0;
+}
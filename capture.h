@@ -0,0 +1,91 @@
+#include "job_control.h"
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+enum capture_overflow {
+    CAPTURE_DROP, CAPTURE_BLOCK
+};
+extern const char *capture_overflow_str[2];
+
+// Whether the stdout and stderr of background jobs go to a buffer per job instead of the terminal (set with "set capture on").
+extern int capture_jobs;
+// Size of the buffer of each job, at least 4K (set with "set capture_size <bytes>").
+extern int capture_size;
+// What happens when the buffer of a job is full (set with "set capture_overflow drop|block"): the
+// oldest output is dropped, or the shell stops reading the job's pipe until the output is shown.
+extern int capture_overflow;
+
+// Number of finished jobs whose output is kept.
+#define FINISHED_OUTPUTS 64
+
+typedef struct output_ring {
+    // Buffer, grown on demand up to capture_size.
+    char *data;
+    size_t cap;
+    // Position of the oldest byte kept, and number of bytes kept.
+    size_t start, len;
+    // Number of bytes dropped to make room for newer output.
+    unsigned long long dropped;
+    // Read end of the pipe of the job (-1 once the job has finished).
+    int fd;
+    // Whether the pipe is not read because the buffer is full (with the block policy).
+    int blocked;
+} output_ring_t;
+
+/*
+ * Function: open_job_output
+ * -------------------------
+ *   Create the pipe that captures the output of a background job, if capture is on.
+ *   The job falls back to the terminal when it cannot be created (e.g. out of descriptors).
+ *
+ *   fds: the read and write ends (both close-on-exec, the read end non-blocking)
+ *
+ *   returns: 0 on success, -1 if capture is off or the pipe could not be created
+ */
+int open_job_output(int fds[2]);
+
+/*
+ * Function: attach_job_output
+ * ---------------------------
+ *   Collect what a job writes to the read end of its pipe in its buffer, from the event loop.
+ *   While the job is in the foreground, its output goes to the terminal instead.
+ *
+ *   job: the job
+ *   fd: the read end of the pipe
+ */
+void attach_job_output(job_t *job, int fd);
+
+/*
+ * Function: release_job_output
+ * ----------------------------
+ *   Read what is left in the pipe of a job that has finished and close it. Its output is
+ *   kept for print_job_output, with the output of the last FINISHED_OUTPUTS finished jobs.
+ *
+ *   job: the job
+ */
+void release_job_output(job_t *job);
+
+/*
+ * Function: foreground_job_output
+ * -------------------------------
+ *   Write the buffered output of a job that is brought to the foreground to the terminal.
+ *
+ *   job: the job
+ */
+void foreground_job_output(job_t *job);
+
+/*
+ * Function: print_job_output
+ * --------------------------
+ *   Print the buffered output of a job (running, or among the last finished jobs). With the
+ *   block policy, the output printed is removed from the buffer, which lets the job write more.
+ *
+ *   job_list: the job list
+ *   id: the job ID
+ *
+ *   returns: 0 on success, -1 if the job has no captured output
+ */
+int print_job_output(job_list_t *job_list, int id);
+
+#endif
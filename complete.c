@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "complete.h"
+#include "path_cache.h"
+#include "utils.h"
+
+// Words handled by the shell itself, completed like the built-in commands.
+static const char *keywords[] = {"exit", "nice", "time"};
+#define NUM_KEYWORDS (sizeof(keywords) / sizeof(keywords[0]))
+
+typedef struct {
+    // First child and next sibling (0 for none, node 0 is the root); siblings are sorted by character.
+    int child, sibling;
+    // Number of sources (built-ins, search directories) of the word ending here,
+    // and number of words ending here or below.
+    int words, below;
+    unsigned char c;
+} trie_node_t;
+
+typedef struct {
+    // Path of the directory (search directories only).
+    char *path;
+    // Identity and modification time of the directory when it was read.
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    // Sorted names of the entries, with a trailing slash for the subdirectories.
+    char **names;
+    int count;
+    // When the listing was last used (file name listings only).
+    unsigned long used;
+} dir_listing_t;
+
+static trie_node_t *nodes = NULL;
+static int node_count = 0, node_cap = 0;
+// Listings of the executables of the search directories, in the order of the search.
+static dir_listing_t *command_dirs = NULL;
+static int num_command_dirs = 0;
+static long long last_refresh_ms = 0;
+// Least recently used listings of the directories file names were completed in.
+static dir_listing_t file_dirs[DIR_CACHE_SIZE];
+static unsigned long use_counter = 0;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int new_node(unsigned char c) {
+    if (node_count == node_cap) {
+        node_cap = node_cap ? node_cap * 2 : 1024;
+        nodes = realloc(nodes, sizeof(trie_node_t) * node_cap);
+    }
+    nodes[node_count] = (trie_node_t) {0, 0, 0, 0, c};
+    return node_count++;
+}
+
+// Find the child of a node for a character, adding it if create is set (returns 0 if there is none).
+static int find_child(int node, unsigned char c, int create) {
+    int prev = 0, child = nodes[node].child;
+    while (child != 0 && nodes[child].c < c) {
+        prev = child;
+        child = nodes[child].sibling;
+    }
+    if (child != 0 && nodes[child].c == c) return child;
+    if (!create) return 0;
+    int added = new_node(c);
+    nodes[added].sibling = child;
+    if (prev != 0) nodes[prev].sibling = added;
+    else nodes[node].child = added;
+    return added;
+}
+
+static void add_word(const char *word) {
+    int node = 0;
+    nodes[0].below++;
+    for (const char *p = word; *p != '\0'; p++) {
+        node = find_child(node, *p, 1);
+        nodes[node].below++;
+    }
+    nodes[node].words++;
+}
+
+static void remove_word(const char *word) {
+    int node = 0;
+    for (const char *p = word; *p != '\0'; p++)
+        if ((node = find_child(node, *p, 0)) == 0) return;
+    if (nodes[node].words == 0) return;
+    // The nodes are kept, a word that comes back reuses them.
+    nodes[node].words--;
+    node = 0;
+    nodes[0].below--;
+    for (const char *p = word; *p != '\0'; p++) {
+        node = find_child(node, *p, 0);
+        nodes[node].below--;
+    }
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static void free_names(dir_listing_t *listing) {
+    for (int i = 0; i < listing->count; i++) free(listing->names[i]);
+    free(listing->names);
+    listing->names = NULL;
+    listing->count = 0;
+}
+
+// Read the entries of a directory (only the executable files if executables is set) into a sorted listing.
+static void read_listing(dir_listing_t *listing, const char *path, int executables) {
+    listing->names = NULL;
+    listing->count = 0;
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+    int cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        int is_dir = entry->d_type == DT_DIR, executable = 0;
+        // Symbolic links (and file systems without d_type) need a stat to know what the entry is.
+        if (executables || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(dir), name, &st, 0) == 0) {
+                is_dir = S_ISDIR(st.st_mode);
+                executable = S_ISREG(st.st_mode) && (st.st_mode & 0111);
+            }
+        }
+        if (executables && !executable) continue;
+        if (listing->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            listing->names = realloc(listing->names, sizeof(char *) * cap);
+        }
+        size_t len = strlen(name);
+        char *copy = malloc(len + 2);
+        memcpy(copy, name, len);
+        if (is_dir) copy[len++] = '/';
+        copy[len] = '\0';
+        listing->names[listing->count++] = copy;
+    }
+    closedir(dir);
+    qsort(listing->names, listing->count, sizeof(char *), compare_names);
+}
+
+// Read a search directory again and apply the differences with its previous listing to the trie.
+static void update_command_dir(dir_listing_t *dir) {
+    dir_listing_t fresh;
+    read_listing(&fresh, dir->path, 1);
+    int i = 0, j = 0;
+    while (i < dir->count || j < fresh.count) {
+        int c = i == dir->count ? 1 : j == fresh.count ? -1 : strcmp(dir->names[i], fresh.names[j]);
+        if (c < 0) remove_word(dir->names[i++]);
+        else if (c > 0) add_word(fresh.names[j++]);
+        else i++, j++;
+    }
+    free_names(dir);
+    dir->names = fresh.names;
+    dir->count = fresh.count;
+}
+
+void refresh_completions(void) {
+    if (node_count == 0) {
+        new_node('\0');
+        for (int i = 0; i < NUM_BUILTINS; i++) add_word(builtin_cmd[i]);
+        for (int i = 0; i < NUM_KEYWORDS; i++) add_word(keywords[i]);
+    }
+    else if (now_ms() - last_refresh_ms < PATH_CACHE_TTL_MS) return;
+    last_refresh_ms = now_ms();
+    // Match the current search directories with the listings (PATH may have changed).
+    int n = 0;
+    while (path_cache_dir(n) != NULL) n++;
+    dir_listing_t *dirs = calloc(n ? n : 1, sizeof(dir_listing_t));
+    for (int i = 0; i < n; i++) {
+        const char *path = path_cache_dir(i);
+        for (int j = 0; j < num_command_dirs; j++)
+            if (command_dirs[j].path != NULL && strcmp(command_dirs[j].path, path) == 0) {
+                dirs[i] = command_dirs[j];
+                command_dirs[j].path = NULL;
+                break;
+            }
+        if (dirs[i].path == NULL) dirs[i].path = strdup(path);
+    }
+    // The directories that are no longer searched take their commands with them.
+    for (int j = 0; j < num_command_dirs; j++) {
+        if (command_dirs[j].path == NULL) continue;
+        for (int i = 0; i < command_dirs[j].count; i++) remove_word(command_dirs[j].names[i]);
+        free_names(&command_dirs[j]);
+        free(command_dirs[j].path);
+    }
+    free(command_dirs);
+    command_dirs = dirs;
+    num_command_dirs = n;
+    for (int i = 0; i < n; i++) {
+        struct stat st;
+        if (stat(dirs[i].path, &st) == -1) st.st_mtim.tv_sec = st.st_mtim.tv_nsec = 0;
+        if (dirs[i].names != NULL && st.st_mtim.tv_sec == dirs[i].mtime.tv_sec
+            && st.st_mtim.tv_nsec == dirs[i].mtime.tv_nsec) continue;
+        update_command_dir(&dirs[i]);
+        dirs[i].mtime = st.st_mtim;
+        // An empty listing is still a listing.
+        if (dirs[i].names == NULL) dirs[i].names = malloc(sizeof(char *));
+    }
+}
+
+// Get the listing of a directory, reading it again only if it changed since it was cached.
+static dir_listing_t *get_listing(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) return NULL;
+    dir_listing_t *listing = NULL, *oldest = &file_dirs[0];
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        // Directories are told apart by device and inode, so a relative path is fine after a cd.
+        if (file_dirs[i].used != 0 && file_dirs[i].dev == st.st_dev && file_dirs[i].ino == st.st_ino) {
+            listing = &file_dirs[i];
+            break;
+        }
+        if (file_dirs[i].used < oldest->used) oldest = &file_dirs[i];
+    }
+    if (listing == NULL || listing->mtime.tv_sec != st.st_mtim.tv_sec || listing->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        if (listing == NULL) listing = oldest;
+        free_names(listing);
+        read_listing(listing, path, 0);
+        listing->dev = st.st_dev;
+        listing->ino = st.st_ino;
+        listing->mtime = st.st_mtim;
+    }
+    listing->used = ++use_counter;
+    return listing;
+}
+
+static void add_match(completion_t *completion, int *cap, char *name) {
+    if (completion->num_matches == *cap)
+        completion->matches = arena_grow(&completion->arena, completion->matches, sizeof(char *), cap);
+    completion->matches[completion->num_matches++] = name;
+}
+
+// Add the words of the subtree of a node (whose word is buf[0, len)) in sorted order.
+static void collect_words(completion_t *completion, int *cap, int node, char *buf, int len) {
+    if (nodes[node].words > 0) {
+        char *word = arena_alloc(&completion->arena, len + 1);
+        memcpy(word, buf, len);
+        word[len] = '\0';
+        add_match(completion, cap, word);
+    }
+    for (int child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+        if (nodes[child].below == 0) continue;
+        buf[len] = nodes[child].c;
+        collect_words(completion, cap, child, buf, len + 1);
+    }
+}
+
+static void complete_command(completion_t *completion, const char *prefix) {
+    int node = 0, cap = 0;
+    for (const char *p = prefix; *p != '\0'; p++)
+        if ((node = find_child(node, *p, 0)) == 0) return;
+    if (nodes[node].below == 0) return;
+    size_t len = strlen(prefix);
+    char *buf = arena_alloc(&completion->arena, len + NAME_MAX + 2);
+    memcpy(buf, prefix, len);
+    collect_words(completion, &cap, node, buf, len);
+}
+
+static void complete_file(completion_t *completion, const char *dir, const char *prefix) {
+    dir_listing_t *listing = get_listing(dir);
+    if (listing == NULL) return;
+    size_t len = strlen(prefix);
+    // The names starting with the prefix are consecutive in the sorted listing.
+    int lo = 0, hi = listing->count, cap = 0;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(listing->names[mid], prefix, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    for (int i = lo; i < listing->count && strncmp(listing->names[i], prefix, len) == 0; i++)
+        // Hidden files are only completed when asked for.
+        if (listing->names[i][0] != '.' || prefix[0] == '.') add_match(completion, &cap, listing->names[i]);
+}
+
+void init_completion(completion_t *completion) {
+    arena_init(&completion->arena);
+    completion->insert = "";
+    completion->matches = NULL;
+    completion->num_matches = 0;
+}
+
+void complete_line(const char *line, int cursor, completion_t *completion) {
+    arena_reset(&completion->arena);
+    completion->insert = "";
+    completion->matches = NULL;
+    completion->num_matches = 0;
+    // Find the word before the cursor and unquote it, noting whether it is the first word of a command.
+    char *word = arena_alloc(&completion->arena, cursor + 1);
+    int len = 0, in_word = 0, first = 1;
+    char quote = '\0';
+    for (int i = 0; i < cursor; i++) {
+        char c = line[i];
+        if (quote) {
+            if (c == quote) quote = '\0';
+            else word[len++] = c;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '&' || c == '|' || c == ';' || c == '(' || c == ')') {
+            // The command of "time cmd" and "nice cmd" is still a first word.
+            if (in_word) first = first && len == 4 && (strncmp(word, "time", 4) == 0 || strncmp(word, "nice", 4) == 0);
+            // A command starts after a separator (&, |, ;, && and ||), and in a group or a $( substitution.
+            if (c == '&' || c == '|' || c == ';' || c == '(') first = 1;
+            else if (c == ')') first = 0;
+            in_word = len = 0;
+            continue;
+        }
+        in_word = 1;
+        if (c == '"' || c == '\'') quote = c;
+        else if (c == '\\' && i + 1 < cursor) word[len++] = line[++i];
+        else word[len++] = c;
+    }
+    word[len] = '\0';
+    const char *prefix = word;
+    if (first && strchr(word, '/') == NULL) complete_command(completion, word);
+    else {
+        char *slash = strrchr(word, '/');
+        const char *dir = ".";
+        if (slash != NULL) {
+            // The directory part keeps its slash ("/" for the root).
+            char *copy = arena_alloc(&completion->arena, slash - word + 2);
+            memcpy(copy, word, slash - word + 1);
+            copy[slash - word + 1] = '\0';
+            dir = copy;
+            prefix = slash + 1;
+        }
+        complete_file(completion, dir, prefix);
+    }
+    if (completion->num_matches == 0) return;
+    // The matches are sorted, so their common prefix is the one of the first and the last.
+    const char *a = completion->matches[0], *b = completion->matches[completion->num_matches - 1];
+    size_t common = 0, start = strlen(prefix);
+    while (a[common] != '\0' && a[common] == b[common]) common++;
+    char *insert = arena_alloc(&completion->arena, 2 * (common - start) + 3);
+    size_t n = 0;
+    for (size_t i = start; i < common; i++) {
+        // Outside quotes, the characters the parser splits on are escaped.
+        if (!quote && strchr(" \t\\'\"&|;()", a[i]) != NULL) insert[n++] = '\\';
+        insert[n++] = a[i];
+    }
+    if (completion->num_matches == 1) {
+        // A complete file name (not a directory) is closed, so the next word can follow.
+        if (a[common - 1] != '/') {
+            if (quote) insert[n++] = quote;
+            insert[n++] = ' ';
+        }
+        completion->num_matches = 0;
+    }
+    insert[n] = '\0';
+    completion->insert = insert;
+}
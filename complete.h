@@ -0,0 +1,53 @@
+#include "arena.h"
+
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+// Number of directory listings kept for the completion of file names.
+#define DIR_CACHE_SIZE 16
+
+typedef struct {
+    // Text to insert at the cursor: the rest of the longest common prefix of the matches
+    // (escaped), followed by '/' or ' ' when it is a complete name.
+    char *insert;
+    // The matching names, sorted (only set when there is more than one).
+    char **matches;
+    int num_matches;
+    // Memory of insert and matches, released at once by the next completion.
+    arena_t arena;
+} completion_t;
+
+/*
+ * Function: refresh_completions
+ * -----------------------------
+ *   Bring the trie of command names up to date: the built-in commands and the executables
+ *   of the search directories. Only the directories whose mtime changed (or that were
+ *   added to PATH) are read again, and only the names that appeared or disappeared are
+ *   updated in the trie. The directories are checked at most every PATH_CACHE_TTL_MS.
+ */
+void refresh_completions(void);
+
+/*
+ * Function: complete_line
+ * -----------------------
+ *   Complete the word before the cursor: a command name when it is the first word of a
+ *   command, at the start of the line, after |, &, ;, && or ||, or after the ( of a group
+ *   or a substitution (from the trie), or a file name (from a cached listing of its
+ *   directory, read again when the mtime of the directory changes).
+ *
+ *   line: the command line
+ *   cursor: the position of the cursor in the line
+ *   completion: the completion (initialized with init_completion)
+ */
+void complete_line(const char *line, int cursor, completion_t *completion);
+
+/*
+ * Function: init_completion
+ * -------------------------
+ *   Initialize a completion result.
+ *
+ *   completion: the completion
+ */
+void init_completion(completion_t *completion);
+
+#endif
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "admission.h"
+#include "arena.h"
+#include "daemon.h"
+#include "event_loop.h"
+#include "exec.h"
+#include "utils.h"
+
+typedef struct {
+    int fd;
+    // Received bytes not yet split into requests.
+    char *in;
+    size_t in_len, in_cap;
+    // Responses not yet sent.
+    char *out;
+    size_t out_len, out_cap;
+    // Set when the client has to be disconnected (it is closed by its own callback).
+    int broken;
+} client_t;
+
+static job_list_t *daemon_job_list;
+// Memory of the parsed command lines, reset for every request.
+static arena_t arena;
+
+static void close_client(client_t *client) {
+    // The jobs of the client keep running, nobody gets their completion.
+    for (job_t *job = next_job(daemon_job_list, NULL); job != NULL; job = next_job(daemon_job_list, job))
+        if (job->done_data == client) job->done_data = NULL;
+    event_del(client->fd);
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+    free(client);
+}
+
+/*
+ * Function: flush_client
+ * ----------------------
+ *   Send the pending responses of a client, waiting for EPOLLOUT if its socket is full.
+ *   A client that cannot be sent to is marked broken, and shut down so that its callback
+ *   runs and closes it.
+ *
+ *   returns: 0, or -1 if the client is broken
+ */
+static int flush_client(client_t *client) {
+    size_t sent = 0;
+    while (sent < client->out_len && !client->broken) {
+        ssize_t n = send(client->fd, client->out + sent, client->out_len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) break;
+        if (n == -1) client->broken = 1;
+        else sent += n;
+    }
+    memmove(client->out, client->out + sent, client->out_len - sent);
+    client->out_len -= sent;
+    if (client->out_len > CLIENT_OUTPUT_MAX) {
+        fprintf(stderr, "daemon: client %d does not read its responses, disconnecting it\n", client->fd);
+        client->broken = 1;
+    }
+    if (client->broken) {
+        shutdown(client->fd, SHUT_RDWR);
+        return -1;
+    }
+    event_mod(client->fd, client->out_len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    return 0;
+}
+
+static void reserve_output(client_t *client, size_t len) {
+    if (client->out_len + len <= client->out_cap) return;
+    client->out_cap = client->out_cap ? client->out_cap : 4096;
+    while (client->out_len + len > client->out_cap) client->out_cap *= 2;
+    client->out = realloc(client->out, client->out_cap);
+}
+
+static void respond(client_t *client, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+    reserve_output(client, len + 1);
+    va_start(ap, format);
+    vsnprintf(client->out + client->out_len, len + 1, format, ap);
+    va_end(ap);
+    client->out_len += len;
+}
+
+// Add a string to the responses as a JSON string.
+static void respond_string(client_t *client, const char *str) {
+    respond(client, "\"");
+    for (const char *p = str; *p != '\0'; p++) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\') respond(client, "\\%c", c);
+        else if (c < 0x20) respond(client, "\\u%04x", c);
+        else {
+            reserve_output(client, 1);
+            client->out[client->out_len++] = c;
+        }
+    }
+    respond(client, "\"");
+}
+
+static void respond_error(client_t *client, const char *message) {
+    respond(client, "{\"event\":\"error\",\"message\":");
+    respond_string(client, message);
+    respond(client, "}\n");
+}
+
+// Called when a job submitted by (or brought to the foreground for) a client has finished.
+static void report_done(job_t *job, void *data) {
+    client_t *client = data;
+    if (client == NULL) return;
+    respond(client, "{\"event\":\"done\",\"id\":%d,\"pid\":%d,", job->pgid, job->pid);
+    if (WIFSIGNALED(job->status)) respond(client, "\"status\":null,\"signal\":%d,", WTERMSIG(job->status));
+    else respond(client, "\"status\":%d,\"signal\":null,", WEXITSTATUS(job->status));
+    respond(client, "\"elapsed\":%.3f}\n", job_elapsed(job));
+    flush_client(client);
+}
+
+// Start the pipelines of a line as background jobs.
+static void run_request(client_t *client, char *line) {
+    command_line_t cmd_line;
+    arena_reset(&arena);
+    parse_args(line, &arena, &cmd_line);
+    command_t *cmds = cmd_line.cmds;
+    for (int k = 0, next = 0; k < cmd_line.count; k = next) {
+        int last = k;
+        while (last < cmd_line.count - 1 && cmds[last].separator == '|') last++;
+        next = last + 1;
+        // The daemon starts jobs, a list has to be grouped into one.
+        if (cmds[last].separator == ';' || cmds[last].separator == SEP_AND || cmds[last].separator == SEP_OR) {
+            respond_error(client, "a command list has to be grouped: run ( ... )");
+            return;
+        }
+        int empty = 0, substitution = 0;
+        for (int i = k; i <= last; i++) {
+            empty |= cmds[i].argc == 0;
+            substitution |= cmds[i].source != NULL;
+        }
+        // Capturing the output would stop the daemon from serving the other clients meanwhile.
+        if (substitution) {
+            respond_error(client, "command substitution is not supported: run ( ... )");
+            continue;
+        }
+        if (empty) {
+            if (last > k) respond_error(client, "syntax error near unexpected token '|'");
+            continue;
+        }
+        // The same prefixes as in the shell, except "time": the elapsed time is in the done event.
+        job_limits_t limits = {0};
+        launch_attr_t launch = {NULL, 0, -1};
+        int prefixes = strip_launch_prefixes(&cmds[k], &limits, &launch);
+        if (prefixes == -1) {
+            respond_error(client, "invalid limit or timeout prefix");
+            continue;
+        }
+        if (prefixes & PREFIX_TIME) {
+            respond_error(client, "time is not supported: the done event has the elapsed time");
+            continue;
+        }
+        job_t *job = start_job(daemon_job_list, &cmds[k], last - k + 1, 1, &launch);
+        if (job == NULL) {
+            respond_error(client, "the job could not be started");
+            continue;
+        }
+        job->on_done = report_done;
+        job->done_data = client;
+        respond(client, "{\"event\":\"started\",\"id\":%d,\"pid\":%d,\"state\":\"%s\"}\n",
+                job->pgid, job->pid, job->state == QUEUED ? "queued" : "running");
+    }
+}
+
+static void jobs_request(client_t *client) {
+    for (job_t *job = next_job(daemon_job_list, NULL); job != NULL; job = next_job(daemon_job_list, job)) {
+        respond(client, "{\"event\":\"job\",\"id\":%d,\"pid\":%d,\"state\":\"%s\",\"elapsed\":%.3f,\"cmd\":",
+                job->pgid, job->pid, job_state_str[job->state], job_elapsed(job));
+        respond_string(client, job->cmd);
+        respond(client, "}\n");
+    }
+    respond(client, "{\"event\":\"end\"}\n");
+}
+
+// Parse a signal given by number or name (with or without SIG).
+static int parse_signal(const char *name) {
+    char *end;
+    long n = strtol(name, &end, 10);
+    if (end != name && *end == '\0') return n > 0 && n < NSIG ? n : -1;
+    if (strncmp(name, "SIG", 3) == 0) name += 3;
+    for (int sig = 1; sig < NSIG; sig++) {
+        const char *abbrev = sigabbrev_np(sig);
+        if (abbrev != NULL && strcmp(abbrev, name) == 0) return sig;
+    }
+    return -1;
+}
+
+// Handle bg, fg and kill.
+static void control_request(client_t *client, char **args) {
+    job_t *job = NULL;
+    if (args[1] != NULL) job = get_job_by_id(daemon_job_list, atoi(args[1] + (args[1][0] == '%')));
+    if (job == NULL) {
+        respond_error(client, "job not found");
+        return;
+    }
+    if (strcmp(args[0], "kill") == 0) {
+        int sig = args[2] != NULL ? parse_signal(args[2]) : SIGTERM;
+        if (sig == -1) respond_error(client, "invalid signal");
+        else if (job->state == QUEUED && (sig == SIGSTOP || sig == SIGTSTP || sig == SIGCONT))
+            respond_error(client, "the job is queued");
+        else if (job->state == QUEUED) {
+            respond(client, "{\"event\":\"ok\"}\n");
+            cancel_queued_job(daemon_job_list, job);
+        }
+        else if (killpg(job->pid, sig) == -1) respond_error(client, strerror(errno));
+        else respond(client, "{\"event\":\"ok\"}\n");
+        return;
+    }
+    // The daemon has no terminal, so fg only moves the completion of the job to this client.
+    if (strcmp(args[0], "fg") == 0) {
+        job->on_done = report_done;
+        job->done_data = client;
+    }
+    if (job->state == QUEUED) run_queued_job(daemon_job_list, job, 1);
+    else if (job->state == STOPPED) {
+        set_job_state(daemon_job_list, job, BACKGROUND);
+        killpg(job->pid, SIGCONT);
+    }
+    respond(client, "{\"event\":\"ok\"}\n");
+}
+
+static void handle_request(client_t *client, char *line) {
+    line += strspn(line, " \t");
+    if (strncmp(line, "run ", 4) == 0) {
+        run_request(client, line + 4);
+        return;
+    }
+    command_line_t cmd_line;
+    arena_reset(&arena);
+    parse_args(line, &arena, &cmd_line);
+    if (cmd_line.count == 0 || cmd_line.cmds[0].argc == 0) return;
+    char **args = cmd_line.cmds[0].args;
+    if (strcmp(args[0], "jobs") == 0) jobs_request(client);
+    else if (strcmp(args[0], "bg") == 0 || strcmp(args[0], "fg") == 0 || strcmp(args[0], "kill") == 0)
+        control_request(client, args);
+    else respond_error(client, "unknown request");
+}
+
+static void client_callback(int fd, unsigned int events, void *data) {
+    client_t *client = data;
+    if (client->broken || ((events & EPOLLOUT) && flush_client(client) == -1)) {
+        close_client(client);
+        return;
+    }
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+    int eof = 0;
+    while (1) {
+        if (client->in_cap - client->in_len < 4096) {
+            client->in_cap = client->in_cap ? client->in_cap * 2 : 8192;
+            client->in = realloc(client->in, client->in_cap);
+        }
+        ssize_t n = read(fd, client->in + client->in_len, client->in_cap - client->in_len - 1);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            eof = n == 0 || errno != EAGAIN;
+            break;
+        }
+        client->in_len += n;
+        // A short read emptied the socket.
+        if (client->in_len < client->in_cap - 1) break;
+    }
+    // Handle the complete lines, and keep the rest for the next read.
+    char *line = client->in, *end;
+    client->in[client->in_len] = '\0';
+    while ((end = memchr(line, '\n', client->in + client->in_len - line)) != NULL) {
+        *end = '\0';
+        handle_request(client, line);
+        line = end + 1;
+    }
+    client->in_len -= line - client->in;
+    memmove(client->in, line, client->in_len);
+    if (client->in_len > REQUEST_MAX) {
+        respond_error(client, "request too long");
+        eof = 1;
+    }
+    // The responses to all the requests of the batch are sent together.
+    if (flush_client(client) == -1 || eof) close_client(client);
+}
+
+static void accept_callback(int fd, unsigned int events, void *data) {
+    int client_fd;
+    while ((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        client_t *client = calloc(1, sizeof(client_t));
+        client->fd = client_fd;
+        if (event_add(client_fd, EPOLLIN, client_callback, client) == -1) {
+            close(client_fd);
+            free(client);
+        }
+    }
+}
+
+void run_daemon(job_list_t *job_list, const char *path) {
+    daemon_job_list = job_list;
+    arena_init(&arena);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "daemon: socket path too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+    // Replace the socket of a previous daemon.
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror(path);
+        exit(1);
+    }
+    event_add(fd, EPOLLIN, accept_callback, NULL);
+    // The jobs do not read the daemon's stdin.
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd != -1) {
+        dup2(null_fd, STDIN_FILENO);
+        if (null_fd != STDIN_FILENO) close(null_fd);
+    }
+    while (1) {
+        event_run(-1);
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,39 @@
+#include "job_control.h"
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+// Longest request line accepted from a client.
+#define REQUEST_MAX (1 << 20)
+// Most bytes of responses kept for a client that does not read them, before it is disconnected.
+#define CLIENT_OUTPUT_MAX (16 << 20)
+
+/*
+ * Function: run_daemon
+ * --------------------
+ *   Serve jobs over a Unix domain socket instead of reading commands ("shell --daemon path").
+ *   Any number of clients connect to the socket, and are served by the event loop together
+ *   with the jobs. A client sends one request per line, and receives one JSON object per
+ *   line for each response and for each completion of the jobs it submitted:
+ *
+ *     run <command line>  start the pipelines of the line as background jobs (a list joined
+ *                         by ;, && or || has to be grouped with ( ... )). A pipeline may start
+ *                         with the limit, nice and timeout prefixes, as in the shell.
+ *                         -> {"event":"started","id":N,"pid":P,"state":"running"|"queued"} per job
+ *                         -> {"event":"done","id":N,"pid":P,"status":S,"signal":null|G,"elapsed":T} when it finishes
+ *     jobs                -> {"event":"job","id":N,"pid":P,"state":"Running",...,"cmd":"..."} per job,
+ *                            then {"event":"end"}
+ *     bg %N               continue a stopped job -> {"event":"ok"}
+ *     fg %N               continue a job, and send its completion to this client -> {"event":"ok"}
+ *     kill %N [signal]    send a signal (TERM by default, a number or a name) to a job, or
+ *                         remove it from the admission queue -> {"event":"ok"}
+ *
+ *   Errors are reported with {"event":"error","message":"..."}. The jobs keep running when
+ *   the client that submitted them disconnects. The function does not return.
+ *
+ *   job_list: the job list
+ *   path: the path of the socket (an existing socket there is replaced)
+ */
+void run_daemon(job_list_t *job_list, const char *path);
+
+#endif
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "event_loop.h"
+
+typedef struct {
+    event_callback_t callback;
+    void *data;
+    unsigned int events;
+} handler_t;
+
+static int epoll_fd = -1;
+// Handlers indexed by file descriptor.
+static handler_t *handlers = NULL;
+static int handler_cap = 0;
+
+int event_init(void) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+int event_reset(void) {
+    close(epoll_fd);
+    if (handler_cap > 0) memset(handlers, 0, sizeof(handler_t) * handler_cap);
+    return event_init();
+}
+
+int event_add(int fd, unsigned int events, event_callback_t callback, void *data) {
+    if (fd >= handler_cap) {
+        int old_cap = handler_cap;
+        handler_cap = handler_cap ? handler_cap : 64;
+        while (fd >= handler_cap) handler_cap *= 2;
+        handlers = realloc(handlers, sizeof(handler_t) * handler_cap);
+        memset(handlers + old_cap, 0, sizeof(handler_t) * (handler_cap - old_cap));
+    }
+    struct epoll_event ev = {.events = events, .data.fd = fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) return -1;
+    // Added once anyway, to find out whether it can be watched at all.
+    if (events == 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    handlers[fd].callback = callback;
+    handlers[fd].data = data;
+    handlers[fd].events = events;
+    return 0;
+}
+
+void event_mod(int fd, unsigned int events) {
+    if (fd >= handler_cap || handlers[fd].callback == NULL || handlers[fd].events == events) return;
+    struct epoll_event ev = {.events = events, .data.fd = fd};
+    // epoll always reports EPOLLHUP and EPOLLERR, so a disabled descriptor is taken out of the set.
+    if (events == 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    else epoll_ctl(epoll_fd, handlers[fd].events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+    handlers[fd].events = events;
+}
+
+void event_del(int fd) {
+    if (fd >= handler_cap || handlers[fd].callback == NULL) return;
+    if (handlers[fd].events != 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    handlers[fd].callback = NULL;
+}
+
+int event_run(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (n == -1) {
+        if (errno != EINTR) perror("epoll_wait");
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        // The handler may have been removed or disabled by an earlier callback in this batch.
+        if (fd < handler_cap && handlers[fd].callback != NULL && handlers[fd].events != 0)
+            handlers[fd].callback(fd, events[i].events, handlers[fd].data);
+    }
+    return n;
+}
@@ -0,0 +1,75 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <sys/epoll.h>
+
+#define MAX_EVENTS 64
+
+typedef void (*event_callback_t)(int fd, unsigned int events, void *data);
+
+/*
+ * Function: event_init
+ * --------------------
+ *   Create the epoll instance of the shell's event loop.
+ *
+ *   returns: 0 on success, -1 on error
+ */
+int event_init(void);
+
+/*
+ * Function: event_reset
+ * ---------------------
+ *   Start an empty event loop in a forked child, which otherwise shares the epoll
+ *   instance of its parent. All the handlers are removed.
+ *
+ *   returns: 0 on success, -1 on error
+ */
+int event_reset(void);
+
+/*
+ * Function: event_add
+ * -------------------
+ *   Watch a file descriptor.
+ *
+ *   fd: the file descriptor
+ *   events: the epoll events to watch for (0 to register it disabled, see event_mod)
+ *   callback: the function called when one of the events occurs
+ *   data: passed to the callback
+ *
+ *   returns: 0 on success, -1 on error (errno is EPERM for regular files)
+ */
+int event_add(int fd, unsigned int events, event_callback_t callback, void *data);
+
+/*
+ * Function: event_mod
+ * -------------------
+ *   Change the events watched for on a file descriptor. A disabled descriptor is taken out
+ *   of the epoll instance (its handler is kept), so it does not wake up the loop when it is
+ *   hung up or in error either, until it is enabled again.
+ *
+ *   fd: the file descriptor
+ *   events: the epoll events to watch for (0 to disable it)
+ */
+void event_mod(int fd, unsigned int events);
+
+/*
+ * Function: event_del
+ * -------------------
+ *   Stop watching a file descriptor.
+ *
+ *   fd: the file descriptor
+ */
+void event_del(int fd);
+
+/*
+ * Function: event_run
+ * -------------------
+ *   Wait for events once and dispatch them to their callbacks.
+ *
+ *   timeout_ms: the maximum time to wait (-1 to wait forever, 0 to poll)
+ *
+ *   returns: the number of events dispatched
+ */
+int event_run(int timeout_ms);
+
+#endif
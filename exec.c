@@ -0,0 +1,886 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "admission.h"
+#include "affinity.h"
+#include "capture.h"
+#include "event_loop.h"
+#include "exec.h"
+#include "history.h"
+#include "input.h"
+#include "job_control.h"
+#include "path_cache.h"
+#include "spawn.h"
+#include "stats.h"
+#include "utilities.h"
+#include "utils.h"
+#include "watchdog.h"
+
+// Most bytes moved from the pipe by one splice call when capturing the output of a command substitution.
+#define SPLICE_CHUNK (1 << 20)
+
+int find_builtin(const char *cmd) {
+    for (int i = 0; i < NUM_BUILTINS; i++)
+        if (strcmp(cmd, builtin_cmd[i]) == 0) return i;
+    return -1;
+}
+
+const char *resolve_command(const char *cmd) {
+    const char *path;
+    // Check if the command has a path.
+    if (strchr(cmd, '/') == NULL) path = path_cache_lookup(cmd);
+    else path = access(cmd, F_OK) != -1 ? cmd : NULL;
+    if (path == NULL) printf("%s: command not found\n", cmd);
+    return path;
+}
+
+// The job list passed to built-in commands run as pipeline stages.
+static job_list_t *stage_job_list;
+
+// Run a built-in command as a pipeline stage (in a child process).
+static int run_builtin_stage(void *arg) {
+    char **args = arg;
+    // A built-in that runs the event loop (jobs --watch, parallel) must not take the events of the shell from
+    // their shared epoll instance. It keeps the jobs of the shell to list them, but only reaps its own.
+    if (event_reset() == -1 || init_sigchld_fd(stage_job_list) == -1) return 1;
+    reset_admission(stage_job_list);
+    reset_watchdog();
+    // Its stdin is the pipe from the previous stage, not the input of the shell.
+    stdin_reader = NULL;
+    return builtin_func[find_builtin(args[0])](stage_job_list, args);
+}
+
+// Run a utility as a pipeline stage (in a child process), executing it if the shell leaves it to the executable.
+static int run_utility_stage(void *arg) {
+    char **args = arg;
+    int status = run_utility(args);
+    if (status != UTILITY_EXEC) return status;
+    const char *path = resolve_command(args[0]);
+    if (path == NULL) return 127;
+    stat_add(STAT_EXECS, 1);
+    execv(path, args);
+    stat_add(STAT_EXEC_FAILURES, 1);
+    perror("execv");
+    return -1;
+}
+
+static int run_commands(job_list_t *job_list, command_t *cmds, int num_cmds, int exec_last);
+static int exit_code(int status);
+
+// Run the command line of a ( ... ) group in a subshell without job control (in a child process).
+static int run_group_stage(void *arg) {
+    // The command line may be in the memory of a queued job, which init_subshell frees.
+    char *group = strdup(arg);
+    init_subshell(stage_job_list);
+    job_control = has_terminal = 0;
+    terminal_signal_handler(SIG_DFL);
+    arena_t arena;
+    command_line_t cmd_line;
+    arena_init(&arena);
+    parse_args(group, &arena, &cmd_line);
+    // The last command replaces the subshell.
+    return exit_code(run_commands(stage_job_list, cmd_line.cmds, cmd_line.count, 1));
+}
+
+/*
+ * Function: run_stages
+ * --------------------
+ *   Start the processes of a pipeline, as a new job or into a queued job.
+ *
+ *   returns: the job, or NULL if no new job could be started
+ */
+static job_t *run_stages(job_list_t *job_list, job_t *job, command_t *stages, int num_stages, int bg_process, const launch_attr_t *launch) {
+    job_limits_t job_limits = {0};
+    if (launch != NULL && launch->limits != NULL) job_limits = *launch->limits;
+    if (bg_process) merge_limits(&job_limits, &bg_limits);
+    int nice = launch != NULL ? launch->nice : 0;
+    // The command line of a queued job is already complete.
+    int queued = job != NULL;
+    spawn_attr_t attr = {job_control ? 0 : -1, !bg_process && has_terminal, -1, -1, -1, job_limits.mask ? &job_limits : NULL, -1, nice};
+    // Spread the background jobs over the CPUs.
+    if (bg_process && autopin) attr.cpu = next_autopin_cpu();
+    stage_job_list = job_list;
+    // The output of all the stages of a captured background job goes through one pipe to its buffer.
+    int out_fds[2] = {-1, -1};
+    if (bg_process) open_job_output(out_fds);
+    attr.stderr_fd = out_fds[1];
+    // Write out what the shell printed so far, so it comes before the output of the children.
+    fflush(stdout);
+    int in_fd = -1;
+    for (int i = 0; i < num_stages; i++) {
+        char **args = stages[i].args;
+        int fds[2] = {-1, -1};
+        if (i < num_stages - 1 && make_pipe(fds) == -1) break;
+        attr.stdin_fd = in_fd;
+        attr.stdout_fd = i < num_stages - 1 ? fds[1] : out_fds[1];
+        pid_t pid = -1;
+        // A group runs in a subshell.
+        if (stages[i].group != NULL) pid = spawn_function(run_group_stage, stages[i].group, &attr);
+        // Built-in commands run in a forked child when they are part of a pipeline.
+        else if (find_builtin(args[0]) != -1) pid = spawn_function(run_builtin_stage, args, &attr);
+        // So do the utilities, which saves the exec.
+        else if (find_utility(args[0]) != -1) pid = spawn_function(run_utility_stage, args, &attr);
+        else {
+            const char *path = resolve_command(args[0]);
+            if (path != NULL) pid = spawn_process(path, args, &attr);
+        }
+        // The children have their own copies of the pipe ends.
+        if (in_fd != -1) close(in_fd);
+        if (fds[1] != -1) close(fds[1]);
+        in_fd = fds[0];
+        // A missing stage is skipped, the next stage just sees the end of its input.
+        if (pid < 0) continue;
+        if (job == NULL) {
+            // The first process leads the process group of the job.
+            job = add_job(job_list, pid, bg_process ? BACKGROUND : FOREGROUND, args);
+            job->limits = job_limits;
+            job->priority = nice;
+            job->pinned = attr.cpu != -1;
+            if (job_control) attr.pgid = pid;
+        }
+        else if (job->num_procs == 0) {
+            // The first process of a queued job leads its process group.
+            job->pid = pid;
+            job->pinned = attr.cpu != -1;
+            add_job_process(job_list, job, pid, NULL);
+            if (job_control) attr.pgid = pid;
+        }
+        else add_job_process(job_list, job, pid, queued ? NULL : args);
+    }
+    if (in_fd != -1) close(in_fd);
+    if (out_fds[0] != -1) {
+        close(out_fds[1]);
+        if (job != NULL) attach_job_output(job, out_fds[0]);
+        else close(out_fds[0]);
+    }
+    return job;
+}
+
+job_t *start_job(job_list_t *job_list, command_t *stages, int num_stages, int bg_process, const launch_attr_t *launch) {
+    job_t *job;
+    // Background jobs wait in the admission queue while the shell is at capacity.
+    if (bg_process && (launch == NULL || !launch->unqueued) && !admit_job(job_list)) {
+        job_limits_t limits = {0};
+        if (launch != NULL && launch->limits != NULL) limits = *launch->limits;
+        merge_limits(&limits, &bg_limits);
+        job = queue_job(job_list, stages, num_stages, &limits, launch != NULL ? launch->nice : 0);
+    }
+    else job = run_stages(job_list, NULL, stages, num_stages, bg_process, launch);
+    long history = launch != NULL ? launch->history : -1;
+    if (job != NULL) job->history = history;
+    // None of the commands could be started.
+    if (job == NULL) set_history_result(history, 127 << 8, 0);
+    if (job != NULL && launch != NULL && launch->timeout_ms > 0) {
+        set_deadline(job, launch->timeout_ms, launch->grace_ms);
+    }
+    return job;
+}
+
+int start_job_processes(job_list_t *job_list, job_t *job, command_t *stages, int num_stages, int bg_process) {
+    launch_attr_t launch = {&job->limits, job->priority, job->history};
+    run_stages(job_list, job, stages, num_stages, bg_process, &launch);
+    return job->num_procs;
+}
+
+job_t *launch_job(job_list_t *job_list, command_t *stages, int num_stages, int bg_process, const launch_attr_t *launch) {
+    job_t *job = start_job(job_list, stages, num_stages, bg_process, launch);
+    // Wait for a foreground job until it is stopped or finished.
+    if (job != NULL && !bg_process) {
+        wait_for_job(job_list, job, 0);
+        return NULL;
+    }
+    return job;
+}
+
+static double tv_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void print_times(double real, const struct rusage *usage) {
+    fprintf(stderr, "\nreal\t%.3fs\nuser\t%.3fs\nsys\t%.3fs\nmaxrss\t%ldK\nfaults\t%ld major, %ld minor\n",
+            real, tv_seconds(usage->ru_utime), tv_seconds(usage->ru_stime),
+            usage->ru_maxrss, usage->ru_majflt, usage->ru_minflt);
+}
+
+// Called when a timed job has finished (possibly after being stopped and resumed).
+static void report_job_times(job_t *job, void *data) {
+    if (WIFSIGNALED(job->status)) printf("[%d] %d terminated by signal %d\n", job->pgid, job->pid, WTERMSIG(job->status));
+    fflush(stdout);
+    print_times(job_elapsed(job), &job->usage);
+}
+
+// Run a built-in command in the shell and report the time it took.
+static int time_builtin(job_list_t *job_list, char **args) {
+    struct rusage before, after;
+    struct timespec start, end;
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = builtin_func[find_builtin(args[0])](job_list, args);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &after);
+    timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+    after.ru_majflt -= before.ru_majflt;
+    after.ru_minflt -= before.ru_minflt;
+    fflush(stdout);
+    print_times((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, &after);
+    return status;
+}
+
+static void print_bg_job(job_t *job) {
+    if (job->state == QUEUED) printf("[%d] queued\n", job->pgid);
+    else printf("[%d] %d\n", job->pgid, job->pid);
+}
+
+/*
+ * Function: strip_limit_prefix
+ * ----------------------------
+ *   Remove a "limit name=value ..." prefix from a command.
+ *
+ *   returns: 1 if there was one, 0 if not (e.g. the limit builtin itself), -1 if a limit is invalid
+ */
+static int strip_limit_prefix(command_t *cmd, job_limits_t *limits) {
+    if (cmd->argc < 2 || strcmp(cmd->args[0], "limit") != 0 || strchr(cmd->args[1], '=') == NULL) return 0;
+    int i = 1;
+    for (; i < cmd->argc && strchr(cmd->args[i], '=') != NULL; i++)
+        if (parse_limit(cmd->args[i], limits) == -1) {
+            printf("limit: invalid limit '%s'\n", cmd->args[i]);
+            return -1;
+        }
+    // Only limits: let the builtin complain.
+    if (i == cmd->argc) return 0;
+    cmd->args += i;
+    cmd->argc -= i;
+    return 1;
+}
+
+/*
+ * Function: strip_nice_prefix
+ * ---------------------------
+ *   Remove a "nice [-n N]" prefix from a command (the niceness defaults to 10, as for nice(1)).
+ *
+ *   returns: 1 if there was one, 0 if not
+ */
+static int strip_nice_prefix(command_t *cmd, int *nice) {
+    if (cmd->argc < 2 || strcmp(cmd->args[0], "nice") != 0) return 0;
+    int skip = 1, value = 10;
+    if (strcmp(cmd->args[1], "-n") == 0 && cmd->argc > 2) {
+        value = atoi(cmd->args[2]);
+        skip = 3;
+    }
+    // Without a command, it is the nice(1) program printing the niceness.
+    if (skip >= cmd->argc) return 0;
+    if (value < NICE_MIN) value = NICE_MIN;
+    if (value > NICE_MAX) value = NICE_MAX;
+    *nice = value;
+    cmd->args += skip;
+    cmd->argc -= skip;
+    return 1;
+}
+
+/*
+ * Function: strip_timeout_prefix
+ * ------------------------------
+ *   Remove a "timeout [-k grace] duration" prefix from a command (the grace period may also
+ *   follow the duration, and defaults to timeout_grace).
+ *
+ *   returns: 1 if there was one, 0 if not, -1 if a duration is invalid
+ */
+static int strip_timeout_prefix(command_t *cmd, launch_attr_t *launch) {
+    if (cmd->argc < 2 || strcmp(cmd->args[0], "timeout") != 0) return 0;
+    int i = 1, timeout_ms = -1, grace_ms = timeout_grace * 1000;
+    while (i < cmd->argc) {
+        int grace = strcmp(cmd->args[i], "-k") == 0;
+        // The command starts after the duration.
+        if (!grace && timeout_ms != -1) break;
+        if (grace && ++i == cmd->argc) break;
+        int ms = parse_duration(cmd->args[i]);
+        if (ms == -1) {
+            printf("timeout: invalid duration '%s'\n", cmd->args[i]);
+            return -1;
+        }
+        if (grace) grace_ms = ms;
+        else timeout_ms = ms;
+        i++;
+    }
+    if (timeout_ms == -1 || i == cmd->argc) {
+        printf("timeout: no command\n");
+        return -1;
+    }
+    launch->timeout_ms = timeout_ms;
+    launch->grace_ms = grace_ms;
+    cmd->args += i;
+    cmd->argc -= i;
+    return 1;
+}
+
+int strip_launch_prefixes(command_t *cmd, job_limits_t *limits, launch_attr_t *launch) {
+    int prefixes = 0, stripped;
+    while (cmd->argc > 0 && cmd->group == NULL) {
+        if (!(prefixes & PREFIX_TIME) && strcmp(cmd->args[0], "time") == 0) {
+            cmd->args++;
+            cmd->argc--;
+            prefixes |= PREFIX_TIME;
+        }
+        else if ((stripped = strip_limit_prefix(cmd, limits)) != 0) {
+            if (stripped == -1) return -1;
+            prefixes |= PREFIX_LIMIT;
+        }
+        else if (strip_nice_prefix(cmd, &launch->nice)) prefixes |= PREFIX_NICE;
+        else if ((stripped = strip_timeout_prefix(cmd, launch)) != 0) {
+            if (stripped == -1) return -1;
+            prefixes |= PREFIX_TIMEOUT;
+        }
+        else break;
+    }
+    if (prefixes & PREFIX_LIMIT) launch->limits = limits;
+    return prefixes;
+}
+
+// Give the history entry of the line to the job about to be started.
+static void take_history(launch_attr_t *launch) {
+    launch->history = history_current;
+    history_current = -1;
+}
+
+/*
+ * Function: run_utility_command
+ * -----------------------------
+ *   Run a utility in the shell. When it is the last command of the line, its status and
+ *   duration go to the history entry of the line.
+ *
+ *   returns: the exit status, or UTILITY_EXEC if the command has to be executed
+ */
+static int run_utility_command(char **args, int last) {
+    long long start = stat_now();
+    int status = run_utility(args);
+    if (status != UTILITY_EXEC && last) {
+        set_history_result(history_current, status << 8, (stat_now() - start) / 1e9);
+        history_current = -1;
+    }
+    return status;
+}
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} text_t;
+
+static void append_text(text_t *text, const char *str, size_t len) {
+    if (text->len + len + 1 > text->cap) {
+        // Doubling keeps the copies linear in the size of the line, however large the output.
+        text->cap = text->cap ? text->cap : 256;
+        while (text->len + len + 1 > text->cap) text->cap *= 2;
+        text->data = realloc(text->data, text->cap);
+    }
+    memcpy(text->data + text->len, str, len);
+    text->len += len;
+    text->data[text->len] = '\0';
+}
+
+// Append an argument to a command line, quoted if it has to be (so it is not expanded again).
+static void append_arg(text_t *text, const char *arg) {
+    const char *plain = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+=.,/:@%";
+    if (*arg != '\0' && arg[strspn(arg, plain)] == '\0') {
+        append_text(text, arg, strlen(arg));
+        return;
+    }
+    append_text(text, "'", 1);
+    for (const char *p = arg; *p != '\0'; p++) {
+        if (*p == '\'') append_text(text, "'\\''", 4);
+        else append_text(text, p, 1);
+    }
+    append_text(text, "'", 1);
+}
+
+static const char *separator_str(char separator) {
+    switch (separator) {
+        case SEP_AND: return "&&";
+        case SEP_OR: return "||";
+        case '&': return "&";
+        case '|': return "|";
+        case ';': return ";";
+        default: return "";
+    }
+}
+
+/*
+ * Function: format_commands
+ * -------------------------
+ *   Write parsed commands back as a command line, to be parsed again later (by a subshell, or
+ *   when a stopped list is resumed).
+ *
+ *   cmds: the commands
+ *   from, to: the first and last commands
+ *   last_separator: whether to write the separator after the last command
+ *
+ *   returns: the command line (to free)
+ */
+static char *format_commands(command_t *cmds, int from, int to, int last_separator) {
+    text_t text = {0};
+    append_text(&text, "", 0);
+    for (int i = from; i <= to; i++) {
+        // A command that has not run yet keeps its substitutions.
+        if (cmds[i].source != NULL) append_text(&text, cmds[i].source, strlen(cmds[i].source));
+        else if (cmds[i].group != NULL) {
+            append_text(&text, "( ", 2);
+            append_text(&text, cmds[i].group, strlen(cmds[i].group));
+            append_text(&text, " )", 2);
+        }
+        else for (int j = 0; j < cmds[i].argc; j++) {
+            if (j > 0) append_text(&text, " ", 1);
+            append_arg(&text, cmds[i].args[j]);
+        }
+        if (i == to && !last_separator) break;
+        append_text(&text, " ", 1);
+        append_text(&text, separator_str(cmds[i].separator), strlen(separator_str(cmds[i].separator)));
+        append_text(&text, " ", 1);
+    }
+    return text.data;
+}
+
+// Exit status of a wait status (128 + the signal for a process killed by a signal).
+static int exit_code(int status) {
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+/*
+ * Function: exec_command
+ * ----------------------
+ *   Execute a command in place of the shell (the last command of a subshell or of -c), which
+ *   saves a fork. A utility just runs in the shell.
+ *
+ *   returns: the wait status of a utility, or of a command that could not be executed
+ */
+static int exec_command(char **args) {
+    int status = find_utility(args[0]) != -1 ? run_utility(args) : UTILITY_EXEC;
+    if (status != UTILITY_EXEC) return status << 8;
+    const char *path = resolve_command(args[0]);
+    if (path == NULL) return 127 << 8;
+    fflush(stdout);
+    // The shell blocks SIGCHLD (for its signalfd), the command must not inherit the mask.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    stat_add(STAT_EXECS, 1);
+    execv(path, args);
+    stat_add(STAT_EXEC_FAILURES, 1);
+    perror("execv");
+    return 126 << 8;
+}
+
+/*
+ * Function: substitute_stages
+ * ---------------------------
+ *   Run the command substitutions of the stages of a pipeline, and parse the stages again.
+ *
+ *   returns: 0 on success, -1 (after printing an error) if a substitution is not terminated
+ */
+static int substitute_stages(job_list_t *job_list, command_t *stages, int num_stages, arena_t *arena) {
+    for (int i = 0; i < num_stages; i++) {
+        if (stages[i].source == NULL) continue;
+        char *line = substitute_commands(job_list, stages[i].source);
+        if (line == NULL) return -1;
+        char *text = line;
+        if (line != stages[i].source) {
+            text = arena_alloc(arena, strlen(line) + 1);
+            strcpy(text, line);
+            free(line);
+        }
+        // The output is escaped, so the command is still a single one.
+        command_line_t cmd_line;
+        parse_args(text, arena, &cmd_line);
+        stages[i].args = cmd_line.cmds[0].args;
+        stages[i].argc = cmd_line.cmds[0].argc;
+        stages[i].source = NULL;
+    }
+    return 0;
+}
+
+/*
+ * Function: run_commands
+ * ----------------------
+ *   Run parsed commands (see execute_line).
+ *
+ *   exec_last: whether to execute the last command in place of the shell
+ *
+ *   returns: the wait status of the last pipeline that ran
+ */
+static int run_commands(job_list_t *job_list, command_t *cmds, int num_cmds, int exec_last) {
+    // The job of the last command (not the empty one after a final '&') takes over the history entry of the line.
+    int last_cmd = num_cmds - 1;
+    while (last_cmd > 0 && cmds[last_cmd].argc == 0) last_cmd--;
+    int status = 0;
+    // Separator before the current pipeline.
+    char before = ';';
+    // Arguments of the commands with substitutions.
+    arena_t arena;
+    arena_init(&arena);
+    for (int k = 0, next = 0; k < num_cmds; k = next) {
+        // The commands up to the next non-pipe separator form one pipeline.
+        int last = k;
+        while (last < num_cmds - 1 && cmds[last].separator == '|') last++;
+        next = last + 1;
+        int num_stages = last - k + 1;
+        char after = cmds[last].separator;
+
+        // After && or ||, a pipeline only runs if the last one succeeded or failed (the status stays the same otherwise).
+        int in_list = before == SEP_AND || before == SEP_OR;
+        int skip = (before == SEP_AND && status != 0) || (before == SEP_OR && status == 0);
+        before = after;
+        if (skip) continue;
+        if (!in_list && (after == SEP_AND || after == SEP_OR)) {
+            // A list joined by && and || that ends with & runs in the background as a whole, in a subshell.
+            int end = last;
+            while (end < num_cmds - 1 && cmds[end].separator != ';' && cmds[end].separator != '&') end++;
+            if (cmds[end].separator == '&') {
+                char *list = format_commands(cmds, k, end, 0);
+                char *args[] = {group_open, list, group_close, NULL};
+                command_t group = {args, 3, '&', list};
+                launch_attr_t launch = {NULL, 0, -1};
+                if (end == last_cmd) take_history(&launch);
+                job_t *job = start_job(job_list, &group, 1, 1, &launch);
+                if (job != NULL && job_control) print_bg_job(job);
+                free(list);
+                status = job != NULL ? 0 : 127 << 8;
+                next = end + 1;
+                before = '&';
+                continue;
+            }
+        }
+
+        // Check if the command needs to be executed in the background.
+        int bg_process = after == '&';
+
+        // The substitutions of a pipeline run only now, after the pipelines before it.
+        if (substitute_stages(job_list, &cmds[k], num_stages, &arena) == -1) {
+            status = 2 << 8;
+            break;
+        }
+
+        job_limits_t limits = {0};
+        launch_attr_t launch = {NULL, 0, -1};
+        int prefixes = strip_launch_prefixes(&cmds[k], &limits, &launch);
+        if (prefixes == -1) {
+            status = 2 << 8;
+            continue;
+        }
+        int timed = prefixes & PREFIX_TIME, limited = prefixes & PREFIX_LIMIT;
+        int niced = prefixes & PREFIX_NICE, watched = prefixes & PREFIX_TIMEOUT;
+
+        int empty = 0, error = 0;
+        for (int i = k; i <= last; i++) {
+            empty |= cmds[i].argc == 0;
+            // A group has to be closed, and be the whole command.
+            if (cmds[i].group != NULL && cmds[i].argc == 2) {
+                printf("syntax error: unterminated (\n");
+                error = 1;
+            }
+            else if (cmds[i].group != NULL && cmds[i].argc > 3) {
+                printf("syntax error near unexpected token '%s'\n", cmds[i].args[3]);
+                error = 1;
+            }
+        }
+        if (error) {
+            status = 2 << 8;
+            break;
+        }
+        if (empty) {
+            // If no arguments, continue (an empty pipeline stage is an error).
+            if (num_stages > 1 || after == SEP_AND || after == SEP_OR) {
+                printf("syntax error near unexpected token '%s'\n", separator_str(after));
+                status = 2 << 8;
+                break;
+            }
+        }
+        else if (num_stages == 1 && cmds[k].group == NULL && strcmp(cmds[k].args[0], "exit") == 0) {
+            // Reap all zombie processes.
+            reap_jobs(job_list);
+            print_notifications();
+            free_job_list(job_list);
+            // Exit shell.
+            exit(0);
+        }
+        else if (num_stages == 1 && find_builtin(cmds[k].args[0]) != -1 && !limited && !niced && !watched) {
+            // If it's a built-in command, execute it (in a child if it has limits, a niceness or a time limit).
+            if (timed) status = time_builtin(job_list, cmds[k].args);
+            else status = builtin_func[find_builtin(cmds[k].args[0])](job_list, cmds[k].args);
+            // Its exit status is the one of the foreground command, for && and ||.
+            status <<= 8;
+            job_list->fg_status = status;
+        }
+        else if (num_stages == 1 && !bg_process && !timed && !limited && !niced && !watched && find_utility(cmds[k].args[0]) != -1
+                 && (status = run_utility_command(cmds[k].args, last == last_cmd)) != UTILITY_EXEC) {
+            // The utility ran in the shell, without a fork and exec.
+            status <<= 8;
+        }
+        else if (exec_last && last == last_cmd && num_stages == 1 && !bg_process && !timed && !limited && !niced
+                 && !watched && cmds[k].group == NULL) {
+            // Only returns if the command could not be executed.
+            status = exec_command(cmds[k].args);
+        }
+        else {
+            if (last == last_cmd) take_history(&launch);
+            job_t *job = start_job(job_list, &cmds[k], num_stages, bg_process, &launch);
+            if (job == NULL) {
+                status = 127 << 8;
+                continue;
+            }
+            // The times are reported whenever the job finishes, even after a stop and bg.
+            if (timed) job->on_done = report_job_times;
+            if (bg_process) {
+                // Print the job pgid and the command line.
+                if (job_control) print_bg_job(job);
+                status = 0;
+                continue;
+            }
+            status = wait_for_job(job_list, job, 0);
+            if (status != -1) continue;
+            // The job was stopped: the rest of the line runs once it has finished, so fg resumes the whole list.
+            int rest = next;
+            while (rest < num_cmds && cmds[rest].argc == 0) rest++;
+            if (rest < num_cmds && (job = get_job_by_id(job_list, job->pgid)) != NULL) {
+                char *commands = format_commands(cmds, next, num_cmds - 1, 1);
+                job->chain = malloc(strlen(separator_str(after)) + strlen(commands) + 2);
+                sprintf(job->chain, "%s %s", separator_str(after), commands);
+                free(commands);
+                append_job_cmd(job, job->chain);
+            }
+            arena_free(&arena);
+            return (128 + SIGTSTP) << 8;
+        }
+    }
+    arena_free(&arena);
+    return status;
+}
+
+int execute_line(job_list_t *job_list, command_line_t *cmd_line) {
+    return run_commands(job_list, cmd_line->cmds, cmd_line->count, 0);
+}
+
+void run_chains(job_list_t *job_list) {
+    while (job_list->chains != NULL) {
+        chain_t *chain = job_list->chains;
+        job_list->chains = chain->next;
+        if (chain->foreground) {
+            arena_t arena;
+            command_line_t cmd_line;
+            arena_init(&arena);
+            parse_args(chain->line, &arena, &cmd_line);
+            execute_line(job_list, &cmd_line);
+            arena_free(&arena);
+        }
+        else {
+            // The job had been moved to the background, so the rest of its list runs there too.
+            char *args[] = {group_open, chain->line, group_close, NULL};
+            command_t group = {args, 3, '&', chain->line};
+            job_t *job = start_job(job_list, &group, 1, 1, NULL);
+            if (job != NULL) print_bg_job(job);
+        }
+        free(chain->line);
+        free(chain);
+    }
+}
+
+void init_subshell(job_list_t *job_list) {
+    // The jobs, event loop and queue of the parent are not the subshell's.
+    free_job_list(job_list);
+    init_job_list(job_list);
+    if (event_reset() == -1 || init_sigchld_fd(job_list) == -1) exit(1);
+    reset_admission(job_list);
+    reset_watchdog();
+    // Like the shell, the subshell takes the terminal back from its foreground jobs.
+    terminal_signal_handler(SIG_IGN);
+    stdin_reader = NULL;
+    history_current = -1;
+}
+
+typedef struct {
+    job_list_t *job_list;
+    char *line;
+} subshell_t;
+
+// Run a command line in a subshell (in a child process).
+static int run_subshell(void *arg) {
+    subshell_t *subshell = arg;
+    init_subshell(subshell->job_list);
+    arena_t arena;
+    command_line_t cmd_line;
+    arena_init(&arena);
+    parse_args(subshell->line, &arena, &cmd_line);
+    execute_line(subshell->job_list, &cmd_line);
+    return 0;
+}
+
+int run_command_line(job_list_t *job_list, char *line) {
+    arena_t arena;
+    command_line_t cmd_line;
+    arena_init(&arena);
+    parse_args(line, &arena, &cmd_line);
+    int status = exit_code(run_commands(job_list, cmd_line.cmds, cmd_line.count, 1));
+    arena_free(&arena);
+    return status;
+}
+
+/*
+ * Function: capture_output
+ * ------------------------
+ *   Run a command line in a subshell and collect its stdout. The output is spliced from
+ *   the pipe into a memory file (splice cannot move it into the shell's memory directly),
+ *   which is then mapped, so it is never copied through a user buffer or reallocated.
+ *
+ *   returns: the mapped output (to unmap), or NULL if it is empty or could not be captured
+ */
+static char *capture_output(job_list_t *job_list, char *line, size_t *size) {
+    *size = 0;
+    int fds[2];
+    if (make_pipe(fds) == -1) return NULL;
+    int mem_fd = memfd_create("substitution", MFD_CLOEXEC);
+    if (mem_fd == -1) {
+        perror("memfd_create");
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    subshell_t subshell = {job_list, line};
+    spawn_attr_t attr = {job_control ? 0 : -1, has_terminal, -1, fds[1], -1, NULL, -1, 0};
+    pid_t pid = spawn_function(run_subshell, &subshell, &attr);
+    close(fds[1]);
+    if (pid != -1) {
+        ssize_t n;
+        while ((n = splice(fds[0], NULL, mem_fd, NULL, SPLICE_CHUNK, SPLICE_F_MOVE)) > 0) *size += n;
+        if (n == -1 && errno == EINVAL) {
+            // The file system of the memory file does not support splice: copy the output.
+            char buf[65536];
+            while ((n = read(fds[0], buf, sizeof(buf))) > 0 && write(mem_fd, buf, n) == n) *size += n;
+        }
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+        if (has_terminal) tcsetpgrp(STDIN_FILENO, getpid());
+    }
+    close(fds[0]);
+    char *output = *size > 0 ? mmap(NULL, *size, PROT_READ, MAP_PRIVATE, mem_fd, 0) : NULL;
+    close(mem_fd);
+    if (output == MAP_FAILED) {
+        perror("mmap");
+        output = NULL;
+    }
+    if (output == NULL) *size = 0;
+    return output;
+}
+
+// Append the output of a command substitution: as is (but escaped) in double quotes,
+// otherwise split into words separated by single spaces, with the separators and quotes escaped.
+static void append_output(text_t *text, const char *output, size_t size, int quoted) {
+    // Trailing newlines are removed.
+    while (size > 0 && output[size - 1] == '\n') size--;
+    const char *special = quoted ? "\"\\" : " \t\\'\"&|;()`";
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++) {
+        char c = output[i];
+        int blank = !quoted && (c == ' ' || c == '\t' || c == '\n');
+        if (c != '\0' && !blank && strchr(special, c) == NULL) continue;
+        append_text(text, output + start, i - start);
+        start = i + 1;
+        if (blank) {
+            while (i + 1 < size && (output[i + 1] == ' ' || output[i + 1] == '\t' || output[i + 1] == '\n')) i++;
+            start = i + 1;
+            append_text(text, " ", 1);
+        }
+        else if (c != '\0') {
+            append_text(text, "\\", 1);
+            append_text(text, &c, 1);
+        }
+    }
+    append_text(text, output + start, size - start);
+}
+
+// Find the end of a command substitution: the matching ')' of "$(" (or of the '(' of a group), or the next unescaped '`'.
+static char *substitution_end(char *start) {
+    if (*start == '`') {
+        for (char *p = start + 1; *p != '\0'; p++) {
+            if (*p == '\\' && p[1] != '\0') p++;
+            else if (*p == '`') return p;
+        }
+        return NULL;
+    }
+    int depth = 1;
+    char quote = 0;
+    for (char *p = start + (*start == '(' ? 1 : 2); *p != '\0'; p++) {
+        if (*p == '\\' && quote != '\'' && p[1] != '\0') p++;
+        else if (quote) {
+            if (*p == quote) quote = 0;
+        }
+        else if (*p == '\'' || *p == '"') quote = *p;
+        else if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) return p;
+    }
+    return NULL;
+}
+
+char *substitute_commands(job_list_t *job_list, char *line) {
+    if (strchr(line, '`') == NULL && strstr(line, "$(") == NULL) return line;
+    text_t text = {0};
+    append_text(&text, "", 0);
+    char quote = 0;
+    char *p = line;
+    // Whether p is at the start of a command, where a parenthesis opens a group.
+    int command_start = 1;
+    while (*p != '\0') {
+        char *copy = p, *end;
+        if (quote == '\'') {
+            if (*p == '\'') quote = 0;
+        }
+        else if (!quote && *p == '(' && command_start && (end = substitution_end(p)) != NULL) {
+            // The substitutions of a group run in its subshell, so it is copied as is.
+            append_text(&text, p, end + 1 - p);
+            p = end + 1;
+            command_start = 0;
+            continue;
+        }
+        else if (*p == '\\' && p[1] != '\0') p++;
+        else if (*p == '"' || *p == '\'') quote = quote == *p ? 0 : quote ? quote : *p;
+        else if (*p == '`' || (*p == '$' && p[1] == '(')) {
+            end = substitution_end(p);
+            if (end == NULL) {
+                printf("syntax error: unterminated %s\n", *p == '`' ? "`" : "$(");
+                free(text.data);
+                return NULL;
+            }
+            // The command between the delimiters ("\`" stands for '`' between backquotes).
+            char *inner = *p == '`' ? p + 1 : p + 2;
+            size_t len = end - inner;
+            char *cmd = malloc(len + 1);
+            size_t n = 0;
+            for (size_t i = 0; i < len; i++) {
+                if (*p == '`' && inner[i] == '\\' && inner[i + 1] == '`') i++;
+                cmd[n++] = inner[i];
+            }
+            cmd[n] = '\0';
+            size_t size;
+            char *output = capture_output(job_list, cmd, &size);
+            free(cmd);
+            if (output != NULL) {
+                append_output(&text, output, size, quote == '"');
+                munmap(output, size);
+            }
+            p = end + 1;
+            command_start = 0;
+            continue;
+        }
+        // An unquoted (and unescaped) separator starts a new command.
+        if (!quote && p == copy && strchr(";&|(", *p) != NULL) command_start = 1;
+        else if (*p != ' ' && *p != '\t') command_start = 0;
+        p++;
+        append_text(&text, copy, p - copy);
+    }
+    return text.data;
+}
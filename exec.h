@@ -0,0 +1,188 @@
+#include "job_control.h"
+#include "rlimits.h"
+#include "utils.h"
+
+#ifndef EXEC_H
+#define EXEC_H
+
+typedef struct {
+    // Resource limits of the job, or NULL for none (background jobs also get the bg_limits that are not set here).
+    const job_limits_t *limits;
+    // Niceness of the processes, also the dispatch priority if the job is queued.
+    int nice;
+    // History entry that gets the status and duration of the job (-1 for none).
+    long history;
+    // Time limit of the job and grace period before SIGKILL, in ms (0 for none, see set_deadline).
+    int timeout_ms, grace_ms;
+    // Whether a background job starts right away, without going through admission (for a caller
+    // that limits how many of its jobs run at once, like parallel).
+    int unqueued;
+} launch_attr_t;
+
+// Prefixes of a command found by strip_launch_prefixes.
+enum launch_prefix {
+    PREFIX_TIME = 1, PREFIX_LIMIT = 2, PREFIX_NICE = 4, PREFIX_TIMEOUT = 8
+};
+
+/*
+ * Function: find_builtin
+ * ----------------------
+ *   Find a built-in command.
+ *
+ *   cmd: the command name
+ *
+ *   returns: the index of the command in builtin_cmd, or -1 if it is not a built-in command
+ */
+int find_builtin(const char *cmd);
+
+/*
+ * Function: resolve_command
+ * -------------------------
+ *   Find the executable of a command, either a path or a name looked up in the search directories.
+ *
+ *   cmd: the command
+ *
+ *   returns: the path of the executable, or NULL (after printing an error) if it does not exist
+ */
+const char *resolve_command(const char *cmd);
+
+/*
+ * Function: strip_launch_prefixes
+ * -------------------------------
+ *   Remove the "time", "limit name=value ...", "nice [-n N]" and "timeout [-k grace] duration"
+ *   prefixes of a command, in any order, and set the limits, niceness and time limit they give.
+ *
+ *   cmd: the command
+ *   limits: the resource limits given by "limit" (launch->limits then points to them)
+ *   launch: the launch attributes to set
+ *
+ *   returns: the PREFIX_* flags of the prefixes found, or -1 (after printing an error) if one is invalid
+ */
+int strip_launch_prefixes(command_t *cmd, job_limits_t *limits, launch_attr_t *launch);
+
+/*
+ * Function: start_job
+ * -------------------
+ *   Start the child processes of a pipeline in one process group and add it to the job list as one job.
+ *   Each stage reads the output of the previous one through a pipe.
+ *
+ *   job_list: the job list
+ *   stages: the commands of the stages
+ *   num_stages: the number of stages
+ *   bg_process: whether the job runs in the background
+ *   launch: the resource limits, niceness and time limit of the job, or NULL for the defaults
+ *
+ *   returns: the job (QUEUED if a background job is not admitted yet), or NULL if it could not be started
+ */
+job_t *start_job(job_list_t *job_list, command_t *stages, int num_stages, int bg_process, const launch_attr_t *launch);
+
+/*
+ * Function: start_job_processes
+ * -----------------------------
+ *   Start the processes of a job that was queued, with its limits and niceness.
+ *
+ *   job_list: the job list
+ *   job: the job (already taken out of the queue)
+ *   stages: the commands of the stages
+ *   num_stages: the number of stages
+ *   bg_process: whether the job runs in the background
+ *
+ *   returns: the number of processes started
+ */
+int start_job_processes(job_list_t *job_list, job_t *job, command_t *stages, int num_stages, int bg_process);
+
+/*
+ * Function: launch_job
+ * --------------------
+ *   Start a pipeline as one job (see start_job).
+ *   A foreground job is waited for, a background job is left running.
+ *
+ *   job_list: the job list
+ *   stages: the commands of the stages
+ *   num_stages: the number of stages
+ *   bg_process: whether the job runs in the background
+ *   launch: the resource limits, niceness and time limit of the job, or NULL for the defaults
+ *
+ *   returns: the background job, or NULL if it could not be started (or ran in the foreground)
+ */
+job_t *launch_job(job_list_t *job_list, command_t *stages, int num_stages, int bg_process, const launch_attr_t *launch);
+
+/*
+ * Function: execute_line
+ * ----------------------
+ *   Execute the commands of a parsed line: built-in commands run in the shell,
+ *   and so do the utilities (see find_utility) in the foreground, everything
+ *   else is launched as a foreground or background job.
+ *   A pipeline after && or || only runs if the last one succeeded or failed,
+ *   going by the status its job was reaped with (or the exit status of a built-in
+ *   command), and a list joined by && and ||
+ *   that ends with & runs in the background as a whole. A ( ... ) group runs in
+ *   a subshell. The command substitutions of a pipeline run once the pipelines before it
+ *   have, and only if it runs itself. When a foreground job is stopped, the rest of the line is kept
+ *   with it and runs once it has finished (see run_chains), so fg resumes the list.
+ *   A pipeline prefixed with "time" reports its real, user and system time,
+ *   max RSS and page faults on stderr when it finishes, one prefixed with
+ *   "limit name=value ..." runs with these resource limits, and one prefixed
+ *   with "nice [-n N]" runs with this niceness (and is dispatched before the
+ *   queued jobs with a higher niceness). One prefixed with "timeout [-k grace]
+ *   duration" is terminated once it has run for that long (see set_deadline).
+ *
+ *   job_list: the job list
+ *   cmd_line: the parsed line
+ *
+ *   returns: the wait status of the last pipeline that ran
+ */
+int execute_line(job_list_t *job_list, command_line_t *cmd_line);
+
+/*
+ * Function: run_chains
+ * --------------------
+ *   Run the rest of the command lists whose stopped job has finished: in the foreground
+ *   if the job was brought back there with fg, otherwise as a background subshell.
+ *
+ *   job_list: the job list
+ */
+void run_chains(job_list_t *job_list);
+
+/*
+ * Function: run_command_line
+ * --------------------------
+ *   Run a command line given with -c: the last command is executed in place of the shell,
+ *   instead of in a child.
+ *
+ *   job_list: the job list
+ *   line: the command line (modified)
+ *
+ *   returns: the exit status of the line (if the last command was not executed in place)
+ */
+int run_command_line(job_list_t *job_list, char *line);
+
+/*
+ * Function: substitute_commands
+ * -----------------------------
+ *   Replace the command substitutions of a command, $(cmd) and `cmd`, by the output of the
+ *   commands, run in subshells (where they can be nested). execute_line calls it for each
+ *   pipeline right before the pipeline runs, so a skipped one has no side effects. The trailing newlines of the
+ *   output are removed; outside double quotes it is split into words (separated by single
+ *   spaces), otherwise it is one word. The output is escaped so that parse_args keeps it
+ *   as is. Nothing is substituted between single quotes or after a backslash.
+ *
+ *   job_list: the job list
+ *   line: the command line
+ *
+ *   returns: the new line (to free), the line itself if it has no substitution, or NULL
+ *            (after printing an error) if a substitution is not terminated
+ */
+char *substitute_commands(job_list_t *job_list, char *line);
+
+/*
+ * Function: init_subshell
+ * -----------------------
+ *   Turn a forked child of the shell into a subshell: it starts with no jobs, its own
+ *   event loop, SIGCHLD descriptor, admission queue and timer wheel, and ignores the terminal signals.
+ *
+ *   job_list: the job list (emptied)
+ */
+void init_subshell(job_list_t *job_list);
+
+#endif
@@ -0,0 +1,540 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "expand.h"
+
+// Bytes of directory entries read by one getdents64 call.
+#define DENTS_BATCH (1 << 18)
+
+#define SET_BIT(set, c) ((set)[(unsigned char) (c) >> 6] |= 1ULL << ((unsigned char) (c) & 63))
+#define HAS_BIT(set, c) ((set)[(unsigned char) (c) >> 6] >> ((unsigned char) (c) & 63) & 1)
+
+int glob_cache = 1;
+
+typedef struct {
+    // Number of tokens (a character, ?, [...] or *), and 64-bit words in a set of states
+    // (bit i: the first i tokens are matched, so bit len means the whole pattern is).
+    int len, words;
+    // For each byte, the tokens other than stars that match it ([256][words]).
+    uint64_t *match;
+    // The star tokens, which match any number of bytes.
+    uint64_t *stars;
+    // Two sets of states, for the current byte and the next one.
+    uint64_t *states;
+    // Whether the pattern starts with a literal dot (only such a pattern matches hidden names).
+    int dot;
+    // Whether the pattern has a wildcard, otherwise it is the plain name.
+    int wild;
+    char *name;
+} matcher_t;
+
+typedef struct {
+    // Offset of the name in the names of the listing.
+    size_t name;
+    // Type of the file (DT_DIR, DT_LNK, DT_UNKNOWN, ...).
+    unsigned char type;
+} dir_entry_t;
+
+typedef struct {
+    // Key of the directory: the listing is stale once its mtime changes.
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    // Entries sorted by name (without . and ..), and the buffer of their names.
+    dir_entry_t *entries;
+    int count;
+    char *names;
+    // Number of expansions using the listing (it is not replaced meanwhile), and whether it is cached.
+    int users, cached;
+} listing_t;
+
+typedef struct {
+    arena_t *arena;
+    // Arguments produced so far.
+    char **args;
+    int argc, cap;
+    // Path of the current match (grown on demand).
+    char *path;
+    size_t path_cap;
+    // Components of the pattern being matched, and whether it ends with a slash (directories only).
+    matcher_t *comps;
+    int count, dir_only;
+} expansion_t;
+
+static listing_t *listing_cache[LISTING_CACHE_SIZE];
+static int cache_next = 0;
+static char *dents;
+
+static const struct {
+    const char *name;
+    int (*test)(int);
+} char_classes[] = {
+    {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+    {"lower", islower}, {"print", isprint}, {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+};
+#define NUM_CHAR_CLASSES (sizeof(char_classes) / sizeof(char_classes[0]))
+
+static char **push_word(expansion_t *e, char *word) {
+    if (e->argc == e->cap) e->args = arena_grow(e->arena, e->args, sizeof(char *), &e->cap);
+    e->args[e->argc++] = word;
+    return e->args;
+}
+
+// Copy a pattern without its escapes.
+static char *unescape(arena_t *arena, const char *p) {
+    char *word = arena_alloc(arena, strlen(p) + 1), *w = word;
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') p++;
+        *w++ = *p;
+    }
+    *w = '\0';
+    return word;
+}
+
+// Read a character of a pattern, which may be escaped.
+static const char *pattern_char(const char *p, unsigned char *c) {
+    if (*p == '\\' && p[1] != '\0') p++;
+    *c = *p;
+    return p + 1;
+}
+
+/*
+ * Function: parse_class
+ * ---------------------
+ *   Parse a bracket expression ([abc], [a-z], [!a], [[:digit:]]) into the set of bytes it matches.
+ *
+ *   p: the opening bracket
+ *   set: the set (256 bits)
+ *
+ *   returns: the end of the expression, or NULL if it is not closed (the bracket is then literal)
+ */
+static const char *parse_class(const char *p, uint64_t set[4]) {
+    memset(set, 0, 4 * sizeof(uint64_t));
+    p++;
+    int negate = *p == '!' || *p == '^';
+    if (negate) p++;
+    // A closing bracket right after the opening one is literal.
+    for (int first = 1; *p != ']' || first; first = 0) {
+        if (*p == '\0') return NULL;
+        if (p[0] == '[' && p[1] == ':') {
+            const char *end = strstr(p + 2, ":]");
+            size_t k = 0;
+            while (end != NULL && k < NUM_CHAR_CLASSES &&
+                   (strlen(char_classes[k].name) != (size_t) (end - p - 2) || strncmp(char_classes[k].name, p + 2, end - p - 2) != 0)) k++;
+            if (end != NULL && k < NUM_CHAR_CLASSES) {
+                for (int c = 1; c < 256; c++) if (char_classes[k].test(c)) SET_BIT(set, c);
+                p = end + 2;
+                continue;
+            }
+        }
+        unsigned char lo, hi;
+        p = pattern_char(p, &lo);
+        hi = lo;
+        if (p[0] == '-' && p[1] != ']' && p[1] != '\0') p = pattern_char(p + 1, &hi);
+        for (int c = lo; c <= hi; c++) SET_BIT(set, c);
+    }
+    if (negate) for (int i = 0; i < 4; i++) set[i] = ~set[i];
+    return p + 1;
+}
+
+/*
+ * Function: compile_pattern
+ * -------------------------
+ *   Compile a pattern component into a bit-parallel NFA: the set of states reached after each
+ *   byte of a name is computed from the previous one with a few shifts and masks, so a name is
+ *   matched in one pass without backtracking, whatever the stars.
+ *
+ *   arena: the arena for the tables
+ *   p: the pattern component
+ *   m: the compiled pattern
+ */
+static void compile_pattern(arena_t *arena, const char *p, matcher_t *m) {
+    size_t n = strlen(p);
+    // Bytes matched by each token (at most one token per character of the pattern).
+    uint64_t (*sets)[4] = arena_alloc(arena, (n + 1) * sizeof(*sets));
+    char *star = arena_alloc(arena, n + 1);
+    int len = 0;
+    m->wild = 0;
+    m->dot = p[0] == '.' || (p[0] == '\\' && p[1] == '.');
+    m->name = unescape(arena, p);
+    while (*p != '\0') {
+        if (*p == '*') {
+            // Consecutive stars are one star (a star is never followed by another one).
+            if (len == 0 || !star[len - 1]) star[len++] = 1;
+            m->wild = 1;
+            p++;
+            continue;
+        }
+        star[len] = 0;
+        const char *end;
+        if (*p == '?') {
+            memset(sets[len], 0xff, sizeof(sets[len]));
+            end = p + 1;
+            m->wild = 1;
+        }
+        else if (*p == '[' && (end = parse_class(p, sets[len])) != NULL) m->wild = 1;
+        else {
+            unsigned char c;
+            end = pattern_char(p, &c);
+            memset(sets[len], 0, sizeof(sets[len]));
+            SET_BIT(sets[len], c);
+        }
+        p = end;
+        len++;
+    }
+    m->len = len;
+    m->words = len / 64 + 1;
+    m->match = arena_alloc(arena, 256 * m->words * sizeof(uint64_t));
+    m->stars = arena_alloc(arena, m->words * sizeof(uint64_t));
+    m->states = arena_alloc(arena, 2 * m->words * sizeof(uint64_t));
+    memset(m->match, 0, 256 * m->words * sizeof(uint64_t));
+    memset(m->stars, 0, m->words * sizeof(uint64_t));
+    for (int i = 0; i < len; i++) {
+        uint64_t bit = 1ULL << (i % 64);
+        if (star[i]) m->stars[i / 64] |= bit;
+        else for (int c = 0; c < 256; c++) if (HAS_BIT(sets[i], c)) m->match[c * m->words + i / 64] |= bit;
+    }
+}
+
+// Add the states after the stars of a set, since a star can match nothing.
+static void skip_stars(const matcher_t *m, uint64_t *states) {
+    uint64_t carry = 0;
+    for (int w = 0; w < m->words; w++) {
+        uint64_t stars = states[w] & m->stars[w];
+        states[w] |= stars << 1 | carry;
+        carry = stars >> 63;
+    }
+}
+
+static int match_name(const matcher_t *m, const char *name) {
+    if (name[0] == '.' && !m->dot) return 0;
+    uint64_t *cur = m->states, *next = m->states + m->words;
+    memset(cur, 0, m->words * sizeof(uint64_t));
+    cur[0] = 1;
+    skip_stars(m, cur);
+    for (const unsigned char *s = (const unsigned char *) name; *s != '\0'; s++) {
+        const uint64_t *match = m->match + *s * m->words;
+        uint64_t carry = 0, alive = 0;
+        for (int w = 0; w < m->words; w++) {
+            // A token that matches the byte moves to the next state, a star stays where it is.
+            uint64_t matched = cur[w] & match[w];
+            next[w] = matched << 1 | carry | (cur[w] & m->stars[w]);
+            carry = matched >> 63;
+            alive |= next[w];
+        }
+        if (!alive) return 0;
+        skip_stars(m, next);
+        uint64_t *tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+    return cur[m->len / 64] >> (m->len % 64) & 1;
+}
+
+static int compare_entries(const void *a, const void *b, void *names) {
+    return strcmp((char *) names + ((const dir_entry_t *) a)->name, (char *) names + ((const dir_entry_t *) b)->name);
+}
+
+static void free_listing(listing_t *listing) {
+    free(listing->entries);
+    free(listing->names);
+    free(listing);
+}
+
+// Keep a listing in the cache, in place of the oldest one that is not in use.
+static void cache_listing(listing_t *listing) {
+    for (int i = 0; i < LISTING_CACHE_SIZE; i++) {
+        int k = (cache_next + i) % LISTING_CACHE_SIZE;
+        listing_t *old = listing_cache[k];
+        if (old != NULL && old->users > 0) continue;
+        if (old != NULL) free_listing(old);
+        listing_cache[k] = listing;
+        listing->cached = 1;
+        cache_next = (k + 1) % LISTING_CACHE_SIZE;
+        return;
+    }
+}
+
+/*
+ * Function: open_listing
+ * ----------------------
+ *   Get the sorted entries of a directory, from the cache if its inode and mtime have not changed,
+ *   otherwise by reading it with getdents64 in large batches.
+ *
+ *   path: the path of the directory
+ *
+ *   returns: the listing (to be released with release_listing), or NULL if it cannot be read
+ */
+static listing_t *open_listing(const char *path) {
+    struct stat st;
+    if (glob_cache && stat(path, &st) == 0) {
+        for (int i = 0; i < LISTING_CACHE_SIZE; i++) {
+            listing_t *listing = listing_cache[i];
+            if (listing != NULL && listing->dev == st.st_dev && listing->ino == st.st_ino &&
+                listing->mtime.tv_sec == st.st_mtim.tv_sec && listing->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                listing->users++;
+                return listing;
+            }
+        }
+    }
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    // The time is taken with the clock that stamps files, before the directory is read.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    fstat(fd, &st);
+    if (dents == NULL) dents = malloc(DENTS_BATCH);
+    listing_t *listing = calloc(1, sizeof(listing_t));
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->users = 1;
+    size_t names_len = 0, names_cap = 0;
+    int cap = 0;
+    ssize_t n;
+    while ((n = getdents64(fd, dents, DENTS_BATCH)) > 0) {
+        for (ssize_t off = 0; off < n;) {
+            struct dirent64 *d = (struct dirent64 *) (dents + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            size_t len = strlen(name) + 1;
+            if (names_len + len > names_cap) {
+                names_cap = names_cap ? names_cap * 2 : 4096;
+                while (names_len + len > names_cap) names_cap *= 2;
+                listing->names = realloc(listing->names, names_cap);
+            }
+            if (listing->count == cap) {
+                cap = cap ? cap * 2 : 64;
+                listing->entries = realloc(listing->entries, cap * sizeof(dir_entry_t));
+            }
+            memcpy(listing->names + names_len, name, len);
+            listing->entries[listing->count].name = names_len;
+            listing->entries[listing->count++].type = d->d_type;
+            names_len += len;
+        }
+    }
+    close(fd);
+    if (n == -1) {
+        free_listing(listing);
+        return NULL;
+    }
+    qsort_r(listing->entries, listing->count, sizeof(dir_entry_t), compare_entries, listing->names);
+    // A directory changed in the same tick as it was read could change again without a new mtime.
+    if (glob_cache && st.st_mtim.tv_sec < now.tv_sec) cache_listing(listing);
+    return listing;
+}
+
+static void release_listing(listing_t *listing) {
+    if (--listing->users == 0 && !listing->cached) free_listing(listing);
+}
+
+// Append a name to the path of the current match, returns the new length.
+static size_t append_path(expansion_t *e, size_t len, const char *name) {
+    size_t n = strlen(name);
+    if (len + n + 3 > e->path_cap) {
+        e->path_cap = e->path_cap * 2 > len + n + 3 ? e->path_cap * 2 : len + n + 3;
+        e->path = realloc(e->path, e->path_cap);
+    }
+    if (len > 0 && e->path[len - 1] != '/') e->path[len++] = '/';
+    memcpy(e->path + len, name, n + 1);
+    return len + n;
+}
+
+static void push_match(expansion_t *e, size_t len) {
+    // A pattern ending with a slash matches directories, with the slash.
+    if (e->dir_only) e->path[len++] = '/';
+    char *word = arena_alloc(e->arena, len + 1);
+    memcpy(word, e->path, len);
+    word[len] = '\0';
+    push_word(e, word);
+}
+
+static int is_dir(const char *path, unsigned char type) {
+    struct stat st;
+    if (type == DT_DIR) return 1;
+    // Symbolic links are followed, and some file systems do not give the type.
+    return (type == DT_LNK || type == DT_UNKNOWN) && stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Match the components of the pattern from the ith one, under the path of the current match.
+static void glob_components(expansion_t *e, size_t len, int i) {
+    matcher_t *m = &e->comps[i];
+    int last = i == e->count - 1;
+    if (!m->wild) {
+        size_t n = append_path(e, len, m->name);
+        struct stat st;
+        if (!last) glob_components(e, n, i + 1);
+        else if (e->dir_only ? stat(e->path, &st) == 0 && S_ISDIR(st.st_mode) : lstat(e->path, &st) == 0) push_match(e, n);
+        return;
+    }
+    append_path(e, len, "");
+    listing_t *listing = open_listing(len > 0 ? e->path : ".");
+    if (listing == NULL) return;
+    for (int k = 0; k < listing->count; k++) {
+        const char *name = listing->names + listing->entries[k].name;
+        if (!match_name(m, name)) continue;
+        size_t n = append_path(e, len, name);
+        if ((!last || e->dir_only) && !is_dir(e->path, listing->entries[k].type)) continue;
+        if (last) push_match(e, n);
+        else glob_components(e, n, i + 1);
+    }
+    release_listing(listing);
+}
+
+static int compare_words(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Replace a word by the paths it matches, or keep it if there is none.
+static void glob_word(expansion_t *e, const char *word) {
+    char *copy = arena_alloc(e->arena, strlen(word) + 1);
+    strcpy(copy, word);
+    int cap = 0, wild = 0, deep = 0;
+    e->comps = NULL;
+    e->count = 0;
+    e->dir_only = 0;
+    for (char *comp = copy, *next; comp != NULL; comp = next) {
+        next = strchr(comp, '/');
+        if (next != NULL) *next++ = '\0';
+        if (*comp == '\0') {
+            e->dir_only = next == NULL && e->count > 0;
+            continue;
+        }
+        if (e->count == cap) e->comps = arena_grow(e->arena, e->comps, sizeof(matcher_t), &cap);
+        compile_pattern(e->arena, comp, &e->comps[e->count]);
+        // The matches of a wildcard before the last component come from several directories.
+        deep |= wild;
+        wild |= e->comps[e->count++].wild;
+    }
+    if (!wild) {
+        push_word(e, unescape(e->arena, word));
+        return;
+    }
+    int first = e->argc;
+    size_t len = 0;
+    if (word[0] == '/') len = append_path(e, 0, "/");
+    glob_components(e, len, 0);
+    if (e->argc == first) push_word(e, unescape(e->arena, word));
+    // The listings are sorted, so only matches across directories need sorting.
+    else if (deep) qsort(e->args + first, e->argc - first, sizeof(char *), compare_words);
+}
+
+static char *join_word(arena_t *arena, const char *a, size_t a_len, const char *b, size_t b_len, const char *c) {
+    size_t c_len = strlen(c);
+    char *word = arena_alloc(arena, a_len + b_len + c_len + 1);
+    memcpy(word, a, a_len);
+    memcpy(word + a_len, b, b_len);
+    memcpy(word + a_len + b_len, c, c_len + 1);
+    return word;
+}
+
+// Find the closing brace of a brace expression, and whether it has a comma at its top level.
+static const char *brace_end(const char *p, int *comma) {
+    int depth = 0;
+    *comma = 0;
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') p++;
+        else if (*p == '{') depth++;
+        else if (*p == '}' && --depth == 0) return p;
+        else if (*p == ',' && depth == 1) *comma = 1;
+    }
+    return NULL;
+}
+
+// Parse a bound of a sequence expression: an integer (with its zero padding) or a single character.
+static int parse_bound(const char *p, size_t n, long *value, int *width, int *is_char) {
+    char buf[24];
+    if (n == 1 && !isdigit((unsigned char) *p) && *p != '\\') {
+        *value = (unsigned char) *p;
+        *is_char = 1;
+        return 1;
+    }
+    if (n == 0 || n >= sizeof(buf)) return 0;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    char *end;
+    *value = strtol(buf, &end, 10);
+    *is_char = 0;
+    int sign = buf[0] == '-';
+    *width = buf[sign] == '0' && n > (size_t) sign + 1 ? n : 0;
+    return *end == '\0' && isdigit((unsigned char) buf[sign]);
+}
+
+// Parse a sequence expression ({1..10}, {05..1}, {a..e}) between braces.
+static int parse_sequence(const char *open, const char *close, long *from, long *to, int *width) {
+    const char *dots = strstr(open + 1, "..");
+    if (dots == NULL || dots >= close) return 0;
+    int from_width = 0, to_width = 0, from_char, to_char;
+    if (!parse_bound(open + 1, dots - open - 1, from, &from_width, &from_char) ||
+        !parse_bound(dots + 2, close - dots - 2, to, &to_width, &to_char) || from_char != to_char) return 0;
+    // Characters are not padded.
+    *width = from_char ? -1 : from_width > to_width ? from_width : to_width;
+    return 1;
+}
+
+/*
+ * Function: expand_braces
+ * -----------------------
+ *   Expand the first brace expression of a word after an offset, and the rest in each result.
+ *   A brace without a comma or a sequence is literal, like {} or {a}.
+ *
+ *   e: the expansion
+ *   word: the word
+ *   from: the offset (the braces before it are literal)
+ */
+static void expand_braces(expansion_t *e, const char *word, size_t from) {
+    const char *open = NULL, *close = NULL;
+    long seq_from = 0, seq_to = 0;
+    int comma = 0, width = 0;
+    for (const char *p = word + from; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') p++;
+        else if (*p == '{' && (close = brace_end(p, &comma)) != NULL &&
+                 (comma || parse_sequence(p, close, &seq_from, &seq_to, &width))) {
+            open = p;
+            break;
+        }
+    }
+    if (open == NULL) {
+        glob_word(e, word);
+        return;
+    }
+    size_t prefix = open - word;
+    if (!comma) {
+        char value[24];
+        for (long v = seq_from, step = seq_from <= seq_to ? 1 : -1;; v += step) {
+            int n = width < 0 ? snprintf(value, sizeof(value), "%c", (int) v) : snprintf(value, sizeof(value), "%0*ld", width, v);
+            expand_braces(e, join_word(e->arena, word, prefix, value, n, close + 1), prefix + n);
+            if (v == seq_to) break;
+        }
+        return;
+    }
+    // Split the alternatives at the commas of the top level (nested braces are expanded in each result).
+    int depth = 0;
+    for (const char *p = open + 1, *alt = open + 1; p <= close; p++) {
+        if (*p == '\\') p++;
+        else if (*p == '{') depth++;
+        else if (*p == '}' && p != close) depth--;
+        else if ((*p == ',' && depth == 0) || p == close) {
+            expand_braces(e, join_word(e->arena, word, prefix, alt, p - alt, close + 1), prefix);
+            alt = p + 1;
+        }
+    }
+}
+
+char **expand_word(arena_t *arena, const char *pattern, char **args, int *argc, int *cap) {
+    expansion_t e = {.arena = arena, .args = args, .argc = *argc, .cap = *cap};
+    expand_braces(&e, pattern, 0);
+    free(e.path);
+    *argc = e.argc;
+    *cap = e.cap;
+    return e.args;
+}
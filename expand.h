@@ -0,0 +1,36 @@
+#include "arena.h"
+
+#ifndef EXPAND_H
+#define EXPAND_H
+
+// Unquoted characters that make parse_args expand an argument.
+#define EXPAND_CHARS "*?[{"
+// Characters escaped with a backslash in a pattern when they were quoted.
+#define PATTERN_CHARS "\\*?[]{},!^-"
+
+// Number of directory listings kept between expansions.
+#define LISTING_CACHE_SIZE 32
+
+// Whether directory listings are kept (keyed by inode and mtime) for the next expansions (set with "set glob_cache on").
+extern int glob_cache;
+
+/*
+ * Function: expand_word
+ * ---------------------
+ *   Expand the braces ({a,b}, {1..5}, {a..e}) and then the wildcards (*, ?, [...]) of an argument,
+ *   and append the resulting arguments to an argument array.
+ *
+ *   The matching file names of each brace word are sorted (byte order), and hidden names only
+ *   match a leading literal dot. A word that matches nothing is kept as is (without its escapes).
+ *
+ *   arena: the arena of the arguments
+ *   pattern: the argument, with its quoted characters in PATTERN_CHARS escaped with a backslash
+ *   args: the argument array (allocated from the arena, or NULL)
+ *   argc: the number of arguments, updated
+ *   cap: the capacity of the array, updated
+ *
+ *   returns: the argument array (it moves when it grows)
+ */
+char **expand_word(arena_t *arena, const char *pattern, char **args, int *argc, int *cap);
+
+#endif
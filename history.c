@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+
+#define HISTORY_MAGIC 0x54534948
+// Number of sorted entries per block with a precomputed latest entry.
+#define BLOCK_SIZE 64
+// Number of unsorted entries searched linearly before the prefix index is rebuilt (plus 1/8 of the sorted ones).
+#define RESORT_MIN 1024
+
+// Header of an entry in the history file, followed by the command line and NUL bytes
+// up to a multiple of 8 bytes. Only status and duration_ms change after the entry is written.
+typedef struct {
+    uint32_t magic;
+    uint32_t len;
+    int64_t time;
+    int32_t status;
+    uint32_t duration_ms;
+} record_t;
+
+long history_current = -1;
+
+static int history_fd = -1;
+// Read-only shared mapping of the file, grown when entries are appended.
+static char *map = NULL;
+static size_t map_size = 0;
+// File offsets and trigram signatures of the entries found up to indexed_end.
+static long *offsets = NULL;
+static uint64_t *signatures = NULL;
+static int count = 0, cap = 0;
+static size_t indexed_end = 0;
+// Entries [0, sorted_count) sorted by text (then by number), and the latest entry of each block of them.
+static int *sorted = NULL, *block_latest = NULL;
+static int sorted_count = 0;
+// Result of expand_history.
+static char *expand_buf = NULL;
+static size_t expand_cap = 0;
+
+static size_t record_size(size_t len) {
+    return (sizeof(record_t) + len + 1 + 7) & ~(size_t) 7;
+}
+
+static const char *entry_text(int n) {
+    return map + offsets[n] + sizeof(record_t);
+}
+
+static uint64_t trigram_signature(const char *s, size_t len) {
+    uint64_t sig = 0;
+    for (size_t i = 0; i + 2 < len; i++) {
+        unsigned int t = (unsigned char) s[i] << 16 | (unsigned char) s[i + 1] << 8 | (unsigned char) s[i + 2];
+        // Fibonacci hashing of the trigram to one of the 64 bits.
+        sig |= 1ull << ((t * 2654435769u) >> 26);
+    }
+    return sig;
+}
+
+int init_history(void) {
+    char buf[4096];
+    const char *path = getenv("HISTFILE");
+    if (path == NULL) {
+        const char *home = getenv("HOME");
+        if (home == NULL) return -1;
+        snprintf(buf, sizeof(buf), "%s/.shell_history", home);
+        path = buf;
+    }
+    // An empty HISTFILE turns the history off.
+    if (*path == '\0') return -1;
+    history_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+// Whether a complete entry starts at an offset of the mapped file.
+static int valid_record(size_t pos, size_t size) {
+    const record_t *rec = (const record_t *) (map + pos);
+    return rec->magic == HISTORY_MAGIC && pos + record_size(rec->len) <= size && map[pos + sizeof(record_t) + rec->len] == '\0';
+}
+
+// Map and index the entries appended since the last call, by this shell or another one.
+static void sync_history(void) {
+    struct stat st;
+    if (history_fd == -1 || fstat(history_fd, &st) == -1 || st.st_size <= indexed_end) return;
+    // Entries are appended under an exclusive lock, so none is half written while this one is held.
+    flock(history_fd, LOCK_SH);
+    if (fstat(history_fd, &st) == -1) {
+        flock(history_fd, LOCK_UN);
+        return;
+    }
+    size_t size = st.st_size;
+    if (size > map_size) {
+        void *p = map == NULL ? mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0)
+                              : mremap(map, map_size, size, MREMAP_MAYMOVE);
+        if (p == MAP_FAILED) {
+            flock(history_fd, LOCK_UN);
+            return;
+        }
+        map = p;
+        map_size = size;
+    }
+    size_t pos = indexed_end;
+    while (pos + sizeof(record_t) <= size) {
+        const record_t *rec = (const record_t *) (map + pos);
+        if (!valid_record(pos, size)) {
+            // The entry may still be written by a shell that does not lock the file: only skip data
+            // that is followed by a complete entry, otherwise try again from here at the next call.
+            size_t next = pos + 8;
+            while (next + sizeof(record_t) <= size && !valid_record(next, size)) next += 8;
+            if (next + sizeof(record_t) > size) break;
+            pos = next;
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 1024;
+            offsets = realloc(offsets, sizeof(long) * cap);
+            signatures = realloc(signatures, sizeof(uint64_t) * cap);
+        }
+        offsets[count] = pos;
+        signatures[count] = trigram_signature(map + pos + sizeof(record_t), rec->len);
+        count++;
+        pos += record_size(rec->len);
+    }
+    indexed_end = pos;
+    flock(history_fd, LOCK_UN);
+}
+
+long add_history(const char *line) {
+    if (history_fd == -1) return -1;
+    size_t len = strlen(line), size = record_size(len);
+    char *buf = calloc(1, size);
+    record_t *rec = (record_t *) buf;
+    rec->magic = HISTORY_MAGIC;
+    rec->len = len;
+    rec->time = time(NULL);
+    rec->status = HISTORY_PENDING;
+    memcpy(buf + sizeof(record_t), line, len);
+    // The lock keeps the entries of concurrent shells from overlapping.
+    long offset = -1;
+    struct stat st;
+    flock(history_fd, LOCK_EX);
+    if (fstat(history_fd, &st) == 0) {
+        long end = (st.st_size + 7) & ~7L;
+        if (pwrite(history_fd, buf, size, end) == size) offset = end;
+    }
+    flock(history_fd, LOCK_UN);
+    free(buf);
+    return offset;
+}
+
+void set_history_result(long entry, int status, double seconds) {
+    if (entry == -1 || history_fd == -1) return;
+    struct {
+        int32_t status;
+        uint32_t duration_ms;
+    } result = {status, seconds * 1000};
+    pwrite(history_fd, &result, sizeof(result), entry + offsetof(record_t, status));
+}
+
+int history_size(void) {
+    sync_history();
+    return count;
+}
+
+int get_history(int n, history_entry_t *entry) {
+    sync_history();
+    if (n < 0 || n >= count) return -1;
+    const record_t *rec = (const record_t *) (map + offsets[n]);
+    entry->text = entry_text(n);
+    entry->time = rec->time;
+    entry->status = rec->status;
+    entry->duration = rec->duration_ms / 1000.0;
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    int c = strcmp(entry_text(x), entry_text(y));
+    return c ? c : x - y;
+}
+
+static void sort_history(void) {
+    sorted = realloc(sorted, sizeof(int) * count);
+    for (int i = 0; i < count; i++) sorted[i] = i;
+    qsort(sorted, count, sizeof(int), compare_entries);
+    sorted_count = count;
+    int num_blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    block_latest = realloc(block_latest, sizeof(int) * num_blocks);
+    for (int b = 0; b < num_blocks; b++) {
+        block_latest[b] = -1;
+        for (int i = b * BLOCK_SIZE; i < count && i < (b + 1) * BLOCK_SIZE; i++)
+            if (sorted[i] > block_latest[b]) block_latest[b] = sorted[i];
+    }
+}
+
+int find_history_prefix(const char *prefix) {
+    sync_history();
+    if (count - sorted_count > sorted_count / 8 + RESORT_MIN) sort_history();
+    size_t len = strlen(prefix);
+    // The entries that are not sorted yet are the latest ones.
+    for (int n = count - 1; n >= sorted_count; n--)
+        if (strncmp(entry_text(n), prefix, len) == 0) return n;
+    // The entries starting with the prefix are the range [lo, hi) of the sorted ones.
+    int lo = 0, hi = sorted_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(entry_text(sorted[mid]), prefix, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    hi = sorted_count;
+    for (int l = lo; l < hi;) {
+        int mid = l + (hi - l) / 2;
+        if (strncmp(entry_text(sorted[mid]), prefix, len) <= 0) l = mid + 1;
+        else hi = mid;
+    }
+    // Take the latest entry of the range, a whole block at a time where possible.
+    int latest = -1;
+    for (int i = lo; i < hi;) {
+        if (i % BLOCK_SIZE == 0 && i + BLOCK_SIZE <= hi) {
+            if (block_latest[i / BLOCK_SIZE] > latest) latest = block_latest[i / BLOCK_SIZE];
+            i += BLOCK_SIZE;
+        }
+        else {
+            if (sorted[i] > latest) latest = sorted[i];
+            i++;
+        }
+    }
+    return latest;
+}
+
+int search_history(const char *text, int before) {
+    sync_history();
+    uint64_t sig = trigram_signature(text, strlen(text));
+    if (before > count) before = count;
+    for (int n = before - 1; n >= 0; n--)
+        if ((signatures[n] & sig) == sig && strstr(entry_text(n), text) != NULL) return n;
+    return -1;
+}
+
+static void append_expanded(size_t *len, const char *s, size_t n) {
+    if (*len + n + 1 > expand_cap) {
+        expand_cap = expand_cap ? expand_cap : 256;
+        while (*len + n + 1 > expand_cap) expand_cap *= 2;
+        expand_buf = realloc(expand_buf, expand_cap);
+    }
+    memcpy(expand_buf + *len, s, n);
+    *len += n;
+    expand_buf[*len] = '\0';
+}
+
+static int is_word_end(char c) {
+    return c == '\0' || c == ' ' || c == '\t' || c == '\n' || c == '&' || c == '|';
+}
+
+int expand_history(const char *line, char **expanded) {
+    // Most lines have no reference, so they do not need the index.
+    if (strchr(line, '!') == NULL) return 0;
+    size_t len = 0;
+    int found = 0;
+    char quote = '\0';
+    append_expanded(&len, "", 0);
+    for (const char *p = line; *p != '\0';) {
+        const char *start = p;
+        if (quote) {
+            if (*p == quote) quote = '\0';
+        }
+        else if (*p == '"' || *p == '\'') quote = *p;
+        else if (*p == '\\' && p[1] != '\0') p++;
+        else if (*p == '!' && (p == line || is_word_end(p[-1])) && !is_word_end(p[1]) && p[1] != '=') {
+            const char *ref = p + 1, *end = ref;
+            int size = history_size(), n = -1;
+            if (*ref == '!') {
+                n = size - 1;
+                end = ref + 1;
+            }
+            else if ((*ref >= '0' && *ref <= '9') || (*ref == '-' && ref[1] >= '0' && ref[1] <= '9')) {
+                n = strtol(ref, (char **) &end, 10);
+                n = n < 0 ? size + n : n - 1;
+            }
+            else {
+                // The text of "!?text?" ends at the closing question mark, if any.
+                int search = *ref == '?';
+                ref += search;
+                end = ref;
+                while (!is_word_end(*end) && !(search && *end == '?')) end++;
+                char *text = strndup(ref, end - ref);
+                n = search ? search_history(text, size) : find_history_prefix(text);
+                free(text);
+                if (search && *end == '?') end++;
+            }
+            if (n < 0 || n >= size) {
+                printf("%.*s: event not found\n", (int) (end - p), p);
+                return -1;
+            }
+            append_expanded(&len, entry_text(n), strlen(entry_text(n)));
+            found = 1;
+            p = end;
+            continue;
+        }
+        // Quote characters and escapes are kept for the parser.
+        p++;
+        append_expanded(&len, start, p - start);
+    }
+    if (found) *expanded = expand_buf;
+    return found;
+}
@@ -0,0 +1,119 @@
+#include <time.h>
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// Status of an entry whose command has not finished (or whose shell exited first).
+#define HISTORY_PENDING -1
+
+typedef struct {
+    // Command line (valid until the next history call).
+    const char *text;
+    // When the command was entered.
+    time_t time;
+    // Wait status of the command (as for a job), or HISTORY_PENDING.
+    int status;
+    // Duration of the command, in seconds.
+    double duration;
+} history_entry_t;
+
+// History entry of the line being executed, until its last job takes it over (-1 for none).
+extern long history_current;
+
+/*
+ * Function: init_history
+ * ----------------------
+ *   Open the history file ($HISTFILE, or ~/.shell_history). The file is only read
+ *   (memory-mapped and indexed) when the history is first used, so the startup
+ *   time does not depend on its size.
+ *
+ *   returns: 0 on success, -1 if the shell runs without a history
+ */
+int init_history(void);
+
+/*
+ * Function: add_history
+ * ---------------------
+ *   Append a command line to the history file. The file is shared with the
+ *   other shells: appends are serialized with a file lock, entries are never moved.
+ *
+ *   line: the command line
+ *
+ *   returns: a handle on the entry for set_history_result, or -1 if it was not added
+ */
+long add_history(const char *line);
+
+/*
+ * Function: set_history_result
+ * ----------------------------
+ *   Record the status and duration of the command of an entry (in place in the file).
+ *
+ *   entry: the handle returned by add_history (-1 does nothing)
+ *   status: the wait status of the command
+ *   seconds: the duration of the command
+ */
+void set_history_result(long entry, int status, double seconds);
+
+/*
+ * Function: history_size
+ * ----------------------
+ *   returns: the number of entries, including those appended by other shells
+ */
+int history_size(void);
+
+/*
+ * Function: get_history
+ * ---------------------
+ *   Get an entry of the history.
+ *
+ *   n: the entry number, from 0 (the oldest) to history_size() - 1
+ *   entry: filled with the entry
+ *
+ *   returns: 0 on success, -1 if there is no such entry
+ */
+int get_history(int n, history_entry_t *entry);
+
+/*
+ * Function: find_history_prefix
+ * -----------------------------
+ *   Find the latest entry starting with a prefix, with a binary search in the entries
+ *   sorted by text (re-sorted lazily once enough entries were appended).
+ *
+ *   prefix: the prefix
+ *
+ *   returns: the entry number, or -1 if none matches
+ */
+int find_history_prefix(const char *prefix);
+
+/*
+ * Function: search_history
+ * ------------------------
+ *   Find the latest entry before a given one that contains a string. Entries are
+ *   first checked against a signature of their trigrams, so most are skipped without
+ *   looking at their text.
+ *
+ *   text: the string to search for
+ *   before: only entries with a smaller number are searched (history_size() for all)
+ *
+ *   returns: the entry number, or -1 if none matches
+ */
+int search_history(const char *text, int before);
+
+/*
+ * Function: expand_history
+ * ------------------------
+ *   Expand the history references of a command line: "!!" (the last entry), "!n"
+ *   (entry n), "!-n" (the n-th last entry), "!?text" (the latest entry containing text)
+ *   and "!prefix" (the latest entry starting with prefix); entries are numbered from 1
+ *   as by the history built-in. A reference starts a word, and is not expanded
+ *   in quotes or after a backslash.
+ *
+ *   line: the command line
+ *   expanded: set to the expanded line (valid until the next call) if there was a reference
+ *
+ *   returns: 1 if the line was expanded, 0 if it had no reference, -1 (with a message
+ *            printed) if a reference matched no entry
+ */
+int expand_history(const char *line, char **expanded);
+
+#endif
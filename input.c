@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "input.h"
+#include "line_edit.h"
+
+reader_t *stdin_reader = NULL;
+
+static void readable_callback(int fd, unsigned int events, void *data) {
+    reader_t *reader = data;
+    reader->ready = 1;
+}
+
+void init_reader(reader_t *reader, int fd) {
+    reader->fd = fd;
+    reader->cap = READ_CHUNK;
+    reader->buf = malloc(reader->cap);
+    reader->start = reader->end = 0;
+    reader->eof = 0;
+    reader->ready = 0;
+    reader->prompt = NULL;
+    reader->edit = 0;
+    if (fd == STDIN_FILENO) stdin_reader = reader;
+    // Regular files cannot be watched by epoll, but they are always readable.
+    reader->pollable = event_add(fd, 0, readable_callback, reader) == 0;
+}
+
+// Read more input into the buffer, returns the number of bytes read.
+static ssize_t fill(reader_t *reader) {
+    // Move the unread data to the front, and grow the buffer if it is full of a single line.
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    if (reader->cap - reader->end < READ_CHUNK) {
+        reader->cap *= 2;
+        reader->buf = realloc(reader->buf, reader->cap);
+    }
+    if (reader->pollable) {
+        // Keep the event loop running until there is input.
+        event_mod(reader->fd, EPOLLIN);
+        while (!reader->ready) event_run(-1);
+        event_mod(reader->fd, 0);
+        reader->ready = 0;
+    }
+    else event_run(0);
+    ssize_t n;
+    do n = read(reader->fd, reader->buf + reader->end, reader->cap - reader->end - 1);
+    while (n == -1 && errno == EINTR);
+    if (n <= 0) reader->eof = 1;
+    else reader->end += n;
+    return n;
+}
+
+int read_byte(reader_t *reader) {
+    if (reader->start == reader->end) {
+        if (reader->eof) return -1;
+        fill(reader);
+        if (reader->start == reader->end) return -1;
+    }
+    return (unsigned char) reader->buf[reader->start++];
+}
+
+char *read_line(reader_t *reader) {
+    if (reader->edit) return edit_line(reader);
+    size_t scanned = reader->start;
+    while (1) {
+        char *nl = memchr(reader->buf + scanned, '\n', reader->end - scanned);
+        if (nl != NULL) {
+            // Count the backslashes before the newline; an odd number means the line continues.
+            char *p = nl;
+            while (p > reader->buf + reader->start && p[-1] == '\\') p--;
+            if ((nl - p) % 2 == 1) {
+                // Drop the backslash and the newline by moving the (usually short) beginning of the line forward.
+                size_t len = nl - 1 - (reader->buf + reader->start);
+                memmove(reader->buf + reader->start + 2, reader->buf + reader->start, len);
+                reader->start += 2;
+                scanned = nl + 1 - reader->buf;
+                continue;
+            }
+            char *line = reader->buf + reader->start;
+            *nl = '\0';
+            reader->start = nl + 1 - reader->buf;
+            return line;
+        }
+        if (reader->eof) break;
+        // Only the newly read data has to be searched for a newline.
+        scanned = reader->end - reader->start;
+        if (reader->prompt != NULL && scanned > 0) {
+            printf("%s", reader->prompt);
+            fflush(stdout);
+        }
+        fill(reader);
+        // fill() moved the unread data to the front.
+        if (reader->eof) break;
+    }
+    if (reader->start == reader->end) return NULL;
+    // Return the last line even if it has no newline.
+    char *line = reader->buf + reader->start;
+    reader->buf[reader->end] = '\0';
+    reader->start = reader->end;
+    return line;
+}
+
+void free_reader(reader_t *reader) {
+    if (stdin_reader == reader) stdin_reader = NULL;
+    if (reader->pollable) event_del(reader->fd);
+    free(reader->buf);
+    reader->buf = NULL;
+}
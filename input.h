@@ -0,0 +1,75 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+// Minimum free space for each read; lines longer than the buffer make it grow.
+#define READ_CHUNK 65536
+
+typedef struct {
+    // File descriptor to read from.
+    int fd;
+    // Buffered input; the unread data is buf[start, end).
+    char *buf;
+    size_t start, end, cap;
+    // Whether the end of the input was reached.
+    int eof;
+    // Whether the file descriptor can be watched by the event loop (not a regular file).
+    int pollable;
+    // Set by the event loop when the file descriptor is readable.
+    int ready;
+    // Printed before reading the continuation of a line (NULL for none), and redrawn by the line editor.
+    const char *prompt;
+    // Whether lines are read with the line editor (the file descriptor is a terminal).
+    int edit;
+} reader_t;
+
+// The reader of stdin, if the shell has one (e.g. for built-in commands that read stdin).
+extern reader_t *stdin_reader;
+
+/*
+ * Function: init_reader
+ * ---------------------
+ *   Initialize a line reader on a file descriptor.
+ *
+ *   reader: the reader
+ *   fd: the file descriptor
+ */
+void init_reader(reader_t *reader, int fd);
+
+/*
+ * Function: read_line
+ * -------------------
+ *   Read the next line of input, without the trailing newline.
+ *   There is no limit on the length of a line. A line ending with an unescaped
+ *   backslash continues on the next line (the backslash and newline are removed).
+ *   If the reader has edit set, the line is read with the line editor (see edit_line).
+ *   While waiting for input, the event loop keeps running (e.g. to reap children).
+ *
+ *   reader: the reader
+ *
+ *   returns: the line (valid until the next call), or NULL at the end of the input
+ */
+char *read_line(reader_t *reader);
+
+/*
+ * Function: read_byte
+ * -------------------
+ *   Read the next byte of input (keeping the event loop running while waiting for it).
+ *
+ *   reader: the reader
+ *
+ *   returns: the byte, or -1 at the end of the input
+ */
+int read_byte(reader_t *reader);
+
+/*
+ * Function: free_reader
+ * ---------------------
+ *   Free the buffer of a reader (the file descriptor is not closed).
+ *
+ *   reader: the reader
+ */
+void free_reader(reader_t *reader);
+
+#endif
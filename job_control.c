@@ -2,132 +2,465 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
 #include <sys/wait.h>
+#include "affinity.h"
+#include "capture.h"
+#include "event_loop.h"
+#include "history.h"
 #include "job_control.h"
+#include "stats.h"
+#include "watchdog.h"
 
-const char *job_state_str[2] = {"Running", "Stopped"};
-static int job_id = 1;
+const char *job_state_str[4] = {"Running", "Running", "Stopped", "Queued"};
+int has_terminal = 0;
+int job_control = 1;
+
+static unsigned int hash_pid(pid_t pid, int cap) {
+    // Fibonacci hashing spreads consecutive process IDs over the table.
+    return ((unsigned int) pid * 2654435769u) & (cap - 1);
+}
+
+static void insert_pid(job_list_t *job_list, pid_t pid, job_t *job) {
+    unsigned int i = hash_pid(pid, job_list->pid_cap);
+    while (job_list->pids[i].job != NULL) i = (i + 1) & (job_list->pid_cap - 1);
+    job_list->pids[i].pid = pid;
+    job_list->pids[i].job = job;
+    job_list->pid_count++;
+}
+
+static void grow_pids(job_list_t *job_list) {
+    pid_entry_t *old = job_list->pids;
+    int old_cap = job_list->pid_cap;
+    job_list->pid_cap = old_cap ? old_cap * 2 : 64;
+    job_list->pids = calloc(job_list->pid_cap, sizeof(pid_entry_t));
+    job_list->pid_count = 0;
+    for (int i = 0; i < old_cap; i++)
+        if (old[i].job != NULL) insert_pid(job_list, old[i].pid, old[i].job);
+    free(old);
+}
+
+static void add_pid(job_list_t *job_list, pid_t pid, job_t *job) {
+    // Keep the load factor of the process ID table below 1/2.
+    if ((job_list->pid_count + 1) * 2 > job_list->pid_cap) grow_pids(job_list);
+    insert_pid(job_list, pid, job);
+}
+
+static void remove_pid(job_list_t *job_list, pid_t pid) {
+    int cap = job_list->pid_cap;
+    unsigned int i = hash_pid(pid, cap);
+    while (job_list->pids[i].job != NULL && job_list->pids[i].pid != pid) i = (i + 1) & (cap - 1);
+    if (job_list->pids[i].job == NULL) return;
+    job_list->pids[i].job = NULL;
+    job_list->pid_count--;
+    // Shift the following entries of the cluster back so lookups never need tombstones.
+    unsigned int j = i;
+    while (1) {
+        j = (j + 1) & (cap - 1);
+        if (job_list->pids[j].job == NULL) break;
+        unsigned int home = hash_pid(job_list->pids[j].pid, cap);
+        // Move the entry if its home bucket is not in the (cyclic) range (i, j].
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            job_list->pids[i] = job_list->pids[j];
+            job_list->pids[j].job = NULL;
+            i = j;
+        }
+    }
+}
+
+static void add_process(job_list_t *job_list, job_t *job, pid_t pid) {
+    if (job->num_procs == job->procs_cap) {
+        job->procs_cap = job->procs_cap ? job->procs_cap * 2 : 4;
+        job->procs = realloc(job->procs, sizeof(process_t) * job->procs_cap);
+    }
+    job->procs[job->num_procs].pid = pid;
+    job->procs[job->num_procs].state = PROC_RUNNING;
+    job->num_procs++;
+    add_pid(job_list, pid, job);
+}
+
+static job_t *alloc_job(job_list_t *job_list) {
+    if (job_list->pool == NULL) {
+        // Carve a new slab into free jobs.
+        job_t *slab = calloc(JOB_SLAB_SIZE, sizeof(job_t));
+        job_list->slabs = realloc(job_list->slabs, sizeof(job_t *) * (job_list->slab_count + 1));
+        job_list->slabs[job_list->slab_count++] = slab;
+        for (int i = 0; i < JOB_SLAB_SIZE; i++) {
+            slab[i].next = job_list->pool;
+            job_list->pool = &slab[i];
+        }
+    }
+    job_t *job = job_list->pool;
+    job_list->pool = job->next;
+    job->next = NULL;
+    return job;
+}
 
 void init_job_list(job_list_t *job_list) {
-    job_list->first = NULL;
-    job_list->size = 0;
+    memset(job_list, 0, sizeof(job_list_t));
+    grow_pids(job_list);
+}
+
+void append_job_cmd(job_t *job, const char *str) {
+    size_t len = strlen(str);
+    if (job->cmd_len + len + 1 > job->cmd_cap) {
+        job->cmd_cap = job->cmd_cap ? job->cmd_cap : 64;
+        while (job->cmd_len + len + 1 > job->cmd_cap) job->cmd_cap *= 2;
+        job->cmd = realloc(job->cmd, job->cmd_cap);
+    }
+    memcpy(job->cmd + job->cmd_len, str, len + 1);
+    job->cmd_len += len;
 }
 
 job_t *add_job(job_list_t *job_list, pid_t pid, enum job_state state, char **cmd) {
-    job_t *job = malloc(sizeof(job_t));
+    job_t *job = alloc_job(job_list);
+    stat_add(STAT_JOBS_ADDED, 1);
     job->pid = pid;
     job->state = state;
-    job->pgid = job_id++;
+    if (state == BACKGROUND) job_list->running_bg++;
+    job->pgid = job_list->max_id + 1;
+    job->status = 0;
+    time(&job->start_time);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job->end.tv_sec = job->end.tv_nsec = 0;
+    memset(&job->usage, 0, sizeof(struct rusage));
+    job->limits.mask = 0;
+    job->pinned = 0;
+    job->priority = 0;
+    job->queued_argv = NULL;
+    job->history = -1;
+    job->output = NULL;
+    job->on_done = NULL;
+    job->done_data = NULL;
+    job->chain = NULL;
+    job->timeout_ms = job->grace_ms = 0;
+    job->expires = 0;
+    job->timed_out = 0;
+    // Concatenate all the arguments in cmd to a single string in job->cmd (reusing the buffer of the recycled job).
+    job->cmd_len = 0;
+    append_job_cmd(job, "");
+    for (int i = 0; cmd[i] != NULL; i++) {
+        append_job_cmd(job, cmd[i]);
+        append_job_cmd(job, " ");
+    }
     // If the job is a background job, append an ampersand to the command line.
-    if (state == BACKGROUND) {
-        // Concatenate all the arguments in cmd to a single string in job->cmd.
-        // Then append an ampersand to the end of the string.
-        int i = 0, len = 0;
-        while (cmd[i] != NULL) {
-            len += strlen(cmd[i]);
-            i++;
-        }
-        job->cmd = malloc(sizeof(char) * (len + i + 2));
-        i = 0;
-        job->cmd[0] = '\0';
-        while (cmd[i] != NULL) {
-            strcat(job->cmd, cmd[i]);
-            strcat(job->cmd, " ");
-            i++;
-        }
-        strcat(job->cmd, "&");
-    } 
-    else {
-        // Concatenate all the arguments in cmd to a single string in job->cmd.
-        int i = 0, len = 0;
-        while (cmd[i] != NULL) {
-            len += strlen(cmd[i]);
-            i++;
-        }
-        job->cmd = malloc(sizeof(char) * (len + i + 1));
-        i = 0;
-        job->cmd[0] = '\0';
-        while (cmd[i] != NULL) {
-            strcat(job->cmd, cmd[i]);
-            strcat(job->cmd, " ");
-            i++;
-        }
-        
+    if (state == BACKGROUND || state == QUEUED) append_job_cmd(job, "&");
+    if (job->pgid > job_list->slot_cap) {
+        int old_cap = job_list->slot_cap;
+        job_list->slot_cap = old_cap ? old_cap * 2 : 64;
+        job_list->slots = realloc(job_list->slots, sizeof(job_t *) * job_list->slot_cap);
+        memset(job_list->slots + old_cap, 0, sizeof(job_t *) * (job_list->slot_cap - old_cap));
     }
-    job->next = job_list->first;
-    job_list->first = job;
+    job_list->slots[job->pgid - 1] = job;
+    job_list->max_id = job->pgid;
+    job->num_procs = 0;
+    if (pid > 0) add_process(job_list, job, pid);
     job_list->size++;
     return job;
 }
 
-job_t *delete_job(job_list_t *job_list, pid_t pid) {
-    job_t *job = job_list->first;
-    job_t *prev = NULL;
-    while (job != NULL) {
-        if (job->pid == pid) {
-            if (prev == NULL)
-                job_list->first = job->next;
-            else
-                prev->next = job->next;
-            free(job->cmd);
-            free(job);
-            job = NULL;
-            job_list->size--;
-        }
-        if (job != NULL) {
-            prev = job;
-            job = job->next;
-        }
+void add_job_process(job_list_t *job_list, job_t *job, pid_t pid, char **cmd) {
+    if (cmd == NULL) {
+        // The command line of a queued job is already complete.
+        add_process(job_list, job, pid);
+        return;
     }
-    // Make the maximum id in the job list the job_id.
-    job_id = 1;
-    job = job_list->first;
-    while (job != NULL) {
-        if (job->pgid >= job_id)
-            job_id = job->pgid + 1;
-        job = job->next;
+    // Keep the ampersand of a background job at the end of the command line.
+    int background = job->cmd_len > 0 && job->cmd[job->cmd_len - 1] == '&';
+    if (background) job->cmd[--job->cmd_len] = '\0';
+    append_job_cmd(job, "| ");
+    for (int i = 0; cmd[i] != NULL; i++) {
+        append_job_cmd(job, cmd[i]);
+        append_job_cmd(job, " ");
     }
-    return prev;
+    if (background) append_job_cmd(job, "&");
+    if (pid > 0) add_process(job_list, job, pid);
+}
+
+void set_job_state(job_list_t *job_list, job_t *job, enum job_state state) {
+    if (job->state == BACKGROUND) job_list->running_bg--;
+    if (state == BACKGROUND) job_list->running_bg++;
+    job->state = state;
+    // The output captured while the job was in the background is shown when it gets the terminal.
+    if (state == FOREGROUND) foreground_job_output(job);
+}
+
+void delete_job(job_list_t *job_list, job_t *job) {
+    stat_add(STAT_JOBS_DELETED, 1);
+    for (int i = 0; i < job->num_procs; i++)
+        if (job->procs[i].state != PROC_DONE) remove_pid(job_list, job->procs[i].pid);
+    if (job->state == BACKGROUND) job_list->running_bg--;
+    set_history_result(job->history, job->status, job_elapsed(job));
+    release_job_output(job);
+    cancel_deadline(job);
+    free(job->queued_argv);
+    job->queued_argv = NULL;
+    free(job->chain);
+    job->chain = NULL;
+    job_list->slots[job->pgid - 1] = NULL;
+    // Make the maximum id in the job list the last used id.
+    while (job_list->max_id > 0 && job_list->slots[job_list->max_id - 1] == NULL) job_list->max_id--;
+    job_list->size--;
+    // Return the job to the pool, keeping its buffers.
+    job->next = job_list->pool;
+    job_list->pool = job;
 }
 
 job_t *get_job(job_list_t *job_list, pid_t pid) {
-    job_t *job = job_list->first;
-    while (job != NULL) {
-        if (job->pid == pid) {
-            return job;
-        }
-        job = job->next;
+    unsigned int i = hash_pid(pid, job_list->pid_cap);
+    while (job_list->pids[i].job != NULL) {
+        if (job_list->pids[i].pid == pid) return job_list->pids[i].job;
+        i = (i + 1) & (job_list->pid_cap - 1);
     }
     return NULL;
 }
 
 job_t *get_job_by_id(job_list_t *job_list, int pgid) {
-    job_t *job = job_list->first;
-    while (job != NULL) {
-        if (job->pgid == pgid) {
-            return job;
-        }
-        job = job->next;
-    }
+    if (pgid < 1 || pgid > job_list->max_id) return NULL;
+    return job_list->slots[pgid - 1];
+}
+
+job_t *next_job(job_list_t *job_list, job_t *job) {
+    for (int i = job == NULL ? 0 : job->pgid; i < job_list->max_id; i++)
+        if (job_list->slots[i] != NULL) return job_list->slots[i];
     return NULL;
 }
 
 void print_job_list(job_list_t *job_list) {
     // Print the job list in sorted order of pgid.
-    for (int i = 1; i < job_id; i++) {
-        job_t *job = get_job_by_id(job_list, i);
-        if (job != NULL) printf("[%d] %d %s %s\n", job->pgid, job->pid, job_state_str[job->state / 2], job->cmd);
+    char limits[128], cpus[128];
+    for (job_t *job = next_job(job_list, NULL); job != NULL; job = next_job(job_list, job)) {
+        if (job->state == QUEUED) printf("[%d] - %s %s", job->pgid, job_state_str[job->state], job->cmd);
+        else printf("[%d] %d %s %s", job->pgid, job->pid, job_state_str[job->state], job->cmd);
+        if (job->priority != 0) printf(" (nice: %d)", job->priority);
+        if (job->limits.mask) printf(" (limits: %s)", format_limits(&job->limits, limits, sizeof(limits)));
+        // Only the pinned jobs are asked for their affinity, so large job lists stay cheap to print.
+        if (job->pinned && format_affinity(job->pid, cpus, sizeof(cpus)) != NULL) printf(" (cpus: %s)", cpus);
+        if (job->timed_out) printf(" (timed out)");
+        else if (job->expires != 0) printf(" (deadline: %.1fs)", deadline_remaining(job));
+        else if (job->timeout_ms > 0) printf(" (timeout: %.1fs)", job->timeout_ms / 1e3);
+        printf("\n");
     }
 }
 
+double job_elapsed(const job_t *job) {
+    struct timespec end = job->end;
+    if (end.tv_sec == 0 && end.tv_nsec == 0) clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - job->start.tv_sec) + (end.tv_nsec - job->start.tv_nsec) / 1e9;
+}
+
+static double tv_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void print_job_usage(job_list_t *job_list) {
+    for (job_t *job = next_job(job_list, NULL); job != NULL; job = next_job(job_list, job)) {
+        char started[16];
+        strftime(started, sizeof(started), "%H:%M:%S", localtime(&job->start_time));
+        printf("[%d] %d %s %s\n", job->pgid, job->pid, job_state_str[job->state], job->cmd);
+        // Only the processes that have finished are accounted for.
+        printf("    started %s  elapsed %.3fs  user %.3fs  sys %.3fs  maxrss %ldK  faults %ld major, %ld minor\n",
+               started, job_elapsed(job), tv_seconds(job->usage.ru_utime), tv_seconds(job->usage.ru_stime),
+               job->usage.ru_maxrss, job->usage.ru_majflt, job->usage.ru_minflt);
+    }
+}
+
+static void add_usage(struct rusage *total, const struct rusage *usage) {
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss) total->ru_maxrss = usage->ru_maxrss;
+    total->ru_majflt += usage->ru_majflt;
+    total->ru_minflt += usage->ru_minflt;
+}
+
 void free_job_list(job_list_t *job_list) {
-    job_t *job = job_list->first;
-    while (job != NULL) {
-        job_t *next = job->next;
-        free(job->cmd);
-        free(job);
-        job = next;
+    for (int i = 0; i < job_list->slab_count; i++) {
+        for (int j = 0; j < JOB_SLAB_SIZE; j++) {
+            free(job_list->slabs[i][j].cmd);
+            free(job_list->slabs[i][j].procs);
+            free(job_list->slabs[i][j].queued_argv);
+            free(job_list->slabs[i][j].chain);
+        }
+        free(job_list->slabs[i]);
     }
+    while (job_list->chains != NULL) {
+        chain_t *chain = job_list->chains;
+        job_list->chains = chain->next;
+        free(chain->line);
+        free(chain);
+    }
+    free(job_list->slabs);
+    free(job_list->slots);
+    free(job_list->pids);
+    memset(job_list, 0, sizeof(job_list_t));
+}
+
+typedef struct {
+    // Job ID and process ID of the job, its wait status, and whether it reached its time limit.
+    int id;
+    pid_t pid;
+    int status;
+    int timed_out;
+} notification_t;
+
+// Notifications of the background jobs that finished since the last prompt, and the number
+// of the ones that did not fit (the jobs themselves are always updated right away).
+static notification_t notify_queue[NOTIFY_QUEUE_SIZE];
+static int notify_count = 0;
+static unsigned long notify_overflow = 0;
+
+static void queue_notification(job_t *job, int status) {
+    if (notify_count == NOTIFY_QUEUE_SIZE) notify_overflow++;
+    else notify_queue[notify_count++] = (notification_t) {job->pgid, job->pid, status, job->timed_out};
+}
+
+void print_notifications(void) {
+    if (notify_count == 0 && notify_overflow == 0) return;
+    // Format the whole batch first, so it reaches the terminal in one write.
+    char *buf;
+    size_t size;
+    FILE *out = open_memstream(&buf, &size);
+    if (out == NULL) return;
+    for (int i = 0; i < notify_count; i++) {
+        notification_t *n = &notify_queue[i];
+        if (n->timed_out) fprintf(out, "[%d] Timed out\n", n->id);
+        else if (WIFEXITED(n->status)) fprintf(out, "[%d] Done\n", n->id);
+        else fprintf(out, "[%d] %d terminated by signal %d\n", n->id, n->pid, WTERMSIG(n->status));
+    }
+    if (notify_overflow > 0) fprintf(out, "... and %lu more jobs finished\n", notify_overflow);
+    fclose(out);
+    fflush(stdout);
+    fwrite(buf, 1, size, stdout);
+    fflush(stdout);
+    free(buf);
+    notify_count = 0;
+    notify_overflow = 0;
+}
+
+// Queue the rest of the command list of a job that has finished, to run from the main loop (see run_chains).
+static void queue_chain(job_list_t *job_list, job_t *job) {
+    chain_t *chain = malloc(sizeof(chain_t));
+    const char *result = WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0 ? "true " : "false ";
+    chain->line = malloc(strlen(result) + strlen(job->chain) + 1);
+    strcpy(chain->line, result);
+    strcat(chain->line, job->chain);
+    chain->foreground = job->state == FOREGROUND;
+    chain->next = NULL;
+    chain_t **tail = &job_list->chains;
+    while (*tail != NULL) tail = &(*tail)->next;
+    *tail = chain;
+}
+
+void update_job(job_list_t *job_list, pid_t pid, int status, const struct rusage *usage) {
+    job_t *job = get_job(job_list, pid);
+    // Not a job (e.g. a child that failed to execute).
+    if (job == NULL) return;
+    process_t *proc = job->procs;
+    while (proc->pid != pid) proc++;
+    enum job_status job_status = get_status(status);
+    if (job_status == SIGNALED || job_status == EXITED) {
+        proc->state = PROC_DONE;
+        remove_pid(job_list, pid);
+        add_usage(&job->usage, usage);
+        // The status of a pipeline is the status of its last process.
+        if (proc == &job->procs[job->num_procs - 1]) job->status = status;
+        for (int i = 0; i < job->num_procs; i++)
+            if (job->procs[i].state != PROC_DONE) return;
+        status = job->status;
+        job_status = get_status(status);
+        clock_gettime(CLOCK_MONOTONIC, &job->end);
+        // A job killed for reaching its time limit fails like with timeout(1).
+        if (job->state == FOREGROUND) job_list->fg_status = job->timed_out ? TIMED_OUT_STATUS : status;
+        if (job->chain != NULL) queue_chain(job_list, job);
+        if (job->on_done != NULL) job->on_done(job, job->done_data);
+        else if (job->state == FOREGROUND) {
+            if (job->timed_out) printf("[%d] %d timed out\n", job->pgid, job->pid);
+            else if (job_status == SIGNALED) printf("\n[%d] %d terminated by signal %d\n", job->pgid, job->pid, status);
+        }
+        // Background jobs are reported at the next prompt.
+        else queue_notification(job, status);
+        // If all the processes are signaled or exited, delete the job from the job list.
+        delete_job(job_list, job);
+    }
+    else if (job_status == SUSPENDED) {
+        proc->state = PROC_STOPPED;
+        // Without job control, the jobs are stopped along with the shell, which keeps waiting for them.
+        if (job->state == STOPPED || !job_control) return;
+        if (job->state == FOREGROUND) printf("\n");
+        // Send SIGSTOP to the process group to stop all processes in the group.
+        else killpg(job->pid, SIGSTOP);
+        // If the job is suspended, change its state to STOPPED.
+        set_job_state(job_list, job, STOPPED);
+    }
+    else if (job_status == CONTINUED) {
+        proc->state = PROC_RUNNING;
+        if (job->state != STOPPED) return;
+        // Send SIGCONT to the process group to continue all processes in the group.
+        killpg(job->pid, SIGCONT);
+        // If the job is continued, change its state to BACKGROUND.
+        set_job_state(job_list, job, BACKGROUND);
+    }
+}
+
+void reap_jobs(job_list_t *job_list) {
+    int status;
+    pid_t pid;
+    struct rusage usage;
+    // Non-blocking wait4 calls for any child until no more state changes are pending.
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        stat_add(STAT_WAIT_CALLS, 1);
+        update_job(job_list, pid, status, &usage);
+    }
+    stat_add(STAT_WAIT_CALLS, 1);
+    fflush(stdout);
+}
+
+static void sigchld_callback(int fd, unsigned int events, void *data) {
+    struct signalfd_siginfo info[16];
+    ssize_t n;
+    // Drain the signalfd; several SIGCHLDs may have been merged anyway, so reap_jobs checks all children.
+    while ((n = read(fd, info, sizeof(info))) > 0) stat_add(STAT_SIGCHLD, n / sizeof(info[0]));
+    stat_add(STAT_SIGCHLD_WAKEUPS, 1);
+    job_list_t *job_list = data;
+    reap_jobs(job_list);
+    // Finished or stopped jobs may have freed room for queued ones.
+    if (job_list->dispatch != NULL) job_list->dispatch(job_list);
+}
+
+int init_sigchld_fd(job_list_t *job_list) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) {
+        perror("signalfd");
+        return -1;
+    }
+    if (event_add(fd, EPOLLIN, sigchld_callback, job_list) == -1) {
+        perror("epoll_ctl");
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+int wait_for_job(job_list_t *job_list, job_t *job, int cont) {
+    pid_t pid = job->pid;
+    int id = job->pgid;
+    // Associate the process group with the terminal.
+    long long start = stat_now();
+    if (has_terminal) tcsetpgrp(STDIN_FILENO, pid);
+    if (cont) killpg(pid, SIGCONT);
+    // The job is deleted when it finishes, so look it up again after every batch of events.
+    while ((job = get_job_by_id(job_list, id)) != NULL && job->pid == pid && job->state == FOREGROUND) event_run(-1);
+    // Get the terminal back.
+    if (has_terminal) tcsetpgrp(STDIN_FILENO, getpid());
+    stat_record(HIST_FG_WAIT, stat_now() - start);
+    return job != NULL && job->pid == pid ? -1 : job_list->fg_status;
 }
 
 void terminal_signal_handler(void (*handler)(int)) {
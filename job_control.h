@@ -1,36 +1,136 @@
+#include <time.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include "rlimits.h"
 
 #ifndef JOB_CONTROL_H
 #define JOB_CONTROL_H
 
 enum job_state {
-    FOREGROUND, BACKGROUND, STOPPED
+    FOREGROUND, BACKGROUND, STOPPED, QUEUED
 };
 enum job_status {
     SUSPENDED, CONTINUED, EXITED, SIGNALED
 };
-extern const char *job_state_str[2];
+extern const char *job_state_str[4];
+// Whether stdin is a terminal the shell hands over to foreground jobs.
+extern int has_terminal;
+// Whether each job gets its own process group. Subshells and -c run without job control: their
+// jobs stay in the shell's process group, and are stopped and interrupted along with it.
+extern int job_control;
 
-typedef struct _ {
+// Number of job notifications kept until they are printed (see print_notifications).
+#define NOTIFY_QUEUE_SIZE 256
+
+enum process_state {
+    PROC_RUNNING, PROC_STOPPED, PROC_DONE
+};
+
+typedef struct {
     // Process ID.
     pid_t pid;
+    // Process state.
+    enum process_state state;
+} process_t;
+
+typedef struct _ {
+    // Process ID of the process group leader (the first process of the job).
+    pid_t pid;
     // Job state.
     enum job_state state;
     // Job ID.
     int pgid;
     // Command line.
     char *cmd;
-    // Pointer to the next job.
+    // Length of the command line and capacity of its buffer (kept when the job is recycled).
+    size_t cmd_len, cmd_cap;
+    // Processes of the job, one per pipeline stage (the buffer is kept when the job is recycled).
+    process_t *procs;
+    int num_procs, procs_cap;
+    // Wait status of the last process of the pipeline, once it has finished.
+    int status;
+    // Wall-clock time the job was started, and start and end times on the monotonic clock.
+    time_t start_time;
+    struct timespec start, end;
+    // Resource usage of the processes of the job that have finished (times and faults
+    // are summed over the pipeline, the max RSS is the largest of the stages).
+    struct rusage usage;
+    // Resource limits the processes of the job were started with (or changed to).
+    job_limits_t limits;
+    // Whether the job was pinned to CPUs (by autopin or the pin builtin).
+    int pinned;
+    // Niceness of the processes, which is also the dispatch priority of a queued job.
+    int priority;
+    // Arguments of the stages of a QUEUED job, each stage ending with NULL and the
+    // last one followed by another NULL (one allocation, NULL if the job is not queued).
+    char **queued_argv;
+    // History entry that gets the status and duration of the job (-1 for none).
+    long history;
+    // Buffer of the captured output of a background job (NULL if its output is not captured).
+    struct output_ring *output;
+    // Called when the job has finished, instead of printing the notification (NULL for none).
+    void (*on_done)(struct _ *job, void *data);
+    void *done_data;
+    // Rest of the command list the job was stopped in, with the separator before it (e.g. "&& make install"),
+    // run once the job has finished (NULL for none).
+    char *chain;
+    // Time limit of the job and grace period between SIGTERM and SIGKILL once it is reached, in ms
+    // (0 for none, see watchdog.h). The time limit of a QUEUED job starts when it is dispatched.
+    int timeout_ms, grace_ms;
+    // Tick at which the timer of the job fires (0 if it is not armed), and its neighbours in its slot of the timer wheel.
+    long long expires;
+    struct _ *timer_prev, *timer_next;
+    // Whether the time limit was reached: 1 once SIGTERM was sent, 2 once SIGKILL was.
+    int timed_out;
+    // Pointer to the next free job in the pool, or to the next job in the admission queue.
     struct _ *next;
 } job_t;
 
 typedef struct {
-    // Pointer to the first job.
-    job_t *first;
+    // Process ID.
+    pid_t pid;
+    // The job the process belongs to.
+    job_t *job;
+} pid_entry_t;
+
+typedef struct chain {
+    // Command line to run: the status of the job ("true" or "false") followed by the rest of the list.
+    char *line;
+    // Whether the job finished in the foreground, so the rest of the list runs in the foreground too.
+    int foreground;
+    struct chain *next;
+} chain_t;
+
+typedef struct job_list {
+    // Jobs indexed by job ID - 1 (NULL for unused IDs).
+    job_t **slots;
+    // Number of slots.
+    int slot_cap;
+    // Highest job ID in use.
+    int max_id;
+    // Open addressing hash table from the process ID of every running process to its job.
+    pid_entry_t *pids;
+    // Number of buckets in the hash table (a power of two) and number of entries.
+    int pid_cap, pid_count;
+    // Free jobs, allocated JOB_SLAB_SIZE at a time.
+    job_t *pool;
+    // Slabs the jobs were allocated from.
+    job_t **slabs;
+    int slab_count;
     // Size of the job list.
     int size;
+    // Number of jobs in the BACKGROUND state.
+    int running_bg;
+    // Called after children have been reaped, to start queued jobs (NULL for none).
+    void (*dispatch)(struct job_list *job_list);
+    // Wait status of the last foreground job that finished.
+    int fg_status;
+    // Command lists to resume, whose stopped job has finished since (oldest first, see run_chains).
+    chain_t *chains;
 } job_list_t;
 
+#define JOB_SLAB_SIZE 64
+
 /*
  * Function: init_job_list
  * -----------------------
@@ -44,9 +144,10 @@ void init_job_list(job_list_t *job_list);
  * Function: add_job
  * -----------------
  *   Add a job to the job list.
+ *   The job gets the smallest ID above all the IDs in use.
  *
  *   job_list: the job list
- *   pid: the process ID
+ *   pid: the process ID (0 for a QUEUED job, which has no processes yet)
  *   state: the job state
  *   cmd: the command line
  * 
@@ -54,17 +155,49 @@ void init_job_list(job_list_t *job_list);
  */
 job_t *add_job(job_list_t *job_list, pid_t pid, enum job_state state, char **cmd);
 
+/*
+ * Function: add_job_process
+ * -------------------------
+ *   Add the next stage of a pipeline to a job.
+ *   The process is expected to be in the process group of the job.
+ *
+ *   job_list: the job list
+ *   job: the job
+ *   pid: the process ID (0 to only add the command line, for a QUEUED job)
+ *   cmd: the command line of the stage (NULL when starting the processes of a QUEUED job)
+ */
+void add_job_process(job_list_t *job_list, job_t *job, pid_t pid, char **cmd);
+
+/*
+ * Function: append_job_cmd
+ * ------------------------
+ *   Append a string to the command line of a job.
+ *
+ *   job: the job
+ *   str: the string
+ */
+void append_job_cmd(job_t *job, const char *str);
+
+/*
+ * Function: set_job_state
+ * -----------------------
+ *   Change the state of a job, keeping count of the running background jobs.
+ *
+ *   job_list: the job list
+ *   job: the job
+ *   state: the new state
+ */
+void set_job_state(job_list_t *job_list, job_t *job, enum job_state state);
+
 /*
  * Function: delete_job
  * --------------------
- *   Delete a job from the job list.
+ *   Delete a job from the job list and return it to the pool.
  *
  *   job_list: the job list
- *   pid: the process ID
- * 
- *   returns: a pointer to the previous job before the deleted job
+ *   job: the job
  */
-job_t *delete_job(job_list_t *job_list, pid_t pid);
+void delete_job(job_list_t *job_list, job_t *job);
 
 /*
  * Function: get_job
@@ -72,7 +205,7 @@ job_t *delete_job(job_list_t *job_list, pid_t pid);
  *   Get a job from the job list.
  *
  *   job_list: the job list
- *   pid: the process ID
+ *   pid: the process ID of any running process of the job
  *
  *   return: the job
  */
@@ -90,6 +223,19 @@ job_t *get_job(job_list_t *job_list, pid_t pid);
  */
 job_t *get_job_by_id(job_list_t *job_list, int pgid);
 
+/*
+ * Function: next_job
+ * ------------------
+ *   Iterate over the jobs in order of job ID.
+ *   The current job may be deleted before moving to the next one.
+ *
+ *   job_list: the job list
+ *   job: the current job, or NULL to get the first job
+ *
+ *   return: the job with the next higher ID, or NULL if there is none
+ */
+job_t *next_job(job_list_t *job_list, job_t *job);
+
 /*
  * Function: print_job_list
  * ------------------------
@@ -99,6 +245,26 @@ job_t *get_job_by_id(job_list_t *job_list, int pgid);
  */
 void print_job_list(job_list_t *job_list);
 
+/*
+ * Function: print_job_usage
+ * -------------------------
+ *   Print the jobs with their start time, elapsed time and resource usage.
+ *
+ *   job_list: the job list
+ */
+void print_job_usage(job_list_t *job_list);
+
+/*
+ * Function: job_elapsed
+ * ---------------------
+ *   Get the wall-clock time a job has been running (until it finished, if it has).
+ *
+ *   job: the job
+ *
+ *   returns: the elapsed time in seconds
+ */
+double job_elapsed(const job_t *job);
+
 /*
  * Function: free_job_list
  * -----------------------
@@ -108,6 +274,70 @@ void print_job_list(job_list_t *job_list);
  */
 void free_job_list(job_list_t *job_list);
 
+/*
+ * Function: update_job
+ * --------------------
+ *   Apply a state change reported by waitpid to the job of a process.
+ *   A job is deleted once all its processes have exited or been signaled
+ *   (after calling its on_done callback, if any),
+ *   it becomes STOPPED when one of its processes is suspended, and a
+ *   continued STOPPED job becomes BACKGROUND.
+ *   The resource usage of finished processes is added to the job.
+ *
+ *   job_list: the job list
+ *   pid: the process ID returned by wait4
+ *   status: the status returned by wait4
+ *   usage: the resource usage returned by wait4
+ */
+void update_job(job_list_t *job_list, pid_t pid, int status, const struct rusage *usage);
+
+/*
+ * Function: print_notifications
+ * -----------------------------
+ *   Print the notifications ("[N] Done") of the background jobs that finished since the
+ *   last call, in one write. The shell calls it before the prompt, so they never land in
+ *   the middle of a line being edited. At most NOTIFY_QUEUE_SIZE are kept in between,
+ *   the others are only counted.
+ */
+void print_notifications(void);
+
+/*
+ * Function: reap_jobs
+ * -------------------
+ *   Collect the state changes of all the children that have one pending,
+ *   with one wait4 call per changed child (plus one to find out there are no more).
+ *
+ *   job_list: the job list
+ */
+void reap_jobs(job_list_t *job_list);
+
+/*
+ * Function: init_sigchld_fd
+ * -------------------------
+ *   Block SIGCHLD and receive it through a signalfd watched by the event loop,
+ *   so children are reaped in the main loop instead of in a signal handler
+ *   (followed by a call to the dispatch callback of the job list).
+ *
+ *   job_list: the job list
+ *
+ *   returns: 0 on success, -1 on error
+ */
+int init_sigchld_fd(job_list_t *job_list);
+
+/*
+ * Function: wait_for_job
+ * ----------------------
+ *   Give the terminal to a foreground job (if there is one) and run the event loop
+ *   until the job is stopped or finished, then take the terminal back.
+ *
+ *   job_list: the job list
+ *   job: the foreground job
+ *   cont: whether to send SIGCONT to the job once it has the terminal
+ *
+ *   returns: the wait status of the job, or -1 if it was stopped
+ */
+int wait_for_job(job_list_t *job_list, job_t *job, int cont);
+
 /*
  * Function: terminal_signal_handler
  * ---------------------------------
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "complete.h"
+#include "history.h"
+#include "line_edit.h"
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+// Keys of the escape sequences, outside the range of bytes.
+enum {
+    KEY_UP = 256, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_HOME, KEY_END, KEY_DELETE
+};
+
+// The line being edited, always NUL-terminated. The text before base belongs to
+// previous lines of a continued line, the cursor is at pos.
+static char *buf = NULL;
+static size_t len = 0, cap = 0, pos = 0, base = 0;
+// Terminal modes of the shell, restored after each line.
+static struct termios cooked;
+static int have_cooked = 0;
+static completion_t completion;
+static int completion_ready = 0;
+// Output of a redraw, written at once.
+static char *out = NULL;
+static size_t out_len = 0, out_cap = 0;
+
+static void out_append(const char *s, size_t n) {
+    if (out_len + n > out_cap) {
+        out_cap = out_cap ? out_cap : 256;
+        while (out_len + n > out_cap) out_cap *= 2;
+        out = realloc(out, out_cap);
+    }
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void out_flush(void) {
+    // Whatever was printed with stdio comes first.
+    fflush(stdout);
+    for (size_t done = 0; done < out_len;) {
+        ssize_t n = write(STDOUT_FILENO, out + done, out_len - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    out_len = 0;
+}
+
+// Whether a byte continues a UTF-8 character (the cursor never stops on one).
+static int is_continuation(char c) {
+    return (c & 0xc0) == 0x80;
+}
+
+static size_t columns(const char *s, size_t n) {
+    size_t cols = 0;
+    for (size_t i = 0; i < n; i++) cols += !is_continuation(s[i]);
+    return cols;
+}
+
+static void refresh(const char *prompt) {
+    struct winsize ws;
+    size_t width = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    size_t prompt_cols = columns(prompt, strlen(prompt));
+    width = width > prompt_cols + 1 ? width - prompt_cols - 1 : 1;
+    // Scroll horizontally so the cursor stays visible on a single row.
+    size_t start = base;
+    while (columns(buf + start, pos - start) >= width) {
+        start++;
+        while (start < pos && is_continuation(buf[start])) start++;
+    }
+    size_t end = start, cols = 0;
+    while (end < len && (cols < width || is_continuation(buf[end]))) cols += !is_continuation(buf[end++]);
+    char move[32];
+    out_append("\r", 1);
+    out_append(prompt, strlen(prompt));
+    out_append(buf + start, end - start);
+    out_append("\x1b[K\r", 4);
+    size_t cursor = prompt_cols + columns(buf + start, pos - start);
+    if (cursor > 0) out_append(move, snprintf(move, sizeof(move), "\x1b[%zuC", cursor));
+    out_flush();
+}
+
+static void insert_text(const char *s, size_t n) {
+    if (len + n + 1 > cap) {
+        cap = cap ? cap : 256;
+        while (len + n + 1 > cap) cap *= 2;
+        buf = realloc(buf, cap);
+    }
+    memmove(buf + pos + n, buf + pos, len - pos + 1);
+    memcpy(buf + pos, s, n);
+    len += n;
+    pos += n;
+}
+
+static void delete_text(size_t from, size_t to) {
+    memmove(buf + from, buf + to, len - to + 1);
+    len -= to - from;
+    pos = from;
+}
+
+// Replace the text of the current line (after base) and put the cursor at its end.
+static void set_text(const char *s) {
+    delete_text(base, len);
+    insert_text(s, strlen(s));
+}
+
+static size_t prev_char(size_t i) {
+    if (i > base) i--;
+    while (i > base && is_continuation(buf[i])) i--;
+    return i;
+}
+
+static size_t next_char(size_t i) {
+    if (i < len) i++;
+    while (i < len && is_continuation(buf[i])) i++;
+    return i;
+}
+
+static void enable_raw_mode(int fd) {
+    // The modes are saved once, so a job that was stopped in its own modes (e.g. an editor) cannot leave them behind.
+    if (!have_cooked) have_cooked = tcgetattr(fd, &cooked) == 0;
+    if (!have_cooked) return;
+    struct termios raw = cooked;
+    // The output processing stays on, so messages printed while a line is edited still start a new line.
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSADRAIN, &raw);
+}
+
+static void disable_raw_mode(int fd) {
+    if (have_cooked) tcsetattr(fd, TCSADRAIN, &cooked);
+}
+
+// Read a key, decoding the escape sequences of the arrows and the editing keys.
+static int read_key(reader_t *reader) {
+    int c = read_byte(reader);
+    if (c != KEY_ESC) return c;
+    int c1 = read_byte(reader);
+    if (c1 != '[' && c1 != 'O') return c1 == -1 ? -1 : KEY_ESC;
+    int c2 = read_byte(reader);
+    if (c2 >= '0' && c2 <= '9') {
+        // "ESC [ n ~" sequences.
+        int c3 = read_byte(reader);
+        if (c3 != '~') return KEY_ESC;
+        if (c2 == '1' || c2 == '7') return KEY_HOME;
+        if (c2 == '4' || c2 == '8') return KEY_END;
+        if (c2 == '3') return KEY_DELETE;
+        return KEY_ESC;
+    }
+    switch (c2) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        default: return KEY_ESC;
+    }
+}
+
+static void show_matches(reader_t *reader, const char *prompt) {
+    int n = completion.num_matches;
+    if (n > COMPLETION_ASK) {
+        printf("\nDisplay all %d possibilities? (y or n)", n);
+        fflush(stdout);
+        if (read_byte(reader) != 'y') {
+            printf("\n");
+            refresh(prompt);
+            return;
+        }
+    }
+    struct winsize ws;
+    int width = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    int col_width = 0;
+    for (int i = 0; i < n; i++) {
+        int w = strlen(completion.matches[i]) + 2;
+        if (w > col_width) col_width = w;
+    }
+    // Fill the columns first, as ls does.
+    int per_row = width / col_width > 0 ? width / col_width : 1;
+    int rows = (n + per_row - 1) / per_row;
+    printf("\n");
+    for (int r = 0; r < rows; r++) {
+        for (int i = r; i < n; i += rows) printf("%-*s", i + rows < n ? col_width : 0, completion.matches[i]);
+        printf("\n");
+    }
+    refresh(prompt);
+}
+
+// Search the history backwards as the query is typed (Ctrl-R again finds an older match).
+// Returns the key that ended the search, to be handled as usual (0 if the search was cancelled).
+static int reverse_search(reader_t *reader) {
+    char query[256], prompt[sizeof(query) + 32];
+    size_t query_len = 0;
+    int size = history_size(), match = -1, failed = 0;
+    char *original = strdup(buf + base);
+    size_t original_pos = pos;
+    query[0] = '\0';
+    while (1) {
+        snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+        refresh(prompt);
+        int c = read_key(reader), n = -1;
+        if (c == CTRL_KEY('r')) {
+            if (query_len > 0) n = search_history(query, match == -1 ? size : match);
+        }
+        else if (c == KEY_BACKSPACE || c == CTRL_KEY('h')) {
+            if (query_len > 0) query[--query_len] = '\0';
+            if (query_len > 0) n = search_history(query, size);
+        }
+        else if (c >= 32 && c < 256 && query_len < sizeof(query) - 1) {
+            query[query_len++] = c;
+            query[query_len] = '\0';
+            // The current match may still contain the longer query.
+            n = search_history(query, match == -1 ? size : match + 1);
+        }
+        else {
+            if (c == CTRL_KEY('g')) {
+                set_text(original);
+                pos = original_pos;
+                c = 0;
+            }
+            free(original);
+            return c;
+        }
+        failed = n == -1 && query_len > 0;
+        if (n == -1) continue;
+        match = n;
+        history_entry_t entry;
+        get_history(match, &entry);
+        set_text(entry.text);
+        pos = base + (strstr(entry.text, query) - entry.text);
+    }
+}
+
+char *edit_line(reader_t *reader) {
+    const char *prompt = reader->prompt != NULL ? reader->prompt : "";
+    if (!completion_ready) {
+        init_completion(&completion);
+        completion_ready = 1;
+    }
+    // Catch up with the search directories before the first key, not on Tab.
+    refresh_completions();
+    enable_raw_mode(reader->fd);
+    if (buf == NULL) buf = malloc(cap = 256);
+    len = pos = base = 0;
+    buf[0] = '\0';
+    // Entry of the history being shown (-1 when editing a new line), and the new line meanwhile.
+    int hist = -1;
+    char *new_line = NULL;
+    int eof = 0, key = 0;
+    while (1) {
+        int c = key ? key : read_key(reader);
+        key = 0;
+        if (c == -1 || (c == CTRL_KEY('d') && len == 0)) {
+            eof = len == 0;
+            break;
+        }
+        if (c == '\r' || c == '\n') {
+            // An unescaped backslash at the end continues the line.
+            size_t n = 0;
+            while (len - n > base && buf[len - n - 1] == '\\') n++;
+            pos = len;
+            if (n % 2 == 0) break;
+            delete_text(len - 1, len);
+            base = len;
+            printf("\n");
+            refresh(prompt);
+            continue;
+        }
+        switch (c) {
+            case '\t':
+                complete_line(buf, pos, &completion);
+                if (completion.insert[0] != '\0') insert_text(completion.insert, strlen(completion.insert));
+                else if (completion.num_matches > 1) {
+                    show_matches(reader, prompt);
+                    continue;
+                }
+                break;
+            case CTRL_KEY('r'):
+                key = reverse_search(reader);
+                break;
+            case CTRL_KEY('c'):
+                printf("^C\n");
+                len = pos = base = 0;
+                buf[0] = '\0';
+                hist = -1;
+                break;
+            case CTRL_KEY('l'):
+                printf("\x1b[H\x1b[2J");
+                break;
+            case CTRL_KEY('a'):
+            case KEY_HOME:
+                pos = base;
+                break;
+            case CTRL_KEY('e'):
+            case KEY_END:
+                pos = len;
+                break;
+            case CTRL_KEY('b'):
+            case KEY_LEFT:
+                pos = prev_char(pos);
+                break;
+            case CTRL_KEY('f'):
+            case KEY_RIGHT:
+                pos = next_char(pos);
+                break;
+            case KEY_BACKSPACE:
+            case CTRL_KEY('h'):
+                delete_text(prev_char(pos), pos);
+                break;
+            case CTRL_KEY('d'):
+            case KEY_DELETE:
+                delete_text(pos, next_char(pos));
+                break;
+            case CTRL_KEY('k'):
+                delete_text(pos, len);
+                break;
+            case CTRL_KEY('u'):
+                delete_text(base, pos);
+                break;
+            case CTRL_KEY('w'): {
+                size_t start = pos;
+                while (start > base && buf[start - 1] == ' ') start--;
+                while (start > base && buf[start - 1] != ' ') start--;
+                delete_text(start, pos);
+                break;
+            }
+            case CTRL_KEY('p'):
+            case KEY_UP:
+            case CTRL_KEY('n'):
+            case KEY_DOWN: {
+                int up = c == CTRL_KEY('p') || c == KEY_UP;
+                if (hist == -1) {
+                    if (!up) break;
+                    hist = history_size();
+                    new_line = strdup(buf + base);
+                }
+                history_entry_t entry;
+                if (up && get_history(hist - 1, &entry) == 0) {
+                    hist--;
+                    set_text(entry.text);
+                }
+                else if (!up && get_history(hist + 1, &entry) == 0) {
+                    hist++;
+                    set_text(entry.text);
+                }
+                else if (!up) {
+                    // Back to the line that was being typed.
+                    set_text(new_line);
+                    free(new_line);
+                    new_line = NULL;
+                    hist = -1;
+                }
+                break;
+            }
+            default:
+                if (c >= 32 && c < 256 && c != KEY_BACKSPACE) {
+                    char ch = c;
+                    insert_text(&ch, 1);
+                }
+                break;
+        }
+        refresh(prompt);
+    }
+    free(new_line);
+    if (!eof) {
+        refresh(prompt);
+        printf("\n");
+    }
+    fflush(stdout);
+    disable_raw_mode(reader->fd);
+    return eof ? NULL : buf;
+}
@@ -0,0 +1,29 @@
+#include "input.h"
+
+#ifndef LINE_EDIT_H
+#define LINE_EDIT_H
+
+// Number of completion matches above which the user is asked before they are listed.
+#define COMPLETION_ASK 100
+
+/*
+ * Function: edit_line
+ * -------------------
+ *   Read a line from a terminal with the line editor. The terminal is in raw mode while
+ *   the line is edited, and restored before returning. The prompt (already printed by
+ *   the caller) is redrawn with the line, which scrolls horizontally when it is longer
+ *   than the terminal is wide.
+ *
+ *   Keys: Tab completes the word before the cursor (listing the matches when they have
+ *   no longer common prefix), the arrows, Home/End and Ctrl-A/E/B/F move, Backspace,
+ *   Delete and Ctrl-K/U/W delete, Up/Down and Ctrl-P/N recall the history, Ctrl-R
+ *   searches it backwards, Ctrl-C discards the line, Ctrl-L clears the screen and
+ *   Ctrl-D deletes a character, or ends the input on an empty line.
+ *
+ *   reader: the reader of the terminal
+ *
+ *   returns: the line (valid until the next call), or NULL at the end of the input
+ */
+char *edit_line(reader_t *reader);
+
+#endif
@@ -0,0 +1,366 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "event_loop.h"
+#include "input.h"
+#include "monitor.h"
+
+static const char *proc_file_path[NUM_PROC_FILES] = {"/proc/%d/stat", "/proc/%d/statm", "/proc/%d/io", "/proc/%d/task/%d/children"};
+
+typedef struct {
+    // Process ID (0 for an empty bucket, -1 for a process moved to the table of the next sample).
+    pid_t pid;
+    // Start time of the process (in clock ticks after boot), to tell a reused process ID.
+    unsigned long long start;
+    // Descriptors of the files of the process (-1 when not kept open).
+    int fds[NUM_PROC_FILES];
+    // CPU time (in clock ticks) and bytes read and written (rchar and wchar) at the last sample.
+    unsigned long long cpu, read, written;
+} sample_t;
+
+typedef struct {
+    // Open addressing hash table from the process ID to the last sample of the process.
+    sample_t *buckets;
+    // Number of buckets (a power of two) and number of processes.
+    int cap, count;
+} sample_table_t;
+
+typedef struct {
+    job_t *job;
+    // Number of processes, CPU usage in percent, resident memory in bytes, and bytes read and written per second.
+    int procs;
+    double cpu, rss, read, written;
+} row_t;
+
+// Descriptors kept open, and how many may be.
+static int kept_fds = 0, fd_budget = 0;
+// Buffer the files are read into (grown for long lists of children).
+static char *buf = NULL;
+static size_t buf_cap = 0;
+// Processes to sample for the current job.
+static pid_t *pending = NULL;
+static int pending_count = 0, pending_cap = 0;
+
+static unsigned int hash_pid(pid_t pid, int cap) {
+    return ((unsigned int) pid * 2654435769u) & (cap - 1);
+}
+
+static sample_t *find_sample(sample_table_t *table, pid_t pid) {
+    if (table->cap == 0) return NULL;
+    for (unsigned int i = hash_pid(pid, table->cap); table->buckets[i].pid != 0; i = (i + 1) & (table->cap - 1))
+        if (table->buckets[i].pid == pid) return &table->buckets[i];
+    return NULL;
+}
+
+static sample_t *insert_sample(sample_table_t *table, const sample_t *sample) {
+    // Keep the load factor below 1/2.
+    if ((table->count + 1) * 2 > table->cap) {
+        sample_table_t grown = {NULL, table->cap ? table->cap * 2 : 64, 0};
+        grown.buckets = calloc(grown.cap, sizeof(sample_t));
+        for (int i = 0; i < table->cap; i++)
+            if (table->buckets[i].pid > 0) insert_sample(&grown, &table->buckets[i]);
+        free(table->buckets);
+        *table = grown;
+    }
+    unsigned int i = hash_pid(sample->pid, table->cap);
+    while (table->buckets[i].pid != 0) i = (i + 1) & (table->cap - 1);
+    table->buckets[i] = *sample;
+    table->count++;
+    return &table->buckets[i];
+}
+
+static void close_sample(sample_t *sample) {
+    for (int i = 0; i < NUM_PROC_FILES; i++)
+        if (sample->fds[i] != -1) {
+            close(sample->fds[i]);
+            sample->fds[i] = -1;
+            kept_fds--;
+        }
+}
+
+static void free_table(sample_table_t *table) {
+    for (int i = 0; i < table->cap; i++)
+        if (table->buckets[i].pid > 0) close_sample(&table->buckets[i]);
+    free(table->buckets);
+    table->buckets = NULL;
+    table->cap = table->count = 0;
+}
+
+// Read a file of a process into buf with one pread, keeping it open while there are descriptors to spare.
+static ssize_t read_proc_file(sample_t *sample, enum proc_file file) {
+    int fd = sample->fds[file];
+    if (fd == -1) {
+        char path[64];
+        snprintf(path, sizeof(path), proc_file_path[file], sample->pid, sample->pid);
+        if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return -1;
+        if (kept_fds < fd_budget) {
+            sample->fds[file] = fd;
+            kept_fds++;
+        }
+    }
+    if (buf_cap == 0) buf = malloc(buf_cap = 4096);
+    ssize_t n;
+    // A list of children that fills the buffer is read again into a larger one.
+    while ((n = pread(fd, buf, buf_cap - 1, 0)) == (ssize_t) buf_cap - 1) buf = realloc(buf, buf_cap *= 2);
+    if (sample->fds[file] != fd) close(fd);
+    if (n >= 0) buf[n] = '\0';
+    return n;
+}
+
+static void push_pending(pid_t pid) {
+    if (pending_count == pending_cap) {
+        pending_cap = pending_cap ? pending_cap * 2 : 64;
+        pending = realloc(pending, sizeof(pid_t) * pending_cap);
+    }
+    pending[pending_count++] = pid;
+}
+
+static unsigned long long boot_ticks(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return now.tv_sec * sysconf(_SC_CLK_TCK) + now.tv_nsec / (1000000000 / sysconf(_SC_CLK_TCK));
+}
+
+/*
+ * Function: sample_process
+ * ------------------------
+ *   Read the files of a process, add its usage since the last sample to the row of its job,
+ *   and queue its children.
+ *
+ *   sample: the sample of the process (new, or the last one)
+ *   fresh: whether the process has no last sample
+ *   since: the time of the last sample (in clock ticks after boot)
+ *   pgrp: the process group of the job (0 without job control)
+ *   row: the row of the job
+ *
+ *   returns: 0 on success, -1 if the process is gone or not in the process group of the job
+ */
+static int sample_process(sample_t *sample, int fresh, unsigned long long since, pid_t pgrp, row_t *row) {
+    if (read_proc_file(sample, PROC_STAT) <= 0) return -1;
+    // The command name may contain spaces and parentheses, the fields start after the last ')'.
+    char *fields = strrchr(buf, ')');
+    int group;
+    unsigned long long utime, stime, start;
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu",
+                                 &group, &utime, &stime, &start) != 4) return -1;
+    if (pgrp != 0 && group != pgrp) return -1;
+    if (!fresh && start != sample->start) return -1;
+    unsigned long long read = 0, written = 0;
+    if (read_proc_file(sample, PROC_IO) > 0) sscanf(buf, "rchar: %llu wchar: %llu", &read, &written);
+    if (fresh) {
+        // A process started since the last sample did all its work in the interval.
+        int recent = start >= since;
+        sample->cpu = recent ? 0 : utime + stime;
+        sample->read = recent ? 0 : read;
+        sample->written = recent ? 0 : written;
+        sample->start = start;
+    }
+    row->procs++;
+    row->cpu += utime + stime - sample->cpu;
+    row->read += read - sample->read;
+    row->written += written - sample->written;
+    sample->cpu = utime + stime;
+    sample->read = read;
+    sample->written = written;
+    unsigned long resident;
+    if (read_proc_file(sample, PROC_STATM) > 0 && sscanf(buf, "%*u %lu", &resident) == 1)
+        row->rss += (double) resident * sysconf(_SC_PAGESIZE);
+    if (read_proc_file(sample, PROC_CHILDREN) > 0)
+        for (char *p = buf, *end;; p = end) {
+            long child = strtol(p, &end, 10);
+            if (end == p) break;
+            push_pending(child);
+        }
+    return 0;
+}
+
+/*
+ * Function: sample_jobs
+ * ---------------------
+ *   Sample the processes of all the jobs into a new table, and close the files of the
+ *   processes of the last table that are gone.
+ *
+ *   returns: the number of rows (one per job)
+ */
+static int sample_jobs(job_list_t *job_list, sample_table_t *table, unsigned long long since, row_t **rows, int *rows_cap) {
+    sample_table_t next = {NULL, 0, 0};
+    int num_rows = 0;
+    for (job_t *job = next_job(job_list, NULL); job != NULL; job = next_job(job_list, job)) {
+        if (num_rows == *rows_cap) {
+            *rows_cap = *rows_cap ? *rows_cap * 2 : 16;
+            *rows = realloc(*rows, sizeof(row_t) * *rows_cap);
+        }
+        row_t *row = &(*rows)[num_rows++];
+        memset(row, 0, sizeof(row_t));
+        row->job = job;
+        pending_count = 0;
+        for (int i = 0; i < job->num_procs; i++)
+            if (job->procs[i].state != PROC_DONE) push_pending(job->procs[i].pid);
+        while (pending_count > 0) {
+            pid_t pid = pending[--pending_count];
+            if (find_sample(&next, pid) != NULL) continue;
+            sample_t *last = find_sample(table, pid), sample = {pid, 0, {-1, -1, -1, -1}, 0, 0, 0};
+            if (last != NULL) {
+                sample = *last;
+                last->pid = -1;
+            }
+            // The last sample may be of a process that had the same ID.
+            int fresh = last == NULL;
+            if (!fresh && sample_process(&sample, 0, since, job_control ? job->pid : 0, row) == -1) {
+                close_sample(&sample);
+                fresh = 1;
+            }
+            if (fresh && sample_process(&sample, 1, since, job_control ? job->pid : 0, row) == -1) {
+                close_sample(&sample);
+                continue;
+            }
+            insert_sample(&next, &sample);
+        }
+    }
+    free_table(table);
+    *table = next;
+    return num_rows;
+}
+
+static int compare_rows(const void *a, const void *b) {
+    const row_t *x = a, *y = b;
+    if (x->cpu != y->cpu) return x->cpu < y->cpu ? 1 : -1;
+    return x->job->pgid - y->job->pgid;
+}
+
+static const char *format_size(double bytes, char *str, size_t size) {
+    const char units[] = "BKMGT";
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(str, size, unit == 0 ? "%.0f%c" : "%.1f%c", bytes, units[unit]);
+    return str;
+}
+
+/*
+ * Function: print_table
+ * ---------------------
+ *   Print the rows of the jobs, busiest first, each cut to the width of the terminal (0 for no terminal).
+ *
+ *   returns: the number of lines printed
+ */
+static int print_table(FILE *out, row_t *rows, int num_rows, double elapsed, int max_rows, int width) {
+    char line[4096], id[16], rss[16], read[16], written[16];
+    qsort(rows, num_rows, sizeof(row_t), compare_rows);
+    if (width <= 0 || width > (int) sizeof(line)) width = sizeof(line);
+    int lines = 1;
+    snprintf(line, width, "%-6s %7s %-8s %5s %6s %8s %8s %8s %s", "JOB", "PID", "STATE", "PROCS", "CPU%", "RSS", "READ/s", "WRITE/s", "COMMAND");
+    fprintf(out, "%s\n", line);
+    for (int i = 0; i < num_rows; i++) {
+        if (max_rows > 0 && i == max_rows - 1 && num_rows > max_rows) {
+            fprintf(out, "... and %d more jobs\n", num_rows - i);
+            return lines + 1;
+        }
+        row_t *row = &rows[i];
+        snprintf(id, sizeof(id), "[%d]", row->job->pgid);
+        snprintf(line, width, "%-6s %7d %-8s %5d %6.1f %8s %8s %8s %s", id, row->job->pid, job_state_str[row->job->state],
+                 row->procs, row->cpu * 100 / sysconf(_SC_CLK_TCK) / elapsed, format_size(row->rss, rss, sizeof(rss)),
+                 format_size(row->read / elapsed, read, sizeof(read)), format_size(row->written / elapsed, written, sizeof(written)),
+                 row->job->cmd);
+        fprintf(out, "%s\n", line);
+        lines++;
+    }
+    return lines;
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Whether a process of a job may still run without the user (stopped and queued jobs wait for bg, fg or a slot).
+static int any_running(job_list_t *job_list) {
+    for (job_t *job = next_job(job_list, NULL); job != NULL; job = next_job(job_list, job))
+        if (job->state == FOREGROUND || job->state == BACKGROUND) return 1;
+    return 0;
+}
+
+void watch_jobs(job_list_t *job_list, int interval_ms) {
+    // The table is redrawn in place on a terminal, where a key stops it.
+    reader_t *keys = has_terminal && stdin_reader != NULL && stdin_reader->pollable && isatty(STDOUT_FILENO) ? stdin_reader : NULL;
+    struct termios cooked, raw;
+    if (keys != NULL && tcgetattr(keys->fd, &cooked) == 0) {
+        raw = cooked;
+        raw.c_lflag &= ~(ECHO | ICANON | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(keys->fd, TCSADRAIN, &raw);
+        event_mod(keys->fd, EPOLLIN);
+        // Hide the cursor.
+        printf("Every %.1fs, press a key to stop\n\033[?25l", interval_ms / 1e3);
+        fflush(stdout);
+    }
+    else keys = NULL;
+    fd_budget = sysconf(_SC_OPEN_MAX) - MONITOR_RESERVED_FDS;
+    sample_table_t table = {NULL, 0, 0};
+    row_t *rows = NULL;
+    int rows_cap = 0, drawn = 0, stop = 0;
+    unsigned long long since = boot_ticks();
+    double last = now_seconds();
+    sample_jobs(job_list, &table, since, &rows, &rows_cap);
+    while (!stop && job_list->size > 0) {
+        // Run the event loop until the next sample (jobs are reaped in between).
+        double due = last + interval_ms / 1e3, now;
+        while ((now = now_seconds()) < due) {
+            event_run((int) ((due - now) * 1000) + 1);
+            if (keys != NULL && (keys->ready || keys->start < keys->end)) {
+                stop = 1;
+                break;
+            }
+        }
+        if (stop) break;
+        unsigned long long ticks = boot_ticks();
+        int num_rows = sample_jobs(job_list, &table, since, &rows, &rows_cap);
+        since = ticks;
+        // The last jobs finished while waiting.
+        if (num_rows == 0) break;
+        // Format the whole table first, so it reaches the terminal in one write.
+        char *frame;
+        size_t size;
+        FILE *out = open_memstream(&frame, &size);
+        if (out == NULL) break;
+        if (keys != NULL) {
+            struct winsize ws;
+            int tty_size = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0;
+            // Go back to the first line of the last table and clear it.
+            if (drawn > 0) fprintf(out, "\033[%dF\033[J", drawn);
+            drawn = print_table(out, rows, num_rows, now - last, tty_size ? ws.ws_row - 2 : 24, tty_size ? ws.ws_col : 80);
+        }
+        else {
+            if (drawn++ > 0) fprintf(out, "\n");
+            print_table(out, rows, num_rows, now - last, 0, 0);
+        }
+        fclose(out);
+        fwrite(frame, 1, size, stdout);
+        fflush(stdout);
+        free(frame);
+        last = now;
+        // Without a key to stop it, the watch would wait forever for stopped jobs.
+        if (keys == NULL && !any_running(job_list)) break;
+    }
+    free_table(&table);
+    free(rows);
+    if (keys != NULL) {
+        // The key only stops the watch.
+        if (stop) read_byte(keys);
+        tcflush(keys->fd, TCIFLUSH);
+        event_mod(keys->fd, 0);
+        keys->ready = 0;
+        tcsetattr(keys->fd, TCSADRAIN, &cooked);
+        printf("\033[?25h");
+        fflush(stdout);
+    }
+}
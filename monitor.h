@@ -0,0 +1,36 @@
+#include "job_control.h"
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+// Files of /proc/<pid> read at each sample.
+enum proc_file {
+    PROC_STAT, PROC_STATM, PROC_IO, PROC_CHILDREN, NUM_PROC_FILES
+};
+
+// Descriptors the monitor keeps open below the limit of open files of the shell (the others are reopened at each sample).
+#define MONITOR_RESERVED_FDS 64
+
+/*
+ * Function: watch_jobs
+ * --------------------
+ *   Show what the jobs are doing ("jobs --watch [interval]"): at every interval, sample
+ *   /proc/<pid>/stat, statm and io for each process of the jobs (their pipeline stages and
+ *   the descendants of these in the process group of the job, found through
+ *   /proc/<pid>/task/<pid>/children, so the rest of the process table is never scanned)
+ *   and print the CPU usage, resident memory and bytes read and written per second of
+ *   each job, busiest first. The files of a process stay open between the samples, and
+ *   are read with one pread each.
+ *
+ *   On a terminal, the table is redrawn in place until a key is pressed, and only the
+ *   jobs that fit on the screen are shown. Otherwise a table is printed at every interval,
+ *   until none of the jobs is running (e.g. they are all stopped). It stops once there are
+ *   no jobs left. The event loop keeps running in between, so
+ *   jobs are reaped and dispatched as usual.
+ *
+ *   job_list: the job list
+ *   interval_ms: the time between two samples, in ms
+ */
+void watch_jobs(job_list_t *job_list, int interval_ms);
+
+#endif
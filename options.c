@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "admission.h"
+#include "affinity.h"
+#include "capture.h"
+#include "expand.h"
+#include "options.h"
+#include "spawn.h"
+#include "utilities.h"
+#include "watchdog.h"
+
+static const option_t options[] = {
+    {"autopin", OPT_BOOL, &autopin, NULL, 0},
+    {"capture", OPT_BOOL, &capture_jobs, NULL, 0},
+    {"capture_overflow", OPT_CHOICE, &capture_overflow, capture_overflow_str, 2},
+    {"capture_size", OPT_INT, &capture_size, NULL, 0},
+    {"glob_cache", OPT_BOOL, &glob_cache, NULL, 0},
+    {"max_jobs", OPT_INT, &max_jobs, NULL, 0},
+    {"max_load", OPT_INT, &max_load, NULL, 0},
+    {"max_mem_pressure", OPT_INT, &max_mem_pressure, NULL, 0},
+    {"pipe_size", OPT_INT, &pipe_size, NULL, 0},
+    {"spawn", OPT_CHOICE, &spawn_backend, spawn_backend_str, 3},
+    {"timeout_grace", OPT_INT, &timeout_grace, NULL, 0},
+    {"utilities", OPT_BOOL, &use_utilities, NULL, 0},
+};
+#define NUM_OPTIONS (sizeof(options) / sizeof(options[0]))
+
+static int parse_int(const char *value, int *result) {
+    char *end;
+    long long n = strtoll(value, &end, 10);
+    if (end == value) return -1;
+    if (*end == 'K' || *end == 'k') n <<= 10, end++;
+    else if (*end == 'M' || *end == 'm') n <<= 20, end++;
+    else if (*end == 'G' || *end == 'g') n <<= 30, end++;
+    if (*end != '\0' || n < 0 || n > 0x7fffffff) return -1;
+    *result = (int) n;
+    return 0;
+}
+
+int set_option(const char *name, const char *value) {
+    for (int i = 0; i < NUM_OPTIONS; i++) {
+        const option_t *opt = &options[i];
+        if (strcmp(opt->name, name) != 0) continue;
+        switch (opt->type) {
+            case OPT_BOOL:
+                if (strcmp(value, "on") == 0) *opt->value = 1;
+                else if (strcmp(value, "off") == 0) *opt->value = 0;
+                else return -1;
+                return 0;
+            case OPT_INT:
+                return parse_int(value, opt->value);
+            case OPT_CHOICE:
+                for (int j = 0; j < opt->num_choices; j++)
+                    if (strcmp(opt->choices[j], value) == 0) {
+                        *opt->value = j;
+                        return 0;
+                    }
+                return -1;
+        }
+    }
+    return -1;
+}
+
+void print_options(void) {
+    for (int i = 0; i < NUM_OPTIONS; i++) {
+        const option_t *opt = &options[i];
+        if (opt->type == OPT_BOOL) printf("%s %s\n", opt->name, *opt->value ? "on" : "off");
+        else if (opt->type == OPT_INT) printf("%s %d\n", opt->name, *opt->value);
+        else printf("%s %s\n", opt->name, opt->choices[*opt->value]);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+enum option_type {
+    OPT_BOOL, OPT_INT, OPT_CHOICE
+};
+
+typedef struct {
+    // Option name.
+    const char *name;
+    // Option type.
+    enum option_type type;
+    // Pointer to the variable holding the value.
+    int *value;
+    // Names of the values of a choice option (indexed by value).
+    const char **choices;
+    int num_choices;
+} option_t;
+
+/*
+ * Function: set_option
+ * --------------------
+ *   Set a shell option.
+ *   Boolean options take on/off, integer options take a number (with an optional K, M or G suffix),
+ *   and choice options take one of their value names.
+ *
+ *   name: the option name
+ *   value: the new value
+ *
+ *   returns: 0 on success, -1 if the option or the value is invalid
+ */
+int set_option(const char *name, const char *value);
+
+/*
+ * Function: print_options
+ * -----------------------
+ *   Print all the shell options and their values.
+ */
+void print_options(void);
+
+#endif
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "path_cache.h"
+#include "stats.h"
+#include "utils.h"
+
+typedef struct {
+    // Command name (points into path).
+    const char *name;
+    // Absolute path of the executable.
+    char *path;
+    // Index of the search directory the command was found in.
+    int dir;
+    // Number of lookups served by this entry.
+    unsigned int hits;
+} cache_entry_t;
+
+typedef struct {
+    // Directory path, always ending with a slash.
+    char *path;
+    int len;
+    // Modification time when the directory was last checked.
+    struct timespec mtime;
+} search_dir_t;
+
+static cache_entry_t *table = NULL;
+static unsigned int table_cap = 0, table_size = 0;
+static search_dir_t *dirs = NULL;
+static int dir_count = 0;
+// Copy of the PATH the directories were built from (NULL if PATH is unset).
+static char *cached_path_env = NULL;
+static int dirs_valid = 0;
+static long long last_check_ms = 0;
+
+static unsigned int hash_name(const char *name) {
+    // FNV-1a.
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void get_mtime(search_dir_t *dir) {
+    struct stat st;
+    if (stat(dir->path, &st) == 0) dir->mtime = st.st_mtim;
+    else dir->mtime.tv_sec = dir->mtime.tv_nsec = 0;
+}
+
+static void clear_table(void) {
+    for (unsigned int i = 0; i < table_cap; i++) {
+        free(table[i].path);
+        table[i].path = NULL;
+    }
+    table_size = 0;
+}
+
+// Remove every entry found in a directory at or after index dir, since a new file in dir may now shadow them.
+static void drop_entries_from(int dir) {
+    cache_entry_t *old = table;
+    unsigned int old_cap = table_cap;
+    table = calloc(table_cap, sizeof(cache_entry_t));
+    table_size = 0;
+    for (unsigned int i = 0; i < old_cap; i++) {
+        if (old[i].path == NULL) continue;
+        if (old[i].dir >= dir) {
+            free(old[i].path);
+            continue;
+        }
+        unsigned int j = hash_name(old[i].name) & (table_cap - 1);
+        while (table[j].path != NULL) j = (j + 1) & (table_cap - 1);
+        table[j] = old[i];
+        table_size++;
+    }
+    free(old);
+}
+
+static void free_dirs(void) {
+    for (int i = 0; i < dir_count; i++) free(dirs[i].path);
+    free(dirs);
+    dirs = NULL;
+    dir_count = 0;
+}
+
+static void add_dir(const char *path, int len) {
+    // An empty PATH component means the current directory.
+    if (len == 0) {
+        path = ".";
+        len = 1;
+    }
+    search_dir_t *dir = &dirs[dir_count++];
+    dir->path = malloc(len + 2);
+    memcpy(dir->path, path, len);
+    if (path[len - 1] != '/') dir->path[len++] = '/';
+    dir->path[len] = '\0';
+    dir->len = len;
+    get_mtime(dir);
+}
+
+static void build_dirs(const char *path_env) {
+    free_dirs();
+    free(cached_path_env);
+    cached_path_env = path_env != NULL ? strdup(path_env) : NULL;
+    if (path_env == NULL) {
+        // Fall back to the default program directories.
+        dirs = malloc(sizeof(search_dir_t) * 2);
+        for (int i = 0; i < 2; i++) add_dir(prog_dir[i], strlen(prog_dir[i]));
+    }
+    else {
+        int n = 1;
+        for (const char *p = path_env; *p; p++) if (*p == ':') n++;
+        dirs = malloc(sizeof(search_dir_t) * n);
+        const char *start = path_env;
+        while (1) {
+            const char *end = strchrnul(start, ':');
+            add_dir(start, end - start);
+            if (*end == '\0') break;
+            start = end + 1;
+        }
+    }
+    clear_table();
+    dirs_valid = 1;
+    last_check_ms = now_ms();
+}
+
+// Make sure the search directories and the entries derived from them are up to date.
+static void validate(void) {
+    const char *path_env = getenv("PATH");
+    if (!dirs_valid || (path_env == NULL) != (cached_path_env == NULL)
+        || (path_env != NULL && strcmp(path_env, cached_path_env) != 0)) {
+        build_dirs(path_env);
+        return;
+    }
+    long long now = now_ms();
+    if (now - last_check_ms < PATH_CACHE_TTL_MS) return;
+    last_check_ms = now;
+    for (int i = 0; i < dir_count; i++) {
+        struct timespec old = dirs[i].mtime;
+        get_mtime(&dirs[i]);
+        if (old.tv_sec != dirs[i].mtime.tv_sec || old.tv_nsec != dirs[i].mtime.tv_nsec) {
+            // Refresh the remaining directories too, then drop everything that may be stale.
+            for (int j = i + 1; j < dir_count; j++) get_mtime(&dirs[j]);
+            drop_entries_from(i);
+            break;
+        }
+    }
+}
+
+static void grow_table(void) {
+    cache_entry_t *old = table;
+    unsigned int old_cap = table_cap;
+    table_cap = table_cap ? table_cap * 2 : 64;
+    table = calloc(table_cap, sizeof(cache_entry_t));
+    for (unsigned int i = 0; i < old_cap; i++) {
+        if (old[i].path == NULL) continue;
+        unsigned int j = hash_name(old[i].name) & (table_cap - 1);
+        while (table[j].path != NULL) j = (j + 1) & (table_cap - 1);
+        table[j] = old[i];
+    }
+    free(old);
+}
+
+const char *path_cache_lookup(const char *name) {
+    validate();
+    if (table_cap == 0) grow_table();
+    unsigned int h = hash_name(name);
+    unsigned int i = h & (table_cap - 1);
+    while (table[i].path != NULL) {
+        if (strcmp(table[i].name, name) == 0) {
+            table[i].hits++;
+            return table[i].path;
+        }
+        i = (i + 1) & (table_cap - 1);
+    }
+    // Not cached yet: probe the search directories in order.
+    int name_len = strlen(name);
+    char probe[PATH_MAX];
+    for (int d = 0; d < dir_count; d++) {
+        if (dirs[d].len + name_len >= PATH_MAX) continue;
+        memcpy(probe, dirs[d].path, dirs[d].len);
+        memcpy(probe + dirs[d].len, name, name_len + 1);
+        struct stat st;
+        stat_add(STAT_PATH_PROBES, 1);
+        if (stat(probe, &st) == 0 && !S_ISDIR(st.st_mode) && access(probe, X_OK) == 0) {
+            char *path = strdup(probe);
+            // Keep the load factor below 1/2.
+            if ((table_size + 1) * 2 > table_cap) {
+                grow_table();
+                i = h & (table_cap - 1);
+                while (table[i].path != NULL) i = (i + 1) & (table_cap - 1);
+            }
+            table[i].path = path;
+            table[i].name = path + dirs[d].len;
+            table[i].dir = d;
+            table[i].hits = 1;
+            table_size++;
+            return path;
+        }
+        stat_add(STAT_PATH_PROBE_MISSES, 1);
+    }
+    return NULL;
+}
+
+const char *path_cache_dir(int i) {
+    validate();
+    return i < dir_count ? dirs[i].path : NULL;
+}
+
+void path_cache_chdir(void) {
+    // A relative directory ("." or an empty PATH entry) is now another one: its entries are wrong,
+    // and a command in it may shadow the entries of the directories after it.
+    for (int i = 0; i < dir_count; i++) {
+        if (dirs[i].path[0] == '/') continue;
+        for (int j = i; j < dir_count; j++) get_mtime(&dirs[j]);
+        drop_entries_from(i);
+        return;
+    }
+}
+
+void path_cache_reset(void) {
+    clear_table();
+    dirs_valid = 0;
+}
+
+void path_cache_print(void) {
+    if (table_size == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (unsigned int i = 0; i < table_cap; i++)
+        if (table[i].path != NULL) printf("%4u\t%s\n", table[i].hits, table[i].path);
+}
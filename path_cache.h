@@ -0,0 +1,58 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+// Minimum time between two checks of the search directories' mtimes.
+#define PATH_CACHE_TTL_MS 1000
+
+/*
+ * Function: path_cache_lookup
+ * ---------------------------
+ *   Resolve a command name to the path of an executable in one of the
+ *   search directories ($PATH, or prog_dir if PATH is not set).
+ *   Resolved names are remembered in a hash table, so only the first lookup of
+ *   a command probes the file system. Entries are dropped when the mtime of a
+ *   search directory changes, when PATH itself changes, and (for the relative
+ *   search directories) when the current directory changes. Only files with the
+ *   execute permission are found.
+ *
+ *   name: the command name (without a slash)
+ *
+ *   returns: the path (owned by the cache), or NULL if not found
+ */
+const char *path_cache_lookup(const char *name);
+
+/*
+ * Function: path_cache_dir
+ * ------------------------
+ *   Get a search directory ($PATH, or prog_dir if PATH is not set), in search order.
+ *
+ *   i: the index of the directory
+ *
+ *   returns: the directory path ending with a slash (owned by the cache, valid until
+ *            PATH changes), or NULL if there are fewer directories
+ */
+const char *path_cache_dir(int i);
+
+/*
+ * Function: path_cache_chdir
+ * --------------------------
+ *   Drop the entries found in a relative search directory, or in one after it,
+ *   once the current directory has changed.
+ */
+void path_cache_chdir(void);
+
+/*
+ * Function: path_cache_reset
+ * --------------------------
+ *   Forget all the remembered command locations.
+ */
+void path_cache_reset(void);
+
+/*
+ * Function: path_cache_print
+ * --------------------------
+ *   Print the remembered command locations and their hit counts.
+ */
+void path_cache_print(void);
+
+#endif
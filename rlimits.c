@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rlimits.h"
+
+static const char *limit_names[NUM_JOB_LIMITS] = {"as", "cpu", "nofile", "nproc"};
+static const int limit_resources[NUM_JOB_LIMITS] = {RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, RLIMIT_NPROC};
+
+job_limits_t bg_limits = {0};
+
+int parse_limit(const char *arg, job_limits_t *limits) {
+    const char *eq = strchr(arg, '=');
+    if (eq == NULL) return -1;
+    for (int i = 0; i < NUM_JOB_LIMITS; i++) {
+        if (strlen(limit_names[i]) != eq - arg || strncmp(arg, limit_names[i], eq - arg) != 0) continue;
+        const char *value = eq + 1;
+        if (strcmp(value, "unlimited") == 0) {
+            limits->mask &= ~(1 << i);
+            limits->values[i] = RLIM_INFINITY;
+            return 0;
+        }
+        char *end;
+        unsigned long long n = strtoull(value, &end, 10);
+        if (end == value || *value == '-') return -1;
+        if (*end == 'K' || *end == 'k') n <<= 10, end++;
+        else if (*end == 'M' || *end == 'm') n <<= 20, end++;
+        else if (*end == 'G' || *end == 'g') n <<= 30, end++;
+        if (*end != '\0') return -1;
+        limits->mask |= 1 << i;
+        limits->values[i] = n;
+        return 0;
+    }
+    return -1;
+}
+
+void merge_limits(job_limits_t *dst, const job_limits_t *src) {
+    for (int i = 0; i < NUM_JOB_LIMITS; i++)
+        if ((src->mask & (1 << i)) && !(dst->mask & (1 << i))) {
+            dst->mask |= 1 << i;
+            dst->values[i] = src->values[i];
+        }
+}
+
+void apply_limits(const job_limits_t *limits) {
+    for (int i = 0; i < NUM_JOB_LIMITS; i++) {
+        if (!(limits->mask & (1 << i))) continue;
+        // The hard limit keeps the job from raising its own limit again.
+        struct rlimit rl = {limits->values[i], limits->values[i]};
+        setrlimit(limit_resources[i], &rl);
+    }
+}
+
+int set_process_limits(pid_t pid, const job_limits_t *limits) {
+    for (int i = 0; i < NUM_JOB_LIMITS; i++) {
+        if (!(limits->mask & (1 << i))) continue;
+        struct rlimit rl = {limits->values[i], limits->values[i]};
+        if (prlimit(pid, limit_resources[i], &rl, NULL) == -1) return -1;
+    }
+    return 0;
+}
+
+char *format_limits(const job_limits_t *limits, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < NUM_JOB_LIMITS && len < size; i++) {
+        if (!(limits->mask & (1 << i))) continue;
+        unsigned long long n = limits->values[i];
+        const char *suffix = "";
+        // Print sizes with the largest suffix that divides them.
+        if (i == LIMIT_AS && n != 0) {
+            if (n % (1 << 30) == 0) n >>= 30, suffix = "G";
+            else if (n % (1 << 20) == 0) n >>= 20, suffix = "M";
+            else if (n % (1 << 10) == 0) n >>= 10, suffix = "K";
+        }
+        len += snprintf(buf + len, size - len, "%s%s=%llu%s", len ? " " : "", limit_names[i], n, suffix);
+    }
+    return buf;
+}
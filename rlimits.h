@@ -0,0 +1,79 @@
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#ifndef RLIMITS_H
+#define RLIMITS_H
+
+enum job_limit {
+    LIMIT_AS, LIMIT_CPU, LIMIT_NOFILE, LIMIT_NPROC, NUM_JOB_LIMITS
+};
+
+typedef struct {
+    // Bit i is set if limit i is set.
+    int mask;
+    // Values of the limits (bytes for as, seconds for cpu, counts for nofile and nproc).
+    rlim_t values[NUM_JOB_LIMITS];
+} job_limits_t;
+
+// Limits applied to every background job (set with "limit -b name=value ...").
+extern job_limits_t bg_limits;
+
+/*
+ * Function: parse_limit
+ * ---------------------
+ *   Parse a "name=value" limit (as, cpu, nofile or nproc) into a set of limits.
+ *   The value takes an optional K, M or G suffix, and "unlimited" clears the limit.
+ *
+ *   arg: the limit
+ *   limits: the set of limits to update
+ *
+ *   returns: 0 on success, -1 if the name or the value is invalid
+ */
+int parse_limit(const char *arg, job_limits_t *limits);
+
+/*
+ * Function: merge_limits
+ * ----------------------
+ *   Add the limits of src that are not set in dst to dst.
+ *
+ *   dst: the limits to complete
+ *   src: the limits to take missing values from
+ */
+void merge_limits(job_limits_t *dst, const job_limits_t *src);
+
+/*
+ * Function: apply_limits
+ * ----------------------
+ *   Set the soft and hard limits of the calling process (meant for a child before exec).
+ *
+ *   limits: the limits
+ */
+void apply_limits(const job_limits_t *limits);
+
+/*
+ * Function: set_process_limits
+ * ----------------------------
+ *   Change the limits of a running process with prlimit.
+ *   Lowering a limit always works, raising it above the hard limit requires CAP_SYS_RESOURCE.
+ *
+ *   pid: the process ID
+ *   limits: the limits to change (only the ones that are set)
+ *
+ *   returns: 0 on success, -1 on error (with errno set)
+ */
+int set_process_limits(pid_t pid, const job_limits_t *limits);
+
+/*
+ * Function: format_limits
+ * -----------------------
+ *   Format the limits that are set as "name=value" words separated by spaces.
+ *
+ *   limits: the limits
+ *   buf: the output buffer
+ *   size: the size of the buffer
+ *
+ *   returns: buf
+ */
+char *format_limits(const job_limits_t *limits, char *buf, size_t size);
+
+#endif
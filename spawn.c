@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "job_control.h"
+#include "spawn.h"
+#include "stats.h"
+
+#define CHILD_STACK_SIZE (64 * 1024)
+
+extern char **environ;
+
+const char *spawn_backend_str[3] = {"fork", "posix_spawn", "vfork"};
+int spawn_backend = SPAWN_FORK;
+int pipe_size = 0;
+
+// Signals whose disposition the shell changes and the child has to get back.
+static const int child_signals[] = {SIGTSTP, SIGTTIN, SIGTTOU, SIGINT, SIGQUIT, SIGCHLD};
+#define NUM_CHILD_SIGNALS (sizeof(child_signals) / sizeof(child_signals[0]))
+
+typedef struct {
+    const char *path;
+    char **args;
+    const spawn_attr_t *attr;
+    // Time the clone call was started at.
+    long long start;
+    // Set by the child if execv fails (the memory is shared with the parent).
+    int error;
+} clone_args_t;
+
+/*
+ * Function: setup_child
+ * ---------------------
+ *   Prepare a freshly created child for execv: process group, terminal, signals and redirections.
+ */
+static void setup_child(const spawn_attr_t *attr) {
+    pid_t pid = getpid();
+    pid_t pgid = attr->pgid ? attr->pgid : pid;
+    if (attr->pgid != -1) {
+        // Establish child process group to avoid race (if the parent process has not done it yet).
+        setpgid(pid, pgid);
+        // If it is a foreground process, associate the process group with the terminal.
+        if (attr->foreground) tcsetpgrp(STDIN_FILENO, pgid);
+    }
+    // Restore default signals.
+    for (int i = 0; i < NUM_CHILD_SIGNALS; i++) signal(child_signals[i], SIG_DFL);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    // The pipe ends are close-on-exec, their duplicates are not.
+    if (attr->stdin_fd != -1) dup2(attr->stdin_fd, STDIN_FILENO);
+    if (attr->stdout_fd != -1) dup2(attr->stdout_fd, STDOUT_FILENO);
+    if (attr->stderr_fd != -1) dup2(attr->stderr_fd, STDERR_FILENO);
+    if (attr->limits != NULL) apply_limits(attr->limits);
+    if (attr->cpu != -1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(attr->cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (attr->nice != 0) nice(attr->nice);
+}
+
+static pid_t spawn_fork(const char *path, char **args, const spawn_attr_t *attr) {
+    long long start = stat_now();
+    // Fork a child process to execute the command.
+    pid_t pid = fork();
+    // Child process.
+    if (pid == 0) {
+        setup_child(attr);
+        // The statistics are in shared memory, so the child records its own fork to exec time.
+        stat_record(HIST_FORK_EXEC, stat_now() - start);
+        stat_add(STAT_EXECS, 1);
+        // Execute the command.
+        execv(path, args);
+        // If execv returns, it means there was an error.
+        stat_add(STAT_EXEC_FAILURES, 1);
+        perror("execv");
+        exit(-1);
+    }
+    // Error.
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    stat_add(STAT_FORKS, 1);
+    // Create the process group in the parent too (if the child has not done it yet).
+    if (attr->pgid != -1) setpgid(pid, attr->pgid ? attr->pgid : pid);
+    return pid;
+}
+
+static pid_t spawn_posix(const char *path, char **args, const spawn_attr_t *spawn) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t sigdef, mask;
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_setflags(&attr, (spawn->pgid != -1 ? POSIX_SPAWN_SETPGROUP : 0) | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    if (spawn->pgid != -1) posix_spawnattr_setpgroup(&attr, spawn->pgid);
+    sigemptyset(&sigdef);
+    for (int i = 0; i < NUM_CHILD_SIGNALS; i++) sigaddset(&sigdef, child_signals[i]);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+    // Hand over the terminal in the child, before execve, so it never runs in the background.
+    if (spawn->foreground && spawn->pgid != -1 && isatty(STDIN_FILENO)) posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+    if (spawn->stdin_fd != -1) posix_spawn_file_actions_adddup2(&actions, spawn->stdin_fd, STDIN_FILENO);
+    if (spawn->stdout_fd != -1) posix_spawn_file_actions_adddup2(&actions, spawn->stdout_fd, STDOUT_FILENO);
+    if (spawn->stderr_fd != -1) posix_spawn_file_actions_adddup2(&actions, spawn->stderr_fd, STDERR_FILENO);
+    pid_t pid;
+    long long start = stat_now();
+    // posix_spawn only returns once the child has called exec.
+    int err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+    stat_record(HIST_FORK_EXEC, stat_now() - start);
+    stat_add(STAT_FORKS, 1);
+    stat_add(STAT_EXECS, 1);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        stat_add(STAT_EXEC_FAILURES, 1);
+        fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+        return -1;
+    }
+    return pid;
+}
+
+static int clone_child(void *arg) {
+    clone_args_t *c = arg;
+    setup_child(c->attr);
+    stat_record(HIST_FORK_EXEC, stat_now() - c->start);
+    execv(c->path, c->args);
+    // The parent reports the error, it is still suspended until we exit.
+    c->error = errno;
+    _exit(127);
+}
+
+static pid_t spawn_vfork(const char *path, char **args, const spawn_attr_t *attr) {
+    static char *stack = NULL;
+    if (stack == NULL) {
+        stack = mmap(NULL, CHILD_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED) {
+            stack = NULL;
+            perror("mmap");
+            return -1;
+        }
+    }
+    clone_args_t c = {path, args, attr, stat_now(), 0};
+    // Block all signals so no shell handler runs in the child while it shares our memory.
+    sigset_t all, old;
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &old);
+    // The parent is suspended until the child calls execv or exits, so the stack can be reused.
+    pid_t pid = clone(clone_child, stack + CHILD_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, &c);
+    int clone_errno = errno;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (pid < 0) {
+        fprintf(stderr, "clone: %s\n", strerror(clone_errno));
+        return -1;
+    }
+    stat_add(STAT_FORKS, 1);
+    stat_add(STAT_EXECS, 1);
+    if (c.error != 0) {
+        stat_add(STAT_EXEC_FAILURES, 1);
+        fprintf(stderr, "execv: %s\n", strerror(c.error));
+        // Reap the failed child right away, it never becomes a job.
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+pid_t spawn_process(const char *path, char **args, const spawn_attr_t *attr) {
+    switch (spawn_backend) {
+        case SPAWN_POSIX_SPAWN:
+            // posix_spawn cannot set resource limits, the CPU affinity or the niceness in the child.
+            if (attr->limits != NULL || attr->cpu != -1 || attr->nice != 0) return spawn_vfork(path, args, attr);
+            return spawn_posix(path, args, attr);
+        case SPAWN_VFORK:
+            return spawn_vfork(path, args, attr);
+        default:
+            return spawn_fork(path, args, attr);
+    }
+}
+
+pid_t spawn_function(int (*func)(void *), void *arg, const spawn_attr_t *attr) {
+    // Do not let the child inherit (and print again) buffered output.
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setup_child(attr);
+        int status = func(arg);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    stat_add(STAT_FORKS, 1);
+    if (attr->pgid != -1) setpgid(pid, attr->pgid ? attr->pgid : pid);
+    return pid;
+}
+
+int make_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    // Larger pipes mean fewer context switches between high-throughput stages.
+    if (pipe_size > 0 && fcntl(fds[1], F_SETPIPE_SZ, pipe_size) == -1) perror("fcntl(F_SETPIPE_SZ)");
+    return 0;
+}
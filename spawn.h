@@ -0,0 +1,79 @@
+#include <sys/types.h>
+#include "rlimits.h"
+
+#ifndef SPAWN_H
+#define SPAWN_H
+
+enum spawn_backend {
+    SPAWN_FORK, SPAWN_POSIX_SPAWN, SPAWN_VFORK
+};
+extern const char *spawn_backend_str[3];
+// The backend used to launch external commands (selected with "set spawn <backend>").
+extern int spawn_backend;
+
+// Capacity requested for the pipes between pipeline stages (0 keeps the default, set with "set pipe_size <bytes>").
+extern int pipe_size;
+
+typedef struct {
+    // Process group to join, 0 to create a new one, or -1 to stay in the shell's (without job control).
+    pid_t pgid;
+    // Whether the process group gets the terminal.
+    int foreground;
+    // File descriptors to use as stdin, stdout and stderr, or -1 to inherit the shell's.
+    int stdin_fd, stdout_fd, stderr_fd;
+    // Resource limits to set before exec, or NULL for none.
+    const job_limits_t *limits;
+    // CPU to pin the process to, or -1 to keep the shell's affinity.
+    int cpu;
+    // Niceness to add to the shell's.
+    int nice;
+} spawn_attr_t;
+
+/*
+ * Function: spawn_process
+ * -----------------------
+ *   Start an external command in a child process.
+ *   The child is placed in its own process group (or in attr->pgid if non-zero, or in the shell's if -1),
+ *   gets the terminal if it runs in the foreground, has the default disposition
+ *   and an empty mask for all the signals the shell changes, gets the
+ *   redirected stdin, stdout and stderr, and gets the resource limits, CPU affinity and niceness.
+ *   The process is created with the backend selected in spawn_backend:
+ *     fork:        fork() followed by execv().
+ *     posix_spawn: posix_spawn() with POSIX_SPAWN_SETPGROUP and POSIX_SPAWN_SETSIGDEF
+ *                  (vfork is used instead when there are resource limits, a CPU or a niceness to set).
+ *     vfork:       clone(CLONE_VM | CLONE_VFORK), sharing the address space until execv().
+ *
+ *   path: the path of the executable
+ *   args: the arguments of the command
+ *   attr: the process group, terminal and redirection settings
+ *
+ *   returns: the process ID of the child, or -1 on error
+ */
+pid_t spawn_process(const char *path, char **args, const spawn_attr_t *attr);
+
+/*
+ * Function: spawn_function
+ * ------------------------
+ *   Fork a child process set up like spawn_process that runs a function
+ *   (e.g. a built-in command in a pipeline) and exits with its return value.
+ *
+ *   func: the function
+ *   arg: passed to the function
+ *   attr: the process group, terminal and redirection settings
+ *
+ *   returns: the process ID of the child, or -1 on error
+ */
+pid_t spawn_function(int (*func)(void *), void *arg, const spawn_attr_t *attr);
+
+/*
+ * Function: make_pipe
+ * -------------------
+ *   Create a close-on-exec pipe for a pipeline, grown to pipe_size bytes with F_SETPIPE_SZ if set.
+ *
+ *   fds: the read and write ends
+ *
+ *   returns: 0 on success, -1 on error
+ */
+int make_pipe(int fds[2]);
+
+#endif
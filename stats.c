@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "stats.h"
+
+typedef struct {
+    unsigned long count;
+    unsigned long long sum_ns;
+    unsigned long buckets[STAT_BUCKETS];
+} histogram_t;
+
+typedef struct {
+    unsigned long counters[NUM_STAT_COUNTERS];
+    histogram_t histograms[NUM_STAT_HISTOGRAMS];
+} stats_t;
+
+static const char *counter_names[NUM_STAT_COUNTERS] = {
+    "forks", "execs", "exec_failures", "path_probes", "path_probe_misses",
+    "sigchld", "sigchld_wakeups", "wait_calls", "jobs_added", "jobs_deleted",
+    "utilities"
+};
+static const char *histogram_names[NUM_STAT_HISTOGRAMS] = {"fork_exec", "fg_wait", "parse"};
+
+static stats_t local_stats;
+// Points to shared memory once stats_init has been called.
+static stats_t *stats = &local_stats;
+
+void stats_init(void) {
+    stats_t *shared = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    memcpy(shared, stats, sizeof(stats_t));
+    stats = shared;
+}
+
+void stat_add(enum stat_counter counter, unsigned long n) {
+    // Children update the shared memory concurrently with the shell.
+    __atomic_fetch_add(&stats->counters[counter], n, __ATOMIC_RELAXED);
+}
+
+long long stat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void stat_record(enum stat_histogram histogram, long long ns) {
+    histogram_t *h = &stats->histograms[histogram];
+    if (ns < 0) ns = 0;
+    // The bucket is the number of significant bits of the duration.
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= STAT_BUCKETS) bucket = STAT_BUCKETS - 1;
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+// Format a duration with a unit that keeps it short.
+static const char *format_ns(char *buf, double ns) {
+    if (ns < 1e3) sprintf(buf, "%.0fns", ns);
+    else if (ns < 1e6) sprintf(buf, "%.1fus", ns / 1e3);
+    else if (ns < 1e9) sprintf(buf, "%.1fms", ns / 1e6);
+    else sprintf(buf, "%.2fs", ns / 1e9);
+    return buf;
+}
+
+static unsigned long long bucket_limit(int bucket) {
+    return bucket == 0 ? 1 : 1ULL << bucket;
+}
+
+// Upper limit of the bucket that holds the given fraction of the samples.
+static unsigned long long percentile(const histogram_t *h, double fraction) {
+    unsigned long target = h->count * fraction, seen = 0;
+    for (int i = 0; i < STAT_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > target) return bucket_limit(i);
+    }
+    return bucket_limit(STAT_BUCKETS - 1);
+}
+
+static void print_table(void) {
+    for (int i = 0; i < NUM_STAT_COUNTERS; i++) printf("%-20s %lu\n", counter_names[i], stats->counters[i]);
+    if (stats->counters[STAT_SIGCHLD_WAKEUPS] > 0)
+        printf("%-20s %.2f\n", "waits_per_sigchld",
+               (double) stats->counters[STAT_WAIT_CALLS] / stats->counters[STAT_SIGCHLD_WAKEUPS]);
+    char a[32], b[32], c[32];
+    for (int i = 0; i < NUM_STAT_HISTOGRAMS; i++) {
+        const histogram_t *h = &stats->histograms[i];
+        printf("%s: %lu samples", histogram_names[i], h->count);
+        if (h->count == 0) {
+            printf("\n");
+            continue;
+        }
+        printf(", mean %s, p50 < %s, p99 < %s\n", format_ns(a, (double) h->sum_ns / h->count),
+               format_ns(b, percentile(h, 0.5)), format_ns(c, percentile(h, 0.99)));
+        for (int j = 0; j < STAT_BUCKETS; j++)
+            if (h->buckets[j] > 0)
+                printf("    %10s - %-10s %lu\n", format_ns(a, j == 0 ? 0 : bucket_limit(j - 1)),
+                       format_ns(b, bucket_limit(j)), h->buckets[j]);
+    }
+}
+
+static void print_json(void) {
+    printf("{\"counters\": {");
+    for (int i = 0; i < NUM_STAT_COUNTERS; i++)
+        printf("%s\"%s\": %lu", i ? ", " : "", counter_names[i], stats->counters[i]);
+    printf("}, \"histograms\": {");
+    for (int i = 0; i < NUM_STAT_HISTOGRAMS; i++) {
+        const histogram_t *h = &stats->histograms[i];
+        printf("%s\"%s\": {\"count\": %lu, \"sum_ns\": %llu, \"buckets\": [", i ? ", " : "",
+               histogram_names[i], h->count, h->sum_ns);
+        // Non-empty buckets as [upper limit in ns, count] pairs.
+        int first = 1;
+        for (int j = 0; j < STAT_BUCKETS; j++) {
+            if (h->buckets[j] == 0) continue;
+            printf("%s[%llu, %lu]", first ? "" : ", ", bucket_limit(j), h->buckets[j]);
+            first = 0;
+        }
+        printf("]}");
+    }
+    printf("}}\n");
+}
+
+void stats_print(int json) {
+    if (json) print_json();
+    else print_table();
+}
+
+void stats_reset(void) {
+    memset(stats, 0, sizeof(stats_t));
+}
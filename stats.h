@@ -0,0 +1,86 @@
+#ifndef STATS_H
+#define STATS_H
+
+enum stat_counter {
+    // Processes created (all spawn backends, including built-ins run as pipeline stages).
+    STAT_FORKS,
+    // Calls to exec, and the ones that failed.
+    STAT_EXECS, STAT_EXEC_FAILURES,
+    // Executables looked up in the search directories, and the lookups that found nothing there.
+    STAT_PATH_PROBES, STAT_PATH_PROBE_MISSES,
+    // SIGCHLD signals received, and the number of times the event loop woke up to handle them.
+    STAT_SIGCHLD, STAT_SIGCHLD_WAKEUPS,
+    // Calls to wait4 (including the ones that found nothing left to reap).
+    STAT_WAIT_CALLS,
+    // Jobs added to and deleted from the job list.
+    STAT_JOBS_ADDED, STAT_JOBS_DELETED,
+    // Utilities (echo, test, ...) run by the shell itself instead of an executable.
+    STAT_UTILITIES,
+    NUM_STAT_COUNTERS
+};
+
+enum stat_histogram {
+    // Time from the start of a process creation to the exec call.
+    HIST_FORK_EXEC,
+    // Time the shell spends waiting for a foreground job.
+    HIST_FG_WAIT,
+    // Time spent in parse_args for one line.
+    HIST_PARSE,
+    NUM_STAT_HISTOGRAMS
+};
+
+// Number of histogram buckets: bucket i holds durations in [2^(i-1), 2^i) nanoseconds.
+#define STAT_BUCKETS 64
+
+/*
+ * Function: stats_init
+ * --------------------
+ *   Move the statistics to memory shared with the children, so a forked child can
+ *   record its own exec. Before this is called, the statistics are only kept in the shell.
+ */
+void stats_init(void);
+
+/*
+ * Function: stat_add
+ * ------------------
+ *   Add to a counter (safe to call from a forked child).
+ *
+ *   counter: the counter
+ *   n: the amount to add
+ */
+void stat_add(enum stat_counter counter, unsigned long n);
+
+/*
+ * Function: stat_now
+ * ------------------
+ *   returns: the time on the monotonic clock, in nanoseconds
+ */
+long long stat_now(void);
+
+/*
+ * Function: stat_record
+ * ---------------------
+ *   Record a duration in a histogram (safe to call from a forked child).
+ *
+ *   histogram: the histogram
+ *   ns: the duration in nanoseconds
+ */
+void stat_record(enum stat_histogram histogram, long long ns);
+
+/*
+ * Function: stats_print
+ * ---------------------
+ *   Print the counters and the non-empty histogram buckets.
+ *
+ *   json: whether to print a JSON object instead of a table
+ */
+void stats_print(int json);
+
+/*
+ * Function: stats_reset
+ * ---------------------
+ *   Set all the counters and histograms back to zero.
+ */
+void stats_reset(void);
+
+#endif
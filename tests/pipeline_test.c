@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+// Tests of stopping and resuming a running multi-stage pipeline, driven through a pseudo-terminal
+// like a user at the keyboard (the shell only does job control on a terminal):
+//   stop_fg      Ctrl-Z stops every stage of the pipeline, and fg brings it back until it finishes
+//   stop_bg_fg   a stopped pipeline continued with bg keeps running, and fg waits for it to finish
+// Each test prints "ok <name>" or "FAIL <name>: <reason>", and the exit status is the number of failures.
+//
+// usage: pipeline_test <shell>
+
+#define TIMEOUT_MS 5000
+// Pipeline whose first stage runs for a while before the output goes through the other stages.
+#define PIPELINE "sh -c \"sleep %s; echo stage-done\" | tr a-z A-Z | cat\n"
+
+static int pty_fd;
+static pid_t shell_pid;
+// Output of the shell since the last match.
+static char out[65536];
+static size_t out_len;
+static const char *failure;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void send(const char *input) {
+    if (write(pty_fd, input, strlen(input)) == -1) perror("write");
+}
+
+// Read the output of the shell until text appears (or for ms, if text is NULL).
+// Returns the output up to and including the match, or NULL on timeout.
+static char *expect(const char *text, int ms) {
+    static char match[sizeof(out)];
+    long long deadline = now_ms() + ms;
+    while (1) {
+        out[out_len] = '\0';
+        char *found = text != NULL ? strstr(out, text) : NULL;
+        if (found != NULL) {
+            size_t len = found + strlen(text) - out;
+            memcpy(match, out, len);
+            match[len] = '\0';
+            out_len -= len;
+            memmove(out, out + len, out_len);
+            return match;
+        }
+        long long left = deadline - now_ms();
+        if (left <= 0) return NULL;
+        struct pollfd pfd = {pty_fd, POLLIN, 0};
+        if (poll(&pfd, 1, left) <= 0) continue;
+        ssize_t n = read(pty_fd, out + out_len, sizeof(out) - 1 - out_len);
+        // The shell exited (EIO on the master).
+        if (n <= 0) return NULL;
+        out_len += n;
+    }
+}
+
+// Run a command line and return what it printed before the next prompt.
+static char *run(const char *line) {
+    send(line);
+    return expect("\n> ", TIMEOUT_MS);
+}
+
+// State letter and process group of a process, from /proc/<pid>/stat (after the command name in parentheses).
+static char process_state(pid_t pid, pid_t *pgrp) {
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return '\0';
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char *paren = strrchr(buf, ')');
+    char state;
+    int ppid, group;
+    if (paren == NULL || sscanf(paren + 1, " %c %d %d", &state, &ppid, &group) != 3) return '\0';
+    if (pgrp != NULL) *pgrp = group;
+    return state;
+}
+
+// Check that every process in a process group is stopped (and that there is one).
+static int group_stopped(pid_t pgid) {
+    DIR *proc = opendir("/proc");
+    if (proc == NULL) return 0;
+    int count = 0, stopped = 0;
+    struct dirent *entry;
+    while ((entry = readdir(proc)) != NULL) {
+        pid_t pid = atoi(entry->d_name), pgrp;
+        if (pid <= 0) continue;
+        char state = process_state(pid, &pgrp);
+        if (state == '\0' || pgrp != pgid) continue;
+        count++;
+        stopped += state == 'T';
+    }
+    closedir(proc);
+    return count > 0 && stopped == count;
+}
+
+// Start the pipeline and stop it with Ctrl-Z. Returns its job id, and its pgid through pgid, or -1.
+static int start_and_stop(const char *seconds, pid_t *pgid) {
+    char line[128];
+    snprintf(line, sizeof(line), PIPELINE, seconds);
+    send(line);
+    // Let every stage start before the terminal sends SIGTSTP.
+    usleep(300000);
+    send("\x1a");
+    if (expect("\n> ", TIMEOUT_MS) == NULL) {
+        failure = "no prompt after Ctrl-Z";
+        return -1;
+    }
+    char *jobs = run("jobs\n");
+    char *entry = jobs != NULL ? strchr(jobs, '[') : NULL;
+    int id;
+    if (entry == NULL || sscanf(entry, "[%d] %d", &id, pgid) != 2 || strstr(entry, "Stopped") == NULL) {
+        failure = "the pipeline is not listed as stopped";
+        return -1;
+    }
+    // The shell tracks the stages, not their children (the sleep of sh), which may take a moment longer to stop.
+    long long deadline = now_ms() + TIMEOUT_MS;
+    while (!group_stopped(*pgid) && now_ms() < deadline) usleep(10000);
+    if (!group_stopped(*pgid)) {
+        failure = "a stage of the pipeline is still running";
+        return -1;
+    }
+    if (strstr(jobs, "STAGE-DONE") != NULL) {
+        failure = "the pipeline finished before it was stopped";
+        return -1;
+    }
+    return id;
+}
+
+// Bring a job to the foreground and check that it finishes with the output of the last stage.
+static int resume_fg(int id) {
+    char line[32];
+    snprintf(line, sizeof(line), "fg %%%d\n", id);
+    char *output = run(line);
+    if (output == NULL || strstr(output, "STAGE-DONE") == NULL) {
+        failure = "fg did not run the pipeline to its end";
+        return -1;
+    }
+    char *jobs = run("jobs\n");
+    if (jobs == NULL || strchr(jobs, '[') != NULL) {
+        failure = "the job is still listed after it finished";
+        return -1;
+    }
+    return 0;
+}
+
+static int test_stop_fg(void) {
+    pid_t pgid;
+    int id = start_and_stop("1", &pgid);
+    if (id == -1) return -1;
+    return resume_fg(id);
+}
+
+static int test_stop_bg_fg(void) {
+    pid_t pgid;
+    int id = start_and_stop("2", &pgid);
+    if (id == -1) return -1;
+    char line[32];
+    snprintf(line, sizeof(line), "bg %%%d\n", id);
+    if (run(line) == NULL) {
+        failure = "no prompt after bg";
+        return -1;
+    }
+    char *jobs = run("jobs\n");
+    if (jobs == NULL || strstr(jobs, "Running") == NULL) {
+        failure = "the pipeline is not running after bg";
+        return -1;
+    }
+    if (process_state(pgid, NULL) == 'T') {
+        failure = "the first stage is still stopped after bg";
+        return -1;
+    }
+    return resume_fg(id);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: pipeline_test <shell>\n");
+        return 2;
+    }
+    shell_pid = forkpty(&pty_fd, NULL, NULL, NULL);
+    if (shell_pid == -1) {
+        perror("forkpty");
+        return 2;
+    }
+    if (shell_pid == 0) {
+        // No line editor and no history file, so the output is plain.
+        setenv("TERM", "dumb", 1);
+        setenv("HISTFILE", "", 1);
+        execl(argv[1], argv[1], (char *) NULL);
+        perror(argv[1]);
+        _exit(127);
+    }
+    if (expect("> ", TIMEOUT_MS) == NULL) {
+        fprintf(stderr, "pipeline_test: no prompt from %s\n", argv[1]);
+        return 2;
+    }
+    struct {
+        const char *name;
+        int (*run)(void);
+    } tests[] = {{"stop_fg", test_stop_fg}, {"stop_bg_fg", test_stop_bg_fg}};
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        failure = NULL;
+        if (tests[i].run() == 0) printf("ok %s\n", tests[i].name);
+        else {
+            printf("FAIL %s: %s\n", tests[i].name, failure);
+            failures++;
+        }
+    }
+    send("exit\n");
+    kill(shell_pid, SIGHUP);
+    waitpid(shell_pid, NULL, 0);
+    return failures;
+}
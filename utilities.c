@@ -0,0 +1,514 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <langinfo.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "stats.h"
+#include "utilities.h"
+
+// Longest conversion specification (flags, width and precision) printed by the shell.
+#define SPEC_MAX 64
+
+int use_utilities = 1;
+
+static int true_utility(char **args);
+static int false_utility(char **args);
+static int echo_utility(char **args);
+static int printf_utility(char **args);
+static int pwd_utility(char **args);
+static int test_utility(char **args);
+
+const char *utility_cmd[NUM_UTILITIES] = {"[", "echo", "false", "printf", "pwd", "test", "true"};
+int (*const utility_func[NUM_UTILITIES])(char **args) = {
+    &test_utility, &echo_utility, &false_utility, &printf_utility, &pwd_utility, &test_utility, &true_utility
+};
+
+int find_utility(const char *cmd) {
+    if (!use_utilities) return -1;
+    for (int i = 0; i < NUM_UTILITIES; i++)
+        if (strcmp(cmd, utility_cmd[i]) == 0) return i;
+    return -1;
+}
+
+int run_utility(char **args) {
+    int status = utility_func[find_utility(args[0])](args);
+    if (status != UTILITY_EXEC) stat_add(STAT_UTILITIES, 1);
+    return status;
+}
+
+// Whether the only argument is --help or --version, which the real executables answer.
+static int asks_for_info(char **args) {
+    return args[1] != NULL && args[2] == NULL && (strcmp(args[1], "--help") == 0 || strcmp(args[1], "--version") == 0);
+}
+
+static int true_utility(char **args) {
+    return asks_for_info(args) ? UTILITY_EXEC : 0;
+}
+
+static int false_utility(char **args) {
+    return asks_for_info(args) ? UTILITY_EXEC : 1;
+}
+
+static int hex_value(char c) {
+    return isdigit((unsigned char) c) ? c - '0' : tolower((unsigned char) c) - 'a' + 10;
+}
+
+static int is_octal(char c) {
+    return c >= '0' && c <= '7';
+}
+
+// The character of a one-letter escape sequence (\n, \t, ...).
+static char escape_char(char c) {
+    switch (c) {
+        case 'a': return '\a';
+        case 'b': return '\b';
+        case 'e': return '\x1b';
+        case 'f': return '\f';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'v': return '\v';
+        default: return c;
+    }
+}
+
+/*
+ * Function: echo_escapes
+ * ----------------------
+ *   Print an argument of "echo -e": \0NNN and \NNN are octal, \xHH is hexadecimal, \c
+ *   stops the output, and an unknown sequence is printed as is.
+ *
+ *   returns: 0, or -1 if the output was stopped by \c
+ */
+static int echo_escapes(const char *s) {
+    while (*s != '\0') {
+        int c = (unsigned char) *s++;
+        if (c == '\\' && *s != '\0') {
+            c = (unsigned char) *s++;
+            if (c == 'c') return -1;
+            if (c == 'x' && isxdigit((unsigned char) *s)) {
+                c = hex_value(*s++);
+                if (isxdigit((unsigned char) *s)) c = c * 16 + hex_value(*s++);
+            }
+            else if (is_octal(c)) {
+                // A leading 0 does not count as one of the three digits.
+                if (c == '0' && is_octal(*s)) c = *s++;
+                c -= '0';
+                for (int i = 0; i < 2 && is_octal(*s); i++) c = c * 8 + *s++ - '0';
+            }
+            else if (c != '\\' && strchr("abefnrtv", c) != NULL) c = escape_char(c);
+            else if (c != '\\') putchar('\\');
+        }
+        putchar(c);
+    }
+    return 0;
+}
+
+static int echo_utility(char **args) {
+    // POSIXLY_CORRECT changes how the options and escapes are handled.
+    if (getenv("POSIXLY_CORRECT") != NULL || asks_for_info(args)) return UTILITY_EXEC;
+    int newline = 1, escapes = 0, i;
+    // The options are the leading arguments made only of -e, -E and -n.
+    for (i = 1; args[i] != NULL && args[i][0] == '-'; i++) {
+        const char *opt = args[i] + 1;
+        if (*opt == '\0' || opt[strspn(opt, "eEn")] != '\0') break;
+        for (; *opt != '\0'; opt++) {
+            if (*opt == 'e') escapes = 1;
+            else if (*opt == 'E') escapes = 0;
+            else newline = 0;
+        }
+    }
+    for (int first = i; args[i] != NULL; i++) {
+        if (i > first) putchar(' ');
+        if (!escapes) fputs(args[i], stdout);
+        else if (echo_escapes(args[i]) == -1) return 0;
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+static int pwd_utility(char **args) {
+    // The logical path (-L, or the default with POSIXLY_CORRECT) is left to pwd.
+    if (getenv("POSIXLY_CORRECT") != NULL || (args[1] != NULL && (strcmp(args[1], "-P") != 0 || args[2] != NULL)))
+        return UTILITY_EXEC;
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) return UTILITY_EXEC;
+    puts(cwd);
+    free(cwd);
+    return 0;
+}
+
+typedef struct {
+    // Output, only written to stdout when printf succeeds.
+    FILE *out;
+    // Set by \c, which stops the output.
+    int stop;
+    // Set when printf would report an error.
+    int error;
+} printf_state_t;
+
+/*
+ * Function: printf_escape
+ * -----------------------
+ *   Print the escape sequence at p (after the backslash) of a printf format, or of a %b
+ *   argument (where \0NNN is octal).
+ *
+ *   returns: the position after the sequence
+ */
+static const char *printf_escape(printf_state_t *state, const char *p, int octal_0) {
+    int value = 0, n;
+    if (*p == 'x') {
+        for (n = 0, p++; n < 2 && isxdigit((unsigned char) *p); n++, p++) value = value * 16 + hex_value(*p);
+        if (n == 0) state->error = 1;
+        putc(value, state->out);
+    }
+    else if (is_octal(*p)) {
+        if (octal_0 && *p == '0') p++;
+        for (n = 0; n < 3 && is_octal(*p); n++, p++) value = value * 8 + *p - '0';
+        putc(value, state->out);
+    }
+    else if (*p != '\0' && strchr("\"\\abcefnrtv", *p) != NULL) {
+        if (*p == 'c') state->stop = 1;
+        else putc(escape_char(*p), state->out);
+        p++;
+    }
+    // Unicode characters depend on the locale.
+    else if (*p == 'u' || *p == 'U') state->error = 1;
+    else {
+        putc('\\', state->out);
+        if (*p != '\0') putc(*p++, state->out);
+    }
+    return p;
+}
+
+// Whether the decimal point of the user's locale is '.', so that the shell prints
+// floating point numbers like printf would (the shell itself stays in the C locale).
+static int c_decimal_point(void) {
+    static int result = -1;
+    if (result == -1) {
+        locale_t locale = newlocale(LC_NUMERIC_MASK, "", (locale_t) 0);
+        result = locale == (locale_t) 0 || strcmp(nl_langinfo_l(RADIXCHAR, locale), ".") == 0;
+        if (locale != (locale_t) 0) freelocale(locale);
+    }
+    return result;
+}
+
+// A character constant ('c or "c) stands for the code of the character.
+static int char_constant(printf_state_t *state, const char *s, uintmax_t *value) {
+    if ((*s != '\'' && *s != '"') || s[1] == '\0') return 0;
+    // printf warns about the characters after the first one, and decodes multibyte characters.
+    if (s[2] != '\0' || (unsigned char) s[1] >= 0x80) state->error = 1;
+    *value = (unsigned char) s[1];
+    return 1;
+}
+
+static intmax_t printf_int(printf_state_t *state, const char *s) {
+    uintmax_t c;
+    if (char_constant(state, s, &c)) return c;
+    char *end;
+    errno = 0;
+    intmax_t value = strtoimax(s, &end, 0);
+    if (errno != 0 || *end != '\0') state->error = 1;
+    return value;
+}
+
+static uintmax_t printf_uint(printf_state_t *state, const char *s) {
+    uintmax_t value;
+    if (char_constant(state, s, &value)) return value;
+    char *end;
+    errno = 0;
+    value = strtoumax(s, &end, 0);
+    if (errno != 0 || *end != '\0') state->error = 1;
+    return value;
+}
+
+static long double printf_float(printf_state_t *state, const char *s) {
+    uintmax_t c;
+    if (!c_decimal_point()) state->error = 1;
+    if (char_constant(state, s, &c)) return c;
+    char *end;
+    errno = 0;
+    long double value = strtold(s, &end);
+    if (errno != 0 || *end != '\0') state->error = 1;
+    return value;
+}
+
+// Print one conversion, given as "%<flags><width>.<precision>" (with '*' for the width
+// and precision given as arguments) and the conversion character.
+static void print_conversion(printf_state_t *state, const char *spec, int spec_len, char conversion,
+                             int width, int precision, int has_width, int has_precision, const char *arg) {
+    char format[SPEC_MAX + 3];
+    memcpy(format, spec, spec_len);
+    int n = spec_len;
+    // The numbers are converted at their largest size.
+    if (strchr("dioxXu", conversion) != NULL) format[n++] = 'j';
+    else if (strchr("aAeEfFgG", conversion) != NULL) format[n++] = 'L';
+    format[n++] = conversion;
+    format[n] = '\0';
+#define PRINT_CONVERSION(value) \
+    do { \
+        if (has_width && has_precision) fprintf(state->out, format, width, precision, value); \
+        else if (has_width) fprintf(state->out, format, width, value); \
+        else if (has_precision) fprintf(state->out, format, precision, value); \
+        else fprintf(state->out, format, value); \
+    } while (0)
+    switch (conversion) {
+        case 'd': case 'i':
+            PRINT_CONVERSION(printf_int(state, arg));
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            PRINT_CONVERSION(printf_uint(state, arg));
+            break;
+        case 'c':
+            PRINT_CONVERSION(*arg);
+            break;
+        case 's':
+            PRINT_CONVERSION(arg);
+            break;
+        default:
+            PRINT_CONVERSION(printf_float(state, arg));
+    }
+#undef PRINT_CONVERSION
+}
+
+/*
+ * Function: print_formatted
+ * -------------------------
+ *   Print the format once, with the arguments it uses (missing ones are empty or 0).
+ *
+ *   returns: the number of arguments used
+ */
+static int print_formatted(printf_state_t *state, const char *format, char **args) {
+    int used = 0;
+    for (const char *f = format; *f != '\0' && !state->stop && !state->error; f++) {
+        if (*f == '\\') {
+            f = printf_escape(state, f + 1, 0) - 1;
+            continue;
+        }
+        if (*f != '%') {
+            putc(*f, state->out);
+            continue;
+        }
+        const char *spec = f++;
+        if (*f == '%') {
+            putc('%', state->out);
+            continue;
+        }
+        if (*f == 'b') {
+            // %b takes no width or precision.
+            if (args[used] != NULL) {
+                for (const char *p = args[used++]; *p != '\0' && !state->stop;) {
+                    if (*p == '\\') p = printf_escape(state, p + 1, 1);
+                    else putc(*p++, state->out);
+                }
+            }
+            continue;
+        }
+        int width = 0, precision = -1, has_width = 0, has_precision = 0;
+        f += strspn(f, "-+ #0");
+        int alternate = memchr(spec, '#', f - spec) != NULL, zero = memchr(spec, '0', f - spec) != NULL;
+        // printf rejects # and 0 with %c and %s (and # with %d, %i and %u), and a precision with %c.
+        int no_c = alternate || zero, no_s = alternate || zero;
+        // The flags that depend on the locale (' and I) are left to printf.
+        if (*f == '\'' || *f == 'I') {
+            state->error = 1;
+            break;
+        }
+        if (*f == '*') {
+            f++;
+            intmax_t value = args[used] != NULL ? printf_int(state, args[used++]) : 0;
+            if (value < INT_MIN || value > INT_MAX) state->error = 1;
+            width = value;
+            has_width = 1;
+        }
+        else while (isdigit((unsigned char) *f)) f++;
+        if (*f == '.') {
+            f++;
+            no_c = 1;
+            if (*f == '*') {
+                f++;
+                intmax_t value = args[used] != NULL ? printf_int(state, args[used++]) : 0;
+                if (value > INT_MAX) state->error = 1;
+                precision = value < 0 ? -1 : value;
+                has_precision = 1;
+            }
+            else while (isdigit((unsigned char) *f)) f++;
+        }
+        int spec_len = f - spec;
+        // The length modifiers are ignored.
+        f += strspn(f, "lLhjtz");
+        char conversion = *f;
+        if (conversion == '\0' || strchr("aAcdeEfFgGiosuxX", conversion) == NULL || spec_len > SPEC_MAX
+            || (conversion == 'c' && no_c) || (conversion == 's' && no_s)
+            || (strchr("diu", conversion) != NULL && alternate)) {
+            state->error = 1;
+            break;
+        }
+        print_conversion(state, spec, spec_len, conversion, width, precision, has_width, has_precision,
+                         args[used] != NULL ? args[used++] : "");
+    }
+    return used;
+}
+
+static int printf_utility(char **args) {
+    if (asks_for_info(args)) return UTILITY_EXEC;
+    args++;
+    if (*args != NULL && strcmp(*args, "--") == 0) args++;
+    // A missing format is an error.
+    if (*args == NULL) return UTILITY_EXEC;
+    const char *format = *args++;
+    char *output;
+    size_t size;
+    printf_state_t state = {open_memstream(&output, &size), 0, 0};
+    if (state.out == NULL) return UTILITY_EXEC;
+    // The format is reused until all the arguments are used.
+    int used;
+    do {
+        used = print_formatted(&state, format, args);
+        args += used;
+    } while (used > 0 && *args != NULL && !state.stop && !state.error);
+    // Unused arguments get a warning.
+    if (*args != NULL && !state.stop) state.error = 1;
+    fclose(state.out);
+    if (!state.error) fwrite(output, 1, size, stdout);
+    free(output);
+    return state.error ? UTILITY_EXEC : 0;
+}
+
+// Parse an integer operand of test: optional blanks and sign, digits and blanks.
+static int test_int(const char *s, long long *value) {
+    s += strspn(s, " \t");
+    const char *digits = s + (*s == '+' || *s == '-');
+    size_t n = strspn(digits, "0123456789");
+    // Longer numbers (compared as strings by test) are left to it.
+    if (n == 0 || n > 18 || digits[n + strspn(digits + n, " \t")] != '\0') return -1;
+    *value = strtoll(s, NULL, 10);
+    return 0;
+}
+
+/*
+ * Function: test_unary
+ * --------------------
+ *   Evaluate a unary test ("-f file", "-z string", ...).
+ *
+ *   returns: 0 or 1, or UTILITY_EXEC for an operator that is not handled here
+ */
+static int test_unary(const char *op, const char *arg) {
+    struct stat st;
+    long long fd;
+    if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') return UTILITY_EXEC;
+    switch (op[1]) {
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 'r': return euidaccess(arg, R_OK) == 0;
+        case 'w': return euidaccess(arg, W_OK) == 0;
+        case 'x': return euidaccess(arg, X_OK) == 0;
+        case 'h': case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        case 't':
+            if (test_int(arg, &fd) == -1 || fd < 0 || fd > INT_MAX) return UTILITY_EXEC;
+            return isatty(fd);
+    }
+    if (strchr("bcdefgGkOpsSu", op[1]) == NULL) return UTILITY_EXEC;
+    if (stat(arg, &st) != 0) return 0;
+    switch (op[1]) {
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'e': return 1;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'G': return st.st_gid == getegid();
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        case 'O': return st.st_uid == geteuid();
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'S': return S_ISSOCK(st.st_mode);
+        default: return (st.st_mode & S_ISUID) != 0;
+    }
+}
+
+/*
+ * Function: test_binary
+ * ---------------------
+ *   Evaluate a binary test ("a = b", "1 -lt 2", "f1 -nt f2", ...).
+ *
+ *   returns: 0 or 1, -1 if op is not a binary operator, or UTILITY_EXEC for an error
+ *            or a case that is not handled here
+ */
+static int test_binary(const char *left, const char *op, const char *right) {
+    static const char *int_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(left, right) != 0;
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(op, int_ops[i]) != 0) continue;
+        long long a, b;
+        if (test_int(left, &a) == -1 || test_int(right, &b) == -1) return UTILITY_EXEC;
+        int results[] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+        return results[i];
+    }
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        struct stat a, b;
+        int missing = stat(left, &a) != 0 || stat(right, &b) != 0;
+        if (op[1] == 'e') return !missing && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+        if (missing) return UTILITY_EXEC;
+        int cmp = a.st_mtim.tv_sec != b.st_mtim.tv_sec ? (a.st_mtim.tv_sec > b.st_mtim.tv_sec) - (a.st_mtim.tv_sec < b.st_mtim.tv_sec)
+                                                       : (a.st_mtim.tv_nsec > b.st_mtim.tv_nsec) - (a.st_mtim.tv_nsec < b.st_mtim.tv_nsec);
+        return op[1] == 'n' ? cmp > 0 : cmp < 0;
+    }
+    return -1;
+}
+
+static int negate(int result) {
+    return result == UTILITY_EXEC ? result : !result;
+}
+
+/*
+ * Function: test_expression
+ * -------------------------
+ *   Evaluate the arguments of test by their number, as POSIX specifies it for up to 4
+ *   arguments. Longer expressions, -a, -o and the syntax errors are left to test.
+ *
+ *   returns: 0 or 1, or UTILITY_EXEC
+ */
+static int test_expression(char **args, int argc) {
+    int result;
+    switch (argc) {
+        case 0:
+            return 0;
+        case 1:
+            return args[0][0] != '\0';
+        case 2:
+            if (strcmp(args[0], "!") == 0) return args[1][0] == '\0';
+            return test_unary(args[0], args[1]);
+        case 3:
+            if ((result = test_binary(args[0], args[1], args[2])) != -1) return result;
+            if (strcmp(args[0], "!") == 0) return negate(test_expression(args + 1, 2));
+            if (strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0) return args[1][0] != '\0';
+            return UTILITY_EXEC;
+        case 4:
+            if (strcmp(args[0], "!") == 0) return negate(test_expression(args + 1, 3));
+            if (strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0) return test_expression(args + 1, 2);
+            return UTILITY_EXEC;
+        default:
+            return UTILITY_EXEC;
+    }
+}
+
+static int test_utility(char **args) {
+    int argc = 0;
+    while (args[argc + 1] != NULL) argc++;
+    if (strcmp(args[0], "[") == 0) {
+        // "[" needs a closing "]" and answers --help and --version.
+        if (argc == 0 || strcmp(args[argc], "]") != 0 || asks_for_info(args)) return UTILITY_EXEC;
+        argc--;
+    }
+    int result = test_expression(args + 1, argc);
+    return result == UTILITY_EXEC ? result : !result;
+}
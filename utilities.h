@@ -0,0 +1,40 @@
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+#define NUM_UTILITIES 7
+
+// Returned by a utility that leaves the command to the real executable (an option or an
+// error it does not reproduce, such as --help or an invalid number).
+#define UTILITY_EXEC -1
+
+// Whether the utilities run in the shell (set with "set utilities on|off").
+extern int use_utilities;
+
+extern const char *utility_cmd[NUM_UTILITIES];
+extern int (*const utility_func[NUM_UTILITIES])(char **args);
+
+/*
+ * Function: find_utility
+ * ----------------------
+ *   Find a utility that the shell runs itself instead of executing it: [, echo, false,
+ *   printf, pwd, test and true. They print the same output and return the same status as
+ *   the GNU coreutils programs.
+ *
+ *   cmd: the command name
+ *
+ *   returns: the index of the utility in utility_cmd, or -1 if it is not one (or use_utilities is off)
+ */
+int find_utility(const char *cmd);
+
+/*
+ * Function: run_utility
+ * ---------------------
+ *   Run a utility in the shell. Nothing is printed when it returns UTILITY_EXEC.
+ *
+ *   args: the arguments of the command (args[0] is the utility)
+ *
+ *   returns: the exit status, or UTILITY_EXEC if the command has to be executed
+ */
+int run_utility(char **args);
+
+#endif
@@ -1,197 +1,672 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include "utils.h"
+#include "admission.h"
+#include "affinity.h"
+#include "capture.h"
+#include "event_loop.h"
+#include "exec.h"
+#include "expand.h"
+#include "history.h"
+#include "input.h"
 #include "job_control.h"
+#include "monitor.h"
+#include "options.h"
+#include "path_cache.h"
+#include "rlimits.h"
+#include "stats.h"
+#include "watchdog.h"
 
 const char *prog_dir[2] = {"/usr/bin/", "/bin/"};
-const char *builtin_cmd[5] = {"bg", "cd", "fg", "jobs", "kill"};
-void (*const builtin_func[5])(job_list_t *, char **) = {bg, cd, fg, jobs, kill_job};
-
-void parse_args(char *line, char *args[][MAX_ARGS], int arg_count[], int *cmd_count) {
-    char new_arg[ARG_LEN];
-    int i = 0, j = 0, k = 0, in_quote = 0, in_escape = 0, next_cmd = 0;
-    while (line[i] != '\0') {
-        // The commands before an ampersand sign (&) have to be executed in the background.
-        // Therefore, we split the command line into multiple commands.
-        // Only the last command can be executed in the foreground if there is no ampersand sign at the end.
-        if (line[i] == '&') {
-            if (j > 0) {
-                if (new_arg[j - 1] == '\n')
-                    new_arg[--j] = '\0';
-                else
-                    new_arg[j] = '\0';
-                if (j > 0) {
-                    args[next_cmd][k] = malloc(sizeof(char) * (j + 1));
-                    strcpy(args[next_cmd][k], new_arg);
-                    k++;
+const char *builtin_cmd[NUM_BUILTINS] = {"bg", "cd", "deadline", "fg", "hash", "history", "jobs", "kill", "limit", "parallel", "pin", "set", "stats"};
+int (*const builtin_func[NUM_BUILTINS])(job_list_t *, char **) = {bg, cd, deadline, fg, hash, history, jobs, kill_job, limit, parallel, pin, set, stats};
+
+char group_open[] = "(", group_close[] = ")";
+
+// Append a pointer to an array allocated from an arena.
+static char **push_arg(arena_t *arena, char **args, int *argc, int *cap, char *arg) {
+    if (*argc == *cap) args = arena_grow(arena, args, sizeof(char *), cap);
+    args[(*argc)++] = arg;
+    return args;
+}
+
+// Add a character of an argument to its pattern (escaped if it was quoted), and note whether the argument has to be expanded.
+static char *pattern_char(char *p, char c, int quoted, int *expand) {
+    if (quoted && strchr(PATTERN_CHARS, c) != NULL) *p++ = '\\';
+    else if (!quoted && strchr(EXPAND_CHARS, c) != NULL) *expand = 1;
+    *p++ = c;
+    return p;
+}
+
+// Find the parenthesis that closes a group (NULL if there is none).
+static char *group_end(char *p) {
+    int depth = 0;
+    char quote = '\0';
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && quote != '\'' && p[1] != '\0') p++;
+        else if (quote) {
+            if (*p == quote) quote = '\0';
+        }
+        else if (*p == '\'' || *p == '"') quote = *p;
+        else if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) return p;
+    }
+    return NULL;
+}
+
+// Find the end of a command (its separator, or the end of the line), and whether it has a command substitution.
+static char *command_end(char *p, int *substitution) {
+    char quote = '\0';
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && quote != '\'' && p[1] != '\0') p++;
+        else if (quote == '\'') {
+            if (*p == '\'') quote = '\0';
+        }
+        else if (*p == '`' || (*p == '$' && p[1] == '(')) {
+            // Skip the command inside, which has separators of its own (an unterminated one takes the rest of the line).
+            char *end = NULL;
+            if (*p == '`') {
+                for (end = p + 1; *end != '\0' && *end != '`'; end++)
+                    if (*end == '\\' && end[1] != '\0') end++;
+                if (*end == '\0') end = NULL;
+            }
+            else end = group_end(p + 1);
+            *substitution = 1;
+            if (end == NULL) return p + strlen(p);
+            p = end;
+        }
+        else if (quote) {
+            if (*p == quote) quote = '\0';
+        }
+        else if (*p == '"' || *p == '\'') quote = *p;
+        else if (*p == '&' || *p == '|' || *p == ';') return p;
+    }
+    return p;
+}
+
+void parse_args(char *line, arena_t *arena, command_line_t *cmd_line) {
+    command_t *cmds = NULL;
+    int num_cmds = 0, cmd_cap = 0;
+    char **args = NULL;
+    int argc = 0, arg_cap = 0;
+    // The unquoted arguments are written back into the line: w never passes r.
+    char *r = line, *w = line, *arg = NULL;
+    char quote = '\0';
+    // Only a line with wildcards or braces needs the patterns of its arguments, which keep track of the quoting.
+    char *pattern = strpbrk(line, EXPAND_CHARS) != NULL ? arena_alloc(arena, 2 * strlen(line) + 1) : NULL;
+    char *p = pattern;
+    int expand = 0;
+    char *group = NULL, *source = NULL;
+    // Only a line with command substitutions has commands to keep as they are.
+    int substitutions = strchr(line, '`') != NULL || strstr(line, "$(") != NULL;
+    while (1) {
+        char c = *r;
+        if (c == '\0' || (!quote && (c == ' ' || c == '\t' || c == '\n' || c == '&' || c == '|' || c == ';'))) {
+            // End the current argument (this may overwrite c, which is already saved).
+            if (arg != NULL) {
+                *w++ = '\0';
+                if (expand) {
+                    *p = '\0';
+                    args = expand_word(arena, pattern, args, &argc, &arg_cap);
                 }
+                else args = push_arg(arena, args, &argc, &arg_cap, arg);
+                arg = NULL;
+                p = pattern;
+                expand = 0;
+            }
+            // The commands before an ampersand sign (&) have to be executed in the background.
+            // Commands separated by a pipe sign (|) are the stages of a single pipeline.
+            if (c == '&' || c == '|' || c == ';' || c == '\0') {
+                char separator = c;
+                // && and || join the pipelines of a list.
+                if ((c == '&' || c == '|') && r[1] == c) separator = *++r == '&' ? SEP_AND : SEP_OR;
+                args = push_arg(arena, args, &argc, &arg_cap, NULL);
+                if (num_cmds == cmd_cap) cmds = arena_grow(arena, cmds, sizeof(command_t), &cmd_cap);
+                cmds[num_cmds].args = args;
+                cmds[num_cmds].argc = argc - 1;
+                cmds[num_cmds].separator = separator;
+                cmds[num_cmds].group = group;
+                cmds[num_cmds].source = source;
+                num_cmds++;
+                args = NULL;
+                argc = arg_cap = 0;
+                group = source = NULL;
+                if (c == '\0') break;
             }
-            arg_count[next_cmd] = k;
-            args[next_cmd][k] = NULL;
-            next_cmd++;
-            j = 0;
-            k = 0;
-        }
-        else if (line[i] == '"') {
-            if (in_quote) {
-                in_quote = 0;
-                new_arg[j] = '\0';
-                args[next_cmd][k] = malloc(sizeof(char) * (j + 1));
-                strcpy(args[next_cmd][k], new_arg);
-                k++;
-                j = 0;
-            } else {
-                in_quote = 1;
+            r++;
+            continue;
+        }
+        // A parenthesis at the start of a command opens a group: its command line is kept as is, up to the matching one.
+        if (!quote && c == '(' && arg == NULL && argc == 0 && group == NULL) {
+            char *end = group_end(r);
+            size_t len = end != NULL ? (size_t) (end - r - 1) : strlen(r + 1);
+            memmove(w, r + 1, len);
+            w[len] = '\0';
+            group = w;
+            args = push_arg(arena, args, &argc, &arg_cap, group_open);
+            args = push_arg(arena, args, &argc, &arg_cap, group);
+            if (end != NULL) args = push_arg(arena, args, &argc, &arg_cap, group_close);
+            w += len + 1;
+            r += len + 1 + (end != NULL);
+            continue;
+        }
+        // A command with a substitution is kept as it is, to be substituted and parsed again when it runs.
+        if (substitutions && arg == NULL && argc == 0 && group == NULL) {
+            int substitution = 0;
+            char *end = command_end(r, &substitution);
+            if (substitution) {
+                source = arena_alloc(arena, end - r + 1);
+                memcpy(source, r, end - r);
+                source[end - r] = '\0';
+                args = push_arg(arena, args, &argc, &arg_cap, source);
+                r = end;
+                continue;
             }
-        } 
-        else if (line[i] == '\\') in_escape = 1;
-        else if (line[i] == ' ') {
-            if (in_quote || in_escape) {
-                new_arg[j++] = line[i];
-                in_escape = in_escape ? 0 : in_escape;
-                in_quote = in_quote ? 0 : in_quote;
-            } 
+        }
+        // Any other character is part of an argument (quotes can start an empty one).
+        if (arg == NULL) arg = w;
+        if (quote) {
+            if (c == quote) quote = '\0';
             else {
-                if (j > 0) {
-                    new_arg[j] = '\0';
-                    args[next_cmd][k] = malloc(sizeof(char) * (j + 1));
-                    strcpy(args[next_cmd][k], new_arg);
-                    k++;
-                    j = 0;
-                }
+                // In double quotes, a backslash only escapes a double quote or a backslash.
+                if (quote == '"' && c == '\\' && (r[1] == '"' || r[1] == '\\')) c = *++r;
+                *w++ = c;
+                if (pattern != NULL) p = pattern_char(p, c, 1, &expand);
             }
-        } 
-        else {
-            new_arg[j] = line[i];
-            j++;
         }
-        i++;
-    }
-    if (j > 0) {
-        if (new_arg[j - 1] == '\n')
-            new_arg[--j] = '\0';
-        else
-            new_arg[j] = '\0';
-        if (strlen(new_arg) > 0) {
-            args[next_cmd][k] = malloc(sizeof(char) * (j + 1));
-            strcpy(args[next_cmd][k], new_arg);
-            k++;
+        else if (c == '"' || c == '\'') quote = c;
+        else {
+            // Outside quotes, a backslash escapes any character (e.g. whitespace).
+            int escaped = c == '\\' && r[1] != '\0';
+            if (escaped) c = *++r;
+            *w++ = c;
+            if (pattern != NULL) p = pattern_char(p, c, escaped, &expand);
         }
+        r++;
     }
-    arg_count[next_cmd] = k;
-    args[next_cmd][k] = NULL;
-    *cmd_count = next_cmd + 1;
+    cmd_line->cmds = cmds;
+    cmd_line->count = num_cmds;
 }
 
-void bg(job_list_t *job_list, char *args[]) {
+int bg(job_list_t *job_list, char *args[]) {
     if (args[1] == NULL) {
         printf("bg: no job specified\n");
-        return;
+        return 1;
     }
     if (args[1][0] != '%') {
         printf("bg: invalid job id\n");
-        return;
+        return 1;
     }
     int pgid = atoi(args[1] + 1);
     job_t *job = get_job_by_id(job_list, pgid);
     if (job == NULL) {
         fprintf(stderr, "bg: job not found: %d\n", pgid);
-        return;
+        return 1;
+    }
+    if (job->state == QUEUED) {
+        printf("bg: job %d is queued\n", pgid);
+        return 1;
     }
     if (job->state != BACKGROUND) {
-        job->state = BACKGROUND;
-        // Append an ampersand sign (&) to the cmd.
-        char *cmd = malloc(sizeof(char) * (strlen(job->cmd) + 2));
-        strcpy(cmd, job->cmd);
-        strcat(cmd, "&");
-        free(job->cmd);
-        job->cmd = cmd;
+        set_job_state(job_list, job, BACKGROUND);
+        // Append an ampersand sign (&) to the cmd (a stopped background job already has one).
+        if (job->cmd_len == 0 || job->cmd[job->cmd_len - 1] != '&') append_job_cmd(job, "&");
         killpg(job->pid, SIGCONT);
         printf("[%d] %d\n", job->pgid, job->pid);
     }
+    return 0;
 }
 
-void cd(job_list_t *job_list, char *args[]) {
+int cd(job_list_t *job_list, char *args[]) {
     char *new_path = args[1];
     if (args[1] == NULL)
         new_path = getenv("HOME");
-    if (chdir(new_path) == -1)
+    if (chdir(new_path) == -1) {
         fprintf(stderr, "cd: %s: No such file or directory\n", new_path);
-    else {
-        char *pwd = malloc(sizeof(char) * PATH_LEN);
-        getcwd(pwd, PATH_LEN);
-        setenv("PWD", pwd, 1);
-        free(pwd);
+        return 1;
     }
+    char *pwd = malloc(sizeof(char) * PATH_LEN);
+    getcwd(pwd, PATH_LEN);
+    setenv("PWD", pwd, 1);
+    free(pwd);
+    path_cache_chdir();
+    return 0;
 }
 
-void fg(job_list_t *job_list, char *args[]) {
+int deadline(job_list_t *job_list, char *args[]) {
+    if (args[1] == NULL || args[1][0] != '%') {
+        printf("deadline: invalid job id\n");
+        return 1;
+    }
+    job_t *job = get_job_by_id(job_list, atoi(args[1] + 1));
+    if (job == NULL) {
+        fprintf(stderr, "deadline: job not found: %d\n", atoi(args[1] + 1));
+        return 1;
+    }
+    if (args[2] == NULL) {
+        // Print when the next signal is sent.
+        double left = deadline_remaining(job);
+        if (left >= 0) printf("[%d] %s in %.1fs\n", job->pgid, job->timed_out ? "SIGKILL" : "SIGTERM", left);
+        else if (job->timeout_ms > 0 && job->state == QUEUED) printf("[%d] %.1fs once dispatched\n", job->pgid, job->timeout_ms / 1e3);
+        else printf("[%d] no deadline\n", job->pgid);
+        return 0;
+    }
+    int timeout_ms = strcmp(args[2], "off") == 0 ? 0 : parse_duration(args[2]);
+    int grace_ms = timeout_grace * 1000;
+    if (timeout_ms != -1 && args[3] != NULL) {
+        if (strcmp(args[3], "-k") != 0 || args[4] == NULL || args[5] != NULL) {
+            printf("deadline: usage: deadline %%N [duration [-k grace] | off]\n");
+            return 1;
+        }
+        grace_ms = parse_duration(args[4]);
+    }
+    if (timeout_ms == -1 || grace_ms == -1) {
+        printf("deadline: invalid duration\n");
+        return 1;
+    }
+    set_deadline(job, timeout_ms, grace_ms);
+    return 0;
+}
+
+// Exit status of fg for the wait status of the job (-1 if it was stopped again).
+static int fg_exit_status(int status) {
+    if (status == -1) return 128 + SIGTSTP;
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+int fg(job_list_t *job_list, char *args[]) {
     if (args[1] == NULL) {
         printf("fg: no job specified\n");
-        return;
+        return 1;
     }
     if (args[1][0] != '%') {
         printf("fg: invalid job id\n");
-        return;
+        return 1;
     }
     int pgid = atoi(args[1] + 1);
     job_t *job = get_job_by_id(job_list, pgid);
     if (job == NULL) {
         fprintf(stderr, "fg: job not found: %d\n", pgid);
-        return;
+        return 1;
     }
-    if (job->state != FOREGROUND) {
-        job->state = FOREGROUND;
-        // Check if the cmd ends with an ampersand sign (&). Remove it if it does.
-        if (job->cmd[strlen(job->cmd) - 1] == '&') job->cmd[strlen(job->cmd) - 1] = '\0';
-        // Associate the job with the current terminal.
-        tcsetpgrp(STDIN_FILENO, job->pid);
-        killpg(job->pid, SIGCONT);
-        int status;
-        waitpid(job->pid, &status, WUNTRACED);
-        // Restore the terminal to the shell.
-        tcsetpgrp(STDIN_FILENO, getpid());
-        enum job_status j_status = get_status(status);
-        if (j_status == SUSPENDED) {
-            printf("\n");
-            // If the job is suspended, change its state to STOPPED.
-            block_signal(SIGCHLD, 1);
-            job->state = STOPPED;
-            block_signal(SIGCHLD, 0);
+    if (job->state == QUEUED) {
+        // Start it right away, in the foreground.
+        if (job->cmd_len > 0 && job->cmd[job->cmd_len - 1] == '&') job->cmd[--job->cmd_len] = '\0';
+        return fg_exit_status(run_queued_job(job_list, job, 0));
+    }
+    if (job->state == FOREGROUND) return 0;
+    set_job_state(job_list, job, FOREGROUND);
+    // Check if the cmd ends with an ampersand sign (&). Remove it if it does.
+    if (job->cmd_len > 0 && job->cmd[job->cmd_len - 1] == '&') job->cmd[--job->cmd_len] = '\0';
+    // Continue the process group and wait for it with the terminal.
+    return fg_exit_status(wait_for_job(job_list, job, 1));
+}
+
+int hash(job_list_t *job_list, char *args[]) {
+    if (args[1] == NULL) {
+        path_cache_print();
+        return 0;
+    }
+    if (strcmp(args[1], "-r") == 0) {
+        path_cache_reset();
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; args[i] != NULL; i++)
+        if (strchr(args[i], '/') == NULL && path_cache_lookup(args[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+            status = 1;
         }
-        // If the job is signaled or exited, delete it from the job list.
-        else if (j_status == SIGNALED || j_status == EXITED) {
-            if (j_status == SIGNALED) printf("\n[%d] %d terminated by signal %d\n", job->pgid, job->pid, status);
-            // Delete the job from the job list.
-            block_signal(SIGCHLD, 1);
-            delete_job(job_list, job->pid);
-            block_signal(SIGCHLD, 0);
+    return status;
+}
+
+static void print_history_entry(int n, int details) {
+    history_entry_t entry;
+    if (get_history(n, &entry) == -1) return;
+    if (!details) {
+        printf("%5d  %s\n", n + 1, entry.text);
+        return;
+    }
+    char started[32], status[32];
+    strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", localtime(&entry.time));
+    if (entry.status == HISTORY_PENDING) strcpy(status, "-");
+    else if (WIFSIGNALED(entry.status)) snprintf(status, sizeof(status), "signal %d", WTERMSIG(entry.status));
+    else snprintf(status, sizeof(status), "exit %d", WEXITSTATUS(entry.status));
+    printf("%5d  %s  %-9s %9.3fs  %s\n", n + 1, started, status, entry.duration, entry.text);
+}
+
+int history(job_list_t *job_list, char *args[]) {
+    int details = 0, i = 1;
+    const char *text = NULL;
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-l") == 0) details = 1;
+        else if (strcmp(args[i], "-s") == 0 && args[i + 1] != NULL) text = args[++i];
+        else {
+            printf("usage: history [-l] [-s text] [n]\n");
+            return 1;
         }
     }
+    int size = history_size();
+    int count = args[i] != NULL ? atoi(args[i]) : size;
+    if (count > size) count = size;
+    if (text == NULL) {
+        for (int n = size - count; n < size; n++) print_history_entry(n, details);
+        return 0;
+    }
+    // Find the latest matches, then print them in order.
+    int *matches = malloc(sizeof(int) * (count ? count : 1));
+    int num_matches = 0;
+    for (int n = size; num_matches < count && (n = search_history(text, n)) != -1;) matches[num_matches++] = n;
+    while (num_matches > 0) print_history_entry(matches[--num_matches], details);
+    free(matches);
+    return 0;
 }
 
-void jobs(job_list_t *job_list, char *args[]) {
-    print_job_list(job_list);
+int jobs(job_list_t *job_list, char *args[]) {
+    if (args[1] != NULL && strcmp(args[1], "-o") == 0) {
+        if (args[2] == NULL || args[2][0] != '%') {
+            printf("jobs: invalid job id\n");
+            return 1;
+        }
+        if (print_job_output(job_list, atoi(args[2] + 1)) == -1) {
+            fprintf(stderr, "jobs: no captured output: %d\n", atoi(args[2] + 1));
+            return 1;
+        }
+    }
+    else if (args[1] != NULL && strcmp(args[1], "-l") == 0) print_job_usage(job_list);
+    else if (args[1] != NULL && strcmp(args[1], "--watch") == 0) {
+        int interval_ms = args[2] != NULL ? parse_duration(args[2]) : 1000;
+        if (interval_ms <= 0) {
+            printf("jobs: invalid interval\n");
+            return 1;
+        }
+        watch_jobs(job_list, interval_ms);
+    }
+    else print_job_list(job_list);
+    return 0;
 }
 
-void kill_job(job_list_t *job_list, char *args[]) {
+int kill_job(job_list_t *job_list, char *args[]) {
     if (args[1] == NULL) {
         printf("kill: no job specified\n");
-        return;
+        return 1;
     }
     if (args[1][0] != '%') {
         printf("kill: invalid job id\n");
-        return;
+        return 1;
     }
     int pgid = atoi(args[1] + 1);
     job_t *job = get_job_by_id(job_list, pgid);
     if (job == NULL) {
         fprintf(stderr, "kill: job not found: %d\n", pgid);
-        return;
+        return 1;
+    }
+    if (job->state == QUEUED) {
+        cancel_queued_job(job_list, job);
+        return 0;
     }
+    // The job is reported at the next prompt once it has finished, the shell does not wait for it.
     killpg(job->pid, SIGTERM);
-    sleep(1);
+    return 0;
+}
+
+int limit(job_list_t *job_list, char *args[]) {
+    char buf[128];
+    if (args[1] == NULL) {
+        // Print the defaults for background jobs.
+        printf("background jobs: %s\n", bg_limits.mask ? format_limits(&bg_limits, buf, sizeof(buf)) : "unlimited");
+        return 0;
+    }
+    job_t *job = NULL;
+    if (args[1][0] == '%') {
+        job = get_job_by_id(job_list, atoi(args[1] + 1));
+        if (job == NULL) {
+            printf("limit: job not found\n");
+            return 1;
+        }
+    }
+    else if (strcmp(args[1], "-b") != 0) {
+        printf("limit: no command\n");
+        return 1;
+    }
+    job_limits_t limits = {0};
+    for (int i = 2; args[i] != NULL; i++) {
+        // "unlimited" does not set a bit, so it is only meaningful for the defaults.
+        if (parse_limit(args[i], job == NULL ? &bg_limits : &limits) == -1) {
+            printf("limit: invalid limit '%s'\n", args[i]);
+            return 1;
+        }
+    }
+    if (job == NULL) return 0;
+    // Change the limits of every running process of the job.
+    for (int i = 0; i < job->num_procs; i++) {
+        if (job->procs[i].state == PROC_DONE) continue;
+        if (set_process_limits(job->procs[i].pid, &limits) == -1) {
+            printf("limit: %d: %s\n", job->procs[i].pid, strerror(errno));
+            return 1;
+        }
+    }
+    for (int i = 0; i < NUM_JOB_LIMITS; i++)
+        if (limits.mask & (1 << i)) job->limits.values[i] = limits.values[i];
+    job->limits.mask |= limits.mask;
+    return 0;
+}
+
+typedef struct {
+    // Input line number of the command.
+    int seq;
+    // Command line.
+    char *cmd;
+    // Wait status of the command, once it has finished.
+    int status;
+    int done;
+    struct parallel_run *run;
+} parallel_cmd_t;
+
+typedef struct parallel_run {
+    // Number of running commands.
+    int running;
+    // Whether the results are reported in input order.
+    int keep_order;
+    // Commands not reported yet (only kept when reporting in input order).
+    parallel_cmd_t **cmds;
+    int count, cap, next_report;
+    // Number of commands that failed.
+    int failed;
+} parallel_run_t;
+
+static void report_parallel_cmd(parallel_cmd_t *cmd) {
+    if (WIFSIGNALED(cmd->status)) printf("[%d] signal %d\t%s\n", cmd->seq, WTERMSIG(cmd->status), cmd->cmd);
+    else printf("[%d] exit %d\t%s\n", cmd->seq, WEXITSTATUS(cmd->status), cmd->cmd);
+    if (!WIFEXITED(cmd->status) || WEXITSTATUS(cmd->status) != 0) cmd->run->failed++;
+    free(cmd->cmd);
+    free(cmd);
+}
+
+static void finish_parallel_cmd(parallel_cmd_t *cmd, int status) {
+    parallel_run_t *run = cmd->run;
+    cmd->status = status;
+    cmd->done = 1;
+    if (!run->keep_order) {
+        report_parallel_cmd(cmd);
+        return;
+    }
+    // Report the finished commands at the front of the input order.
+    while (run->next_report < run->count && run->cmds[run->next_report]->done)
+        report_parallel_cmd(run->cmds[run->next_report++]);
+    fflush(stdout);
+}
+
+// Called by the reaping path when a job started by parallel has finished.
+static void parallel_job_done(job_t *job, void *data) {
+    parallel_cmd_t *cmd = data;
+    cmd->run->running--;
+    finish_parallel_cmd(cmd, job->status);
+}
+
+int parallel(job_list_t *job_list, char *args[]) {
+    int max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    parallel_run_t run = {0};
+    const char *file = NULL;
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-j") == 0 && args[i + 1] != NULL) max_jobs = atoi(args[++i]);
+        else if (strcmp(args[i], "-k") == 0) run.keep_order = 1;
+        else file = args[i];
+    }
+    if (max_jobs < 1) {
+        fprintf(stderr, "parallel: invalid number of jobs\n");
+        return 1;
+    }
+    // Read from the file, or from the shell's own stdin reader so no buffered input is lost.
+    reader_t own_reader, *reader = stdin_reader;
+    if (file != NULL) {
+        int fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(file);
+            return 1;
+        }
+        init_reader(&own_reader, fd);
+        reader = &own_reader;
+    }
+    else if (reader == NULL) {
+        init_reader(&own_reader, STDIN_FILENO);
+        reader = &own_reader;
+    }
+    arena_t arena;
+    arena_init(&arena);
+    command_line_t cmd_line;
+    int seq = 0, eof = 0;
+    while (1) {
+        // Start commands until all the slots are taken.
+        while (!eof && run.running < max_jobs) {
+            char *line = read_line(reader);
+            if (line == NULL) {
+                eof = 1;
+                break;
+            }
+            seq++;
+            char *cmd_str = strdup(line);
+            arena_reset(&arena);
+            parse_args(line, &arena, &cmd_line);
+            // The commands up to the first separator other than a pipe form the job.
+            int num_stages = 0;
+            while (num_stages < cmd_line.count) {
+                if (cmd_line.cmds[num_stages].argc == 0) break;
+                if (cmd_line.cmds[num_stages++].separator != '|') break;
+            }
+            if (num_stages == 0) {
+                free(cmd_str);
+                continue;
+            }
+            // A line with more than one pipeline, or with command substitutions, runs as a whole in a subshell.
+            int whole_line = cmd_line.cmds[num_stages - 1].separator == SEP_AND || cmd_line.cmds[num_stages - 1].separator == SEP_OR;
+            for (int i = 0; i < cmd_line.count; i++)
+                whole_line |= cmd_line.cmds[i].source != NULL || (i >= num_stages && cmd_line.cmds[i].argc > 0);
+            char *group_args[] = {group_open, cmd_str, group_close, NULL};
+            command_t group = {group_args, 3, '&', cmd_str, NULL};
+            parallel_cmd_t *cmd = malloc(sizeof(parallel_cmd_t));
+            cmd->seq = seq;
+            cmd->cmd = cmd_str;
+            cmd->done = 0;
+            cmd->run = &run;
+            if (run.keep_order) {
+                if (run.count == run.cap) {
+                    run.cap = run.cap ? run.cap * 2 : 64;
+                    run.cmds = realloc(run.cmds, sizeof(parallel_cmd_t *) * run.cap);
+                }
+                run.cmds[run.count++] = cmd;
+            }
+            // Only -j limits the commands running at once: they do not wait for admission.
+            launch_attr_t launch = {NULL, 0, -1, 0, 0, 1};
+            job_t *job = whole_line ? launch_job(job_list, &group, 1, 1, &launch)
+                                    : launch_job(job_list, cmd_line.cmds, num_stages, 1, &launch);
+            // A command that cannot be started counts as "command not found".
+            if (job == NULL) finish_parallel_cmd(cmd, 127 << 8);
+            else {
+                job->on_done = parallel_job_done;
+                job->done_data = cmd;
+                run.running++;
+            }
+        }
+        if (run.running == 0 && eof) break;
+        // Sleep until a child changes state; the reaping path frees the slots.
+        event_run(-1);
+    }
+    printf("parallel: %d commands, %d failed\n", seq, run.failed);
+    free(run.cmds);
+    arena_free(&arena);
+    if (reader == &own_reader) {
+        if (own_reader.fd != STDIN_FILENO) close(own_reader.fd);
+        free_reader(&own_reader);
+    }
+    return run.failed > 0;
+}
+
+int pin(job_list_t *job_list, char *args[]) {
+    if (args[1] == NULL || args[1][0] != '%') {
+        printf("pin: usage: pin %%job [cpulist]\n");
+        return 1;
+    }
+    job_t *job = get_job_by_id(job_list, atoi(args[1] + 1));
+    if (job == NULL) {
+        printf("pin: job not found\n");
+        return 1;
+    }
+    if (job->state == QUEUED) {
+        printf("pin: job %d is queued\n", job->pgid);
+        return 1;
+    }
+    char cpus[128];
+    if (args[2] == NULL) {
+        // Print the affinity of the process group leader.
+        if (format_affinity(job->pid, cpus, sizeof(cpus)) == NULL) {
+            perror("pin");
+            return 1;
+        }
+        printf("[%d] %d cpus: %s\n", job->pgid, job->pid, cpus);
+        return 0;
+    }
+    if (pin_process_group(job->pid, args[2]) == -1) {
+        if (errno == EINVAL) printf("pin: invalid cpu list '%s'\n", args[2]);
+        else perror("pin");
+        return 1;
+    }
+    job->pinned = 1;
+    return 0;
+}
+
+int set(job_list_t *job_list, char *args[]) {
+    if (args[1] == NULL) {
+        print_options();
+        return 0;
+    }
+    if (args[2] == NULL) {
+        fprintf(stderr, "set: usage: set <option> <value>\n");
+        return 1;
+    }
+    if (set_option(args[1], args[2]) == -1) {
+        fprintf(stderr, "set: invalid option or value: %s %s\n", args[1], args[2]);
+        return 1;
+    }
+    return 0;
+}
+
+int stats(job_list_t *job_list, char *args[]) {
+    int json = 0, reset = 0;
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-j") == 0) json = 1;
+        else if (strcmp(args[i], "-r") == 0) reset = 1;
+        else {
+            printf("stats: usage: stats [-j] [-r]\n");
+            return 1;
+        }
+    }
+    stats_print(json);
+    if (reset) stats_reset();
+    return 0;
 }
\ No newline at end of file
@@ -1,30 +1,66 @@
+#include "arena.h"
 #include "job_control.h"
 
 #ifndef UTILS_H
 #define UTILS_H
 
-#define MAX_LINE 2048
-#define ARG_LEN 128
-#define MAX_ARGS 20
-#define MAX_CMDS 10
 #define PATH_LEN 128
+#define NUM_BUILTINS 13
+
+// Separators of the commands joined by && and ||.
+#define SEP_AND 'A'
+#define SEP_OR 'O'
 
 extern const char *prog_dir[2];
-extern const char *builtin_cmd[5];
-extern void (*const builtin_func[5])(job_list_t *, char **args);
+extern const char *builtin_cmd[NUM_BUILTINS];
+// Built-in commands return their exit status (0 on success, 1 on error).
+extern int (*const builtin_func[NUM_BUILTINS])(job_list_t *, char **args);
+// First and last arguments of a ( ... ) group, around its command line.
+extern char group_open[], group_close[];
+
+typedef struct {
+    // Arguments of the command (NULL-terminated).
+    char **args;
+    // Number of arguments.
+    int argc;
+    // Separator after the command ('&', '|', ';', SEP_AND, SEP_OR or '\0' for the last one).
+    char separator;
+    // Command line of a ( ... ) group, run in a subshell (NULL for a simple command). The
+    // arguments of a group are "(", the command line and ")", unless there is a syntax error.
+    char *group;
+    // Text of a command with command substitutions, substituted and parsed again right before
+    // its pipeline runs (see execute_line), or NULL. Its only argument is the text until then.
+    char *source;
+} command_t;
+
+typedef struct {
+    // Commands of the line.
+    command_t *cmds;
+    // Number of commands.
+    int count;
+} command_line_t;
 
 /*
  * Function: parse_args
  * -------------------
  *   Parse the command line and split it into arguments.
- *   It can handle escaped whitespace and quoted strings with spaces as well.
- *   (Even though it's not required in the assignment)
+ *   It can handle escaped characters and single or double quoted strings with spaces as well.
  *
- *   line: the command line
- *   args: the array of arguments
- *   arg_count: the number of arguments
+ *   Commands are separated by & (run in the background), | (piped into the next command), ;
+ *   (run one after the other), && or || (run the next pipeline if the last one succeeded or failed).
+ *   A command in parentheses is a group, whose command line is parsed again by its subshell.
+ *   A command with a $(cmd) or `cmd` substitution is not split into arguments: its text is
+ *   kept in source, so the substitution only runs if and when the command does.
+ *   The unquoted braces and wildcards of an argument are expanded (see expand_word).
+ *   The arguments are unquoted in place in the line, and the argument and command arrays
+ *   are allocated from the arena, so there is no limit on their number and the whole line
+ *   is released with a single arena_reset.
+ *
+ *   line: the command line (modified)
+ *   arena: the arena for the arrays
+ *   cmd_line: the parsed commands
  */
-void parse_args(char *line, char *args[][MAX_ARGS], int arg_count[], int *cmd_count);
+void parse_args(char *line, arena_t *arena, command_line_t *cmd_line);
 
 /*
  * Function: bg
@@ -34,7 +70,7 @@ void parse_args(char *line, char *args[][MAX_ARGS], int arg_count[], int *cmd_co
  *   job_list: the job list
  *   pgid: the job ID
  */
-void bg(job_list_t *job_list, char **args);
+int bg(job_list_t *job_list, char **args);
 
 /*
  * Function: cd
@@ -45,7 +81,18 @@ void bg(job_list_t *job_list, char **args);
  * 
  *   path: the path
  */
-void cd(job_list_t *job_list, char **args);
+int cd(job_list_t *job_list, char **args);
+
+/*
+ * Function: deadline
+ * ------------------
+ *   Show or change the time limit of a job ("deadline %N [duration [-k grace] | off]"),
+ *   counted from now: without a duration, print when the next signal is sent to the job.
+ *   A job reaching its time limit gets SIGTERM, then SIGKILL after the grace period.
+ *
+ *   job_list: the job list
+ */
+int deadline(job_list_t *job_list, char **args);
 
 /*
  * Function: fg
@@ -55,25 +102,108 @@ void cd(job_list_t *job_list, char **args);
  *   job_list: the job list
  *   pgid: the job ID
  */
-void fg(job_list_t *job_list, char **args);
+int fg(job_list_t *job_list, char **args);
+
+/*
+ * Function: hash
+ * --------------
+ *   Show or reset the remembered locations of commands.
+ *   With -r, forget all the locations. With command names, look them up and remember them.
+ * 
+ *   job_list: the job list
+ */
+int hash(job_list_t *job_list, char **args);
+
+/*
+ * Function: history
+ * -----------------
+ *   Print the command history ("history [-l] [-s text] [n]"): the last n entries, or with -s
+ *   the last n entries containing text. With -l, also print when each command was entered,
+ *   its exit status and its duration.
+ *
+ *   job_list: the job list
+ */
+int history(job_list_t *job_list, char **args);
 
 /*
  * Function: jobs
  * --------------
- *   Print the list of jobs.
+ *   Print the list of jobs ("jobs [-l]", "jobs -o %N" or "jobs --watch [interval]").
+ *   With -l, also print the start time, elapsed time and resource usage of every job.
+ *   With -o, print the captured output of a background job (see "set capture").
+ *   With --watch, show the CPU, memory and I/O usage of the jobs every interval (1s by default, see watch_jobs).
  * 
  *   job_list: the job list
  */
-void jobs(job_list_t *job_list, char **args);
+int jobs(job_list_t *job_list, char **args);
 
 /*
  * Function: kill_job
  * ------------------
- *   Send a SIGTERM signal to a job.
+ *   Send a SIGTERM signal to a job, without waiting for it to finish.
  * 
  *   job_list: the job list
  *   pgid: the job ID
  */
-void kill_job(job_list_t *job_list, char **args);
+int kill_job(job_list_t *job_list, char **args);
+
+/*
+ * Function: limit
+ * ---------------
+ *   Show or change resource limits (as, cpu, nofile and nproc):
+ *     limit                           print the limits of background jobs
+ *     limit -b name=value ...         set the limits of background jobs ("unlimited" clears one)
+ *     limit %N name=value ...         change the limits of the running processes of job N (prlimit)
+ *     limit name=value ... command    run a command with limits (handled by execute_line)
+ * 
+ *   job_list: the job list
+ */
+int limit(job_list_t *job_list, char **args);
+
+/*
+ * Function: parallel
+ * ------------------
+ *   Run the commands read from a file (or stdin), one per line, as background jobs,
+ *   with at most N of them running at once ("parallel [-j N] [-k] [file]").
+ *   A line with several pipelines (joined by ;, &&, || or &) or with command substitutions
+ *   runs as a whole in a subshell. A new command is started as soon as a running one
+ *   finishes, and the exit status of every command is reported as it finishes (in input
+ *   order with -k).
+ *   N defaults to the number of online CPUs. The commands start without waiting for
+ *   admission (see admit_job), N is their only limit.
+ * 
+ *   job_list: the job list
+ */
+int parallel(job_list_t *job_list, char **args);
+
+/*
+ * Function: pin
+ * -------------
+ *   Pin a job to CPUs ("pin %job cpulist", e.g. "pin %1 0-3,6") with sched_setaffinity on every
+ *   thread of every process in its process group, or print its affinity ("pin %job").
+ * 
+ *   job_list: the job list
+ */
+int pin(job_list_t *job_list, char **args);
+
+/*
+ * Function: set
+ * -------------
+ *   Print the shell options, or set one of them ("set <name> <value>").
+ * 
+ *   job_list: the job list
+ */
+int set(job_list_t *job_list, char **args);
+
+/*
+ * Function: stats
+ * ---------------
+ *   Print the shell's instrumentation counters and latency histograms ("stats [-j] [-r]"):
+ *   forks, execs, path probes, SIGCHLDs, wait calls and job list operations, and the
+ *   fork to exec, foreground wait and parse times. -j prints JSON, -r resets them afterwards.
+ * 
+ *   job_list: the job list
+ */
+int stats(job_list_t *job_list, char **args);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "event_loop.h"
+#include "watchdog.h"
+
+#define WHEEL_WORDS (WHEEL_SLOTS / 64)
+
+int timeout_grace = 5;
+
+// Jobs whose timer fires at a tick of the slot (linked through job->timer_next, in any round),
+// and the slots that have one, to find the next one without scanning the empty slots.
+static job_t *wheel[WHEEL_SLOTS];
+static unsigned long long occupied[WHEEL_WORDS];
+static int armed_count = 0;
+// Last tick the slots were processed up to, and tick the timer is set for (0 if it is not).
+static long long current_tick = 0, timer_tick = 0;
+static int timer_fd = -1;
+
+static long long now_tick(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000LL + now.tv_nsec / 1000000) / WHEEL_TICK_MS;
+}
+
+// Set the timer to go off at a tick (0 to stop it).
+static void arm_timer(long long tick) {
+    timer_tick = tick;
+    if (timer_fd == -1) return;
+    long long ms = tick * WHEEL_TICK_MS;
+    struct itimerspec when = {{0, 0}, {ms / 1000, ms % 1000 * 1000000}};
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+// Set the timer for the first occupied slot after the current tick (a job there may be due in a later round).
+static void arm_next_slot(void) {
+    if (armed_count == 0) {
+        arm_timer(0);
+        return;
+    }
+    unsigned int start = (current_tick + 1) & (WHEEL_SLOTS - 1);
+    for (unsigned int n = 0; n <= WHEEL_WORDS; n++) {
+        unsigned int word = (start / 64 + n) % WHEEL_WORDS;
+        unsigned long long bits = occupied[word];
+        // Only the slots from the start on in its own word (the rest comes around at the end).
+        if (n == 0) bits &= ~0ULL << (start % 64);
+        else if (n == WHEEL_WORDS) bits &= ~(~0ULL << (start % 64));
+        if (bits == 0) continue;
+        unsigned int slot = word * 64 + __builtin_ctzll(bits);
+        arm_timer(current_tick + 1 + ((slot - start) & (WHEEL_SLOTS - 1)));
+        return;
+    }
+}
+
+static void unlink_timer(job_t *job) {
+    unsigned int slot = job->expires & (WHEEL_SLOTS - 1);
+    if (job->timer_prev != NULL) job->timer_prev->timer_next = job->timer_next;
+    else wheel[slot] = job->timer_next;
+    if (job->timer_next != NULL) job->timer_next->timer_prev = job->timer_prev;
+    if (wheel[slot] == NULL) occupied[slot / 64] &= ~(1ULL << (slot % 64));
+    job->expires = 0;
+    armed_count--;
+}
+
+static void schedule(job_t *job, int delay_ms) {
+    // Nothing was armed, so the slots passed since the last time hold no jobs.
+    if (armed_count == 0) current_tick = now_tick();
+    long long ticks = (delay_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    job->expires = now_tick() + (ticks > 0 ? ticks : 1);
+    unsigned int slot = job->expires & (WHEEL_SLOTS - 1);
+    job->timer_prev = NULL;
+    job->timer_next = wheel[slot];
+    if (wheel[slot] != NULL) wheel[slot]->timer_prev = job;
+    wheel[slot] = job;
+    occupied[slot / 64] |= 1ULL << (slot % 64);
+    armed_count++;
+    if (timer_tick == 0 || job->expires < timer_tick) arm_timer(job->expires);
+}
+
+// Send a signal to the processes of a job (without job control, they are in the shell's process group).
+static void signal_job(job_t *job, int signal) {
+    if (job_control) {
+        killpg(job->pid, signal);
+        return;
+    }
+    for (int i = 0; i < job->num_procs; i++)
+        if (job->procs[i].state != PROC_DONE) kill(job->procs[i].pid, signal);
+}
+
+static void expire(job_t *job) {
+    if (job->timed_out) {
+        job->timed_out = 2;
+        signal_job(job, SIGKILL);
+        return;
+    }
+    job->timed_out = 1;
+    signal_job(job, SIGTERM);
+    // A stopped job would only get the signal once continued.
+    if (job->state == STOPPED) signal_job(job, SIGCONT);
+    if (job->grace_ms > 0) schedule(job, job->grace_ms);
+}
+
+static void timer_callback(int fd, unsigned int events, void *data) {
+    unsigned long long expirations;
+    while (read(fd, &expirations, sizeof(expirations)) > 0);
+    long long now = now_tick();
+    // Each slot is visited once per tick (or once in all if the shell was busy for a whole round),
+    // and only its jobs that are due in this round expire.
+    long long end = now - current_tick > WHEEL_SLOTS ? current_tick + WHEEL_SLOTS : now;
+    for (long long tick = current_tick + 1; tick <= end; tick++) {
+        unsigned int slot = tick & (WHEEL_SLOTS - 1);
+        if (!(occupied[slot / 64] & (1ULL << (slot % 64)))) continue;
+        job_t *next;
+        for (job_t *job = wheel[slot]; job != NULL; job = next) {
+            next = job->timer_next;
+            if (job->expires > now) continue;
+            unlink_timer(job);
+            expire(job);
+        }
+    }
+    current_tick = now;
+    timer_tick = 0;
+    arm_next_slot();
+}
+
+void init_watchdog(void) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) perror("timerfd_create");
+    else event_add(timer_fd, EPOLLIN, timer_callback, NULL);
+}
+
+void reset_watchdog(void) {
+    // The jobs of the wheel were the parent's, and the timer is shared with it.
+    memset(wheel, 0, sizeof(wheel));
+    memset(occupied, 0, sizeof(occupied));
+    armed_count = 0;
+    timer_tick = 0;
+    if (timer_fd != -1) close(timer_fd);
+    init_watchdog();
+}
+
+int parse_duration(const char *str) {
+    char *end;
+    double seconds = strtod(str, &end);
+    if (end == str || !isfinite(seconds) || seconds < 0) return -1;
+    if (strcmp(end, "ms") == 0) seconds /= 1000;
+    else if (strcmp(end, "m") == 0) seconds *= 60;
+    else if (strcmp(end, "h") == 0) seconds *= 3600;
+    else if (strcmp(end, "d") == 0) seconds *= 86400;
+    else if (*end != '\0' && strcmp(end, "s") != 0) return -1;
+    if (seconds * 1000 > 0x7fffffff) return -1;
+    // Round up, so a short duration is not 0 (no time limit).
+    int ms = (int) (seconds * 1000);
+    return ms < seconds * 1000 ? ms + 1 : ms;
+}
+
+void set_deadline(job_t *job, int timeout_ms, int grace_ms) {
+    cancel_deadline(job);
+    job->timeout_ms = timeout_ms;
+    job->grace_ms = grace_ms;
+    job->timed_out = 0;
+    if (timeout_ms > 0 && job->state != QUEUED) schedule(job, timeout_ms);
+}
+
+void cancel_deadline(job_t *job) {
+    if (job->expires != 0) unlink_timer(job);
+}
+
+double deadline_remaining(const job_t *job) {
+    if (job->expires == 0) return -1;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double left = job->expires * (WHEEL_TICK_MS / 1e3) - (now.tv_sec + now.tv_nsec / 1e9);
+    return left > 0 ? left : 0;
+}
@@ -0,0 +1,78 @@
+#include "job_control.h"
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+// Resolution of the time limits, and number of slots of the timer wheel (a power of two, one round is about 41s).
+#define WHEEL_TICK_MS 10
+#define WHEEL_SLOTS 4096
+
+// Exit status of a job that reached its time limit, as for timeout(1).
+#define TIMED_OUT_STATUS (124 << 8)
+
+// Seconds between SIGTERM and SIGKILL when no grace period is given (set with "set timeout_grace <s>", 0 to never send SIGKILL).
+extern int timeout_grace;
+
+/*
+ * Function: init_watchdog
+ * -----------------------
+ *   Create the timer of the time limits of the jobs, watched by the event loop.
+ *   The timers of all the jobs are kept in a hashed timer wheel, and the timer only
+ *   fires for the next slot that has one, so the shell is not woken up while no job
+ *   has a time limit, and arming or cancelling the time limit of a job is O(1).
+ */
+void init_watchdog(void);
+
+/*
+ * Function: reset_watchdog
+ * ------------------------
+ *   Empty the timer wheel in a forked subshell (whose job list was reset), and give it its own timer.
+ */
+void reset_watchdog(void);
+
+/*
+ * Function: parse_duration
+ * ------------------------
+ *   Parse a duration: a number of seconds (e.g. "1.5"), with an optional ms, s, m, h or d suffix.
+ *
+ *   str: the duration
+ *
+ *   returns: the duration in ms, or -1 if it is invalid
+ */
+int parse_duration(const char *str);
+
+/*
+ * Function: set_deadline
+ * ----------------------
+ *   Give a job a time limit, counted from now, replacing the one it had. When it is reached,
+ *   SIGTERM (and SIGCONT, for a stopped job) is sent to the processes of the job, then SIGKILL
+ *   after the grace period. The job then finishes with TIMED_OUT_STATUS, and is reported as
+ *   timed out. The time limit of a QUEUED job starts when the job is dispatched.
+ *
+ *   job: the job
+ *   timeout_ms: the time limit in ms (0 to remove it)
+ *   grace_ms: the grace period in ms (0 to never send SIGKILL)
+ */
+void set_deadline(job_t *job, int timeout_ms, int grace_ms);
+
+/*
+ * Function: cancel_deadline
+ * -------------------------
+ *   Disarm the timer of a job (e.g. when it is deleted).
+ *
+ *   job: the job
+ */
+void cancel_deadline(job_t *job);
+
+/*
+ * Function: deadline_remaining
+ * ----------------------------
+ *   Get the time left until the next signal is sent to a job.
+ *
+ *   job: the job
+ *
+ *   returns: the time left in seconds, or -1 if the timer of the job is not armed
+ */
+double deadline_remaining(const job_t *job);
+
+#endif